@@ -5,13 +5,12 @@
 
    Extract a Tar - Tar Extractor
 
-   Some performance measurements showed that zlib performed quite poorly
-   in comparison to a forked gzip process. This tar extractor makes use
-   of the fact that dup'd file descriptors have the same seek pointer
-   and that gzip will not read past the end of a compressed stream, 
-   even if there is more data. We use the dup property to track extraction
-   progress and the gzip feature to just feed gzip a fd in the middle
-   of an AR file. 
+   The tar stream is decompressed in-process by the FileFd compressor
+   backends, which just like a forked gzip will not read past the end of
+   a compressed stream, even if there is more data. We use this to just
+   feed the decompressor a fd in the middle of an AR file. The
+   decompressed stream is read in large chunks into a buffer and the
+   headers and file contents are handed out directly from it.
    
    ##################################################################### */
 									/*}}}*/
@@ -27,6 +26,7 @@
 
 #include <string.h>
 #include <algorithm>
+#include <memory>
 #include <string>
 #include <unistd.h>
 #include <signal.h>
@@ -57,6 +57,54 @@ struct ExtractTar::TarHeader
    char Minor[8];      
 };
    
+// TarBuffer - Hands out blocks of a tar stream from a big buffer	/*{{{*/
+class APT_HIDDEN TarBuffer
+{
+   static constexpr size_t BufferSize = 128 * 1024;
+   FileFd &InFd;
+   std::unique_ptr<unsigned char[]> Buffer;
+   size_t Start;
+   size_t End;
+
+   public:
+   /** \brief make at least Min bytes available, unless the stream ends before */
+   bool Fill(unsigned long long const Min)
+   {
+      if (End - Start >= Min)
+	 return true;
+      if (Start != End)
+	 memmove(Buffer.get(), Buffer.get() + Start, End - Start);
+      End -= Start;
+      Start = 0;
+      while (End < std::min<unsigned long long>(Min, BufferSize))
+      {
+	 unsigned long long Actual = 0;
+	 if (InFd.Read(Buffer.get() + End, BufferSize - End, &Actual) == false)
+	    return false;
+	 if (Actual == 0)
+	    break;
+	 End += Actual;
+      }
+      return true;
+   }
+   size_t Available() const { return End - Start; }
+   unsigned char * Data() const { return Buffer.get() + Start; }
+   void Consume(size_t const Size) { Start += Size; }
+   /** \brief get the next Size bytes or fail with a corrupted archive error */
+   bool Get(unsigned char * &Data, unsigned long long const Size)
+   {
+      if (Fill(Size) == false)
+	 return false;
+      if (Available() < Size)
+	 return _error->Error(_("Corrupted archive"));
+      Data = this->Data();
+      Consume(Size);
+      return true;
+   }
+
+   explicit TarBuffer(FileFd &InFd) : InFd(InFd), Buffer(new unsigned char[BufferSize]), Start(0), End(0) {}
+};
+									/*}}}*/
 // ExtractTar::ExtractTar - Constructor					/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -86,11 +134,12 @@ bool ExtractTar::Done()
    return InFd.Close();
 }
 									/*}}}*/
-// ExtractTar::StartGzip - Startup gzip					/*{{{*/
+// ExtractTar::StartGzip - Startup the decompressor			/*{{{*/
 // ---------------------------------------------------------------------
-/* This creates a gzip sub process that has its input as the file itself.
-   If this tar file is embedded into something like an ar file then 
-   gzip will efficiently ignore the extra bits. */
+/* This opens the file itself with the compressor matching the given name
+   and for compatibility with older callers binary. If this tar file is
+   embedded into something like an ar file then the decompressor will
+   efficiently ignore the extra bits. */
 bool ExtractTar::StartGzip()
 {
    if (DecompressProg.empty())
@@ -100,12 +149,13 @@ bool ExtractTar::StartGzip()
    }
 
    std::vector<APT::Configuration::Compressor> const compressors = APT::Configuration::getCompressors();
-   std::vector<APT::Configuration::Compressor>::const_iterator compressor = compressors.begin();
-   for (; compressor != compressors.end(); ++compressor) {
-      if (compressor->Name == DecompressProg) {
-	 return InFd.OpenDescriptor(File.Fd(), FileFd::ReadOnly, *compressor, false);
-      }
-   }
+   auto compressor = std::find_if(compressors.begin(), compressors.end(),
+	 [&](APT::Configuration::Compressor const &c) { return c.Name == DecompressProg; });
+   if (compressor == compressors.end())
+      compressor = std::find_if(compressors.begin(), compressors.end(),
+	    [&](APT::Configuration::Compressor const &c) { return c.Binary == DecompressProg; });
+   if (compressor != compressors.end())
+      return InFd.OpenDescriptor(File.Fd(), FileFd::ReadOnly, *compressor, false);
 
    return _error->Error(_("Cannot find a configured compressor for '%s'"),
 			DecompressProg.c_str());
@@ -121,6 +171,7 @@ bool ExtractTar::Go(pkgDirStream &Stream)
 {   
    if (StartGzip() == false)
       return false;
+   TarBuffer Buffer(InFd);
    
    // Loop over all blocks
    string LastLongLink, ItemLink;
@@ -128,12 +179,13 @@ bool ExtractTar::Go(pkgDirStream &Stream)
    while (1)
    {
       bool BadRecord = false;      
-      unsigned char Block[512];      
-      if (InFd.Read(Block,sizeof(Block),true) == false)
+      size_t const BlockSize = 512;
+      if (Buffer.Fill(BlockSize) == false)
 	 return false;
-      
-      if (InFd.Eof() == true)
+      if (Buffer.Available() < BlockSize)
 	 break;
+      unsigned char * const Block = Buffer.Data();
+      Buffer.Consume(BlockSize);
 
       // Get the checksum
       TarHeader *Tar = (TarHeader *)Block;
@@ -145,7 +197,7 @@ bool ExtractTar::Go(pkgDirStream &Stream)
          with spaces so it is not included in the computation */
       unsigned long NewSum = 0;
       memset(Tar->Checksum,' ',sizeof(Tar->Checksum));
-      for (int I = 0; I != sizeof(Block); I++)
+      for (size_t I = 0; I != BlockSize; I++)
 	 NewSum += Block[I];
       
       /* Check for a block of nulls - in this case we kill gzip, GNU tar
@@ -222,18 +274,18 @@ bool ExtractTar::Go(pkgDirStream &Stream)
 	 case GNU_LongLink:
 	 {
 	    unsigned long long Length = Itm.Size;
-	    unsigned char Block[512];
 	    while (Length > 0)
 	    {
-	       if (InFd.Read(Block,sizeof(Block),true) == false)
+	       unsigned char *Block = nullptr;
+	       if (Buffer.Get(Block, BlockSize) == false)
 		  return false;
-	       if (Length <= sizeof(Block))
+	       if (Length <= BlockSize)
 	       {
-		  LastLongLink.append(Block,Block+sizeof(Block));
+		  LastLongLink.append(Block,Block+BlockSize);
 		  break;
 	       }	       
-	       LastLongLink.append(Block,Block+sizeof(Block));
-	       Length -= sizeof(Block);
+	       LastLongLink.append(Block,Block+BlockSize);
+	       Length -= BlockSize;
 	    }
 	    continue;
 	 }
@@ -241,18 +293,18 @@ bool ExtractTar::Go(pkgDirStream &Stream)
 	 case GNU_LongName:
 	 {
 	    unsigned long long Length = Itm.Size;
-	    unsigned char Block[512];
 	    while (Length > 0)
 	    {
-	       if (InFd.Read(Block,sizeof(Block),true) == false)
+	       unsigned char *Block = nullptr;
+	       if (Buffer.Get(Block, BlockSize) == false)
 		  return false;
-	       if (Length < sizeof(Block))
+	       if (Length < BlockSize)
 	       {
-		  LastLongName.append(Block,Block+sizeof(Block));
+		  LastLongName.append(Block,Block+BlockSize);
 		  break;
 	       }	       
-	       LastLongName.append(Block,Block+sizeof(Block));
-	       Length -= sizeof(Block);
+	       LastLongName.append(Block,Block+BlockSize);
+	       Length -= BlockSize;
 	    }
 	    continue;
 	 }
@@ -268,20 +320,22 @@ bool ExtractTar::Go(pkgDirStream &Stream)
 	 if (Stream.DoItem(Itm,Fd) == false)
 	    return false;
       
-      // Copy the file over the FD
+      // Copy the file over the FD straight out of the buffer
       unsigned long long Size = Itm.Size;
       while (Size != 0)
       {
-	 unsigned char Junk[32*1024];
-	 unsigned long Read = min(Size, (unsigned long long)sizeof(Junk));
-	 if (InFd.Read(Junk,((Read+511)/512)*512) == false)
+	 if (Buffer.Fill(Size) == false)
 	    return false;
+	 unsigned long const Read = min(Size, (unsigned long long)Buffer.Available());
+	 if (Read == 0)
+	    return _error->Error(_("Corrupted archive"));
+	 unsigned char const * const Junk = Buffer.Data();
 	 
 	 if (BadRecord == false)
 	 {
 	    if (Fd > 0)
 	    {
-	       if (write(Fd,Junk,Read) != (signed)Read)
+	       if (FileFd::Write(Fd,Junk,Read) == false)
 		  return Stream.Fail(Itm,Fd);
 	    }
 	    else
@@ -294,8 +348,13 @@ bool ExtractTar::Go(pkgDirStream &Stream)
 	    }
 	 }
 	 
+	 Buffer.Consume(Read);
 	 Size -= Read;
       }
+      // skip the padding to the next block
+      unsigned char *Padding;
+      if (Buffer.Get(Padding, (BlockSize - Itm.Size % BlockSize) % BlockSize) == false)
+	 return false;
       
       // And finish up
       if (BadRecord == false)
@@ -5,7 +5,7 @@
 
    Extract a Tar - Tar Extractor
    
-   The tar extractor takes an ordinary gzip compressed tar stream from 
+   The tar extractor takes an ordinary (compressed) tar stream from 
    the given file and explodes it, passing the individual items to the
    given Directory Stream for processing.
    
@@ -46,7 +46,7 @@ class ExtractTar
    bool Eof;
    std::string DecompressProg;
    
-   // Fork and reap gzip
+   // Open and close the decompressor
    bool StartGzip();
    bool Done();
    APT_DEPRECATED_MSG("Parameter Force is ignored, use Done() instead.") bool Done(bool Force);
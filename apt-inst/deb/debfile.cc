@@ -50,7 +50,8 @@ debDebFile::debDebFile(FileFd &File) : File(File), AR(File)
 
    if (!CheckMember("control.tar") &&
        !CheckMember("control.tar.gz") &&
-       !CheckMember("control.tar.xz")) {
+       !CheckMember("control.tar.xz") &&
+       !CheckMember("control.tar.zst")) {
       _error->Error(_("This is not a valid DEB archive, missing '%s' member"), "control.tar");
       return;
    }
@@ -59,7 +60,8 @@ debDebFile::debDebFile(FileFd &File) : File(File), AR(File)
        !CheckMember("data.tar.gz") &&
        !CheckMember("data.tar.bz2") &&
        !CheckMember("data.tar.lzma") &&
-       !CheckMember("data.tar.xz")) {
+       !CheckMember("data.tar.xz") &&
+       !CheckMember("data.tar.zst")) {
       _error->Error(_("This is not a valid DEB archive, missing '%s' member"), "data.tar");
       return;
    }
@@ -113,7 +115,7 @@ bool debDebFile::ExtractTarMember(pkgDirStream &Stream,const char *Name)
       Member = AR.FindMember(std::string(Name).append(c->Extension).c_str());
       if (Member == NULL)
 	 continue;
-      Compressor = c->Binary;
+      Compressor = c->Name;
       break;
    }
 
@@ -39,6 +39,9 @@
 #include <iostream>
 #include <vector>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string>
@@ -121,6 +124,206 @@ static std::string GetExistingFilename(std::string const &File)		/*{{{*/
    return "";
 }
 									/*}}}*/
+// SharedCache - Content-addressed store shared between several roots	/*{{{*/
+/* If Dir::Cache::Shared is set, verified downloads are kept there as
+   sha256/<first two characters>/<hash> so that other roots (chroots,
+   containers, …) expecting a file with the same hash can link it instead
+   of downloading it again. A linked file is verified against the expected
+   hashes just like a download before it is accepted. Lookups and inserts
+   take a shared flock on its lock file, evicting the least recently used
+   files once the store grows over Acquire::Shared-Cache::Max-Size (in MiB)
+   takes an exclusive one. Any problem with the store just means that the
+   file is downloaded. */
+class APT_HIDDEN SharedCacheLock
+{
+   int Fd;
+public:
+   bool IsLocked() const { return Fd != -1; }
+   explicit SharedCacheLock(int const Operation) : Fd(-1)
+   {
+      std::string const LockFile = _config->FindDir("Dir::Cache::Shared") + "lock";
+      Fd = open(LockFile.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+      if (Fd != -1 && flock(Fd, Operation) != 0)
+      {
+	 close(Fd);
+	 Fd = -1;
+      }
+   }
+   ~SharedCacheLock()
+   {
+      if (Fd != -1)
+	 close(Fd);
+   }
+};
+static std::string GetSharedCacheFileName(HashStringList const &Hashes)
+{
+   if (_config->Find("Dir::Cache::Shared").empty() == true)
+      return "";
+   HashString const * const Hash = Hashes.find("SHA256");
+   if (Hash == nullptr)
+      return "";
+   std::string const Value = Hash->HashValue();
+   if (Value.length() != 64 || std::all_of(Value.begin(), Value.end(), [](char const c) { return isxdigit(c) != 0; }) == false)
+      return "";
+   return _config->FindDir("Dir::Cache::Shared") + "sha256/" + Value.substr(0, 2) + "/" + Value;
+}
+static bool LinkOrCopyFile(std::string const &From, std::string const &To)
+{
+   RemoveFile("LinkOrCopyFile", To);
+   if (link(From.c_str(), To.c_str()) == 0)
+      return true;
+   // across filesystems CopyFile will still share the data via a reflink if it can
+   FileFd In(From, FileFd::ReadOnly);
+   FileFd Out(To, FileFd::WriteOnly | FileFd::Create | FileFd::Exclusive, 0644);
+   if (CopyFile(In, Out) == true && Out.Close() == true)
+      return true;
+   RemoveFile("LinkOrCopyFile", To);
+   return false;
+}
+static bool ReadSharedCacheSize(unsigned long long &Total)
+{
+   std::string const SizeFile = _config->FindDir("Dir::Cache::Shared") + "size";
+   char Buffer[30] = "";
+   FileFd In;
+   if (RealFileExists(SizeFile) == false || In.Open(SizeFile, FileFd::ReadOnly) == false ||
+	 In.ReadLine(Buffer, sizeof(Buffer)) == nullptr)
+      return false;
+   Total = strtoull(Buffer, nullptr, 10);
+   return true;
+}
+static void WriteSharedCacheSize(unsigned long long const Total)
+{
+   std::string const SizeFile = _config->FindDir("Dir::Cache::Shared") + "size";
+   std::string const Size = std::to_string(Total);
+   FileFd Out(SizeFile, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, 0644);
+   Out.Write(Size.c_str(), Size.length());
+}
+static void EvictFromSharedCache(unsigned long long const MaxSize)
+{
+   struct Entry { std::string File; off_t Size; time_t Used; };
+   std::vector<Entry> Entries;
+   unsigned long long Total = 0;
+   std::string const Store = _config->FindDir("Dir::Cache::Shared") + "sha256/";
+   DIR * const StoreDir = opendir(Store.c_str());
+   if (StoreDir == nullptr)
+      return;
+   for (struct dirent *Prefix = readdir(StoreDir); Prefix != nullptr; Prefix = readdir(StoreDir))
+   {
+      if (Prefix->d_name[0] == '.')
+	 continue;
+      std::string const Dir = Store + Prefix->d_name + "/";
+      DIR * const D = opendir(Dir.c_str());
+      if (D == nullptr)
+	 continue;
+      for (struct dirent *Ent = readdir(D); Ent != nullptr; Ent = readdir(D))
+      {
+	 struct stat Buf;
+	 std::string const File = Dir + Ent->d_name;
+	 if (Ent->d_name[0] == '.' || stat(File.c_str(), &Buf) != 0 || S_ISREG(Buf.st_mode) == false)
+	    continue;
+	 Entries.push_back({File, Buf.st_size, Buf.st_atime});
+	 Total += Buf.st_size;
+      }
+      closedir(D);
+   }
+   closedir(StoreDir);
+   // evict down to 90%, so that not every following insert has to evict
+   if (Total > MaxSize)
+   {
+      std::sort(Entries.begin(), Entries.end(), [](Entry const &A, Entry const &B) { return A.Used < B.Used; });
+      for (auto const &E : Entries)
+      {
+	 if (Total <= MaxSize / 10 * 9)
+	    break;
+	 if (RemoveFile("EvictFromSharedCache", E.File) == true)
+	    Total -= E.Size;
+      }
+   }
+   WriteSharedCacheSize(Total);
+}
+static bool GetFromSharedCache(HashStringList const &Hashes, std::string const &To)
+{
+   std::string const File = GetSharedCacheFileName(Hashes);
+   if (File.empty() == true)
+      return false;
+   _error->PushToStack();
+   bool Found = false;
+   off_t Dropped = 0;
+   {
+      SharedCacheLock const Lock(LOCK_SH);
+      struct stat Buf;
+      if (Lock.IsLocked() && stat(File.c_str(), &Buf) == 0 &&
+	    (Hashes.FileSize() == 0 || Hashes.FileSize() == (unsigned long long)Buf.st_size))
+	 Found = LinkOrCopyFile(File, To);
+      // the store is writeable by other roots, so its content isn't trusted
+      if (Found == true && Hashes.VerifyFile(To) == false)
+      {
+	 if (_config->FindB("Debug::Acquire::Shared-Cache", false) == true)
+	    std::clog << "Dropped " << File << " as it doesn't match its hash" << std::endl;
+	 RemoveFile("GetFromSharedCache", To);
+	 if (RemoveFile("GetFromSharedCache", File) == true)
+	    Dropped = Buf.st_size;
+	 Found = false;
+      }
+      else if (Found == true)
+      {
+	 // the access time orders the files for eviction
+	 struct timespec const Times[2] = { { 0, UTIME_NOW }, { 0, UTIME_OMIT } };
+	 utimensat(AT_FDCWD, File.c_str(), Times, 0);
+      }
+   }
+   if (Dropped != 0)
+   {
+      // keep the size tracked for eviction in sync, like evicting does
+      SharedCacheLock const Lock(LOCK_EX);
+      unsigned long long Total = 0;
+      if (Lock.IsLocked() && ReadSharedCacheSize(Total) == true)
+	 WriteSharedCacheSize(Total > (unsigned long long)Dropped ? Total - Dropped : 0);
+   }
+   if (_config->FindB("Debug::Acquire::Shared-Cache", false) == true)
+      std::clog << (Found ? "Linked " : "Missed ") << File << " for " << To << std::endl;
+   _error->RevertToStack();
+   return Found;
+}
+static void AddToSharedCache(HashStringList const &Hashes, std::string const &From)
+{
+   std::string const File = GetSharedCacheFileName(Hashes);
+   if (File.empty() == true || RealFileExists(File) == true)
+      return;
+   _error->PushToStack();
+   bool Added = false;
+   {
+      SharedCacheLock const Lock(LOCK_SH);
+      std::string const Dir = flNotFile(File);
+      std::string const Temp = File + ".new." + std::to_string(getpid());
+      // link, rather than rename, to not replace a file another root added meanwhile
+      if (Lock.IsLocked() && CreateDirectory(_config->FindDir("Dir::Cache::Shared"), Dir) == true &&
+	    LinkOrCopyFile(From, Temp) == true)
+      {
+	 Added = link(Temp.c_str(), File.c_str()) == 0;
+	 RemoveFile("AddToSharedCache", Temp);
+      }
+   }
+   unsigned long long const MaxSize = _config->FindI("Acquire::Shared-Cache::Max-Size", 0) * 1024ull * 1024ull;
+   if (Added == true && MaxSize != 0)
+   {
+      SharedCacheLock const Lock(LOCK_EX);
+      struct stat Buf;
+      if (Lock.IsLocked() && stat(File.c_str(), &Buf) == 0)
+      {
+	 // without a known size the store is scanned to find it out
+	 unsigned long long Total = 0;
+	 if (ReadSharedCacheSize(Total) == false || Total + Buf.st_size > MaxSize)
+	    EvictFromSharedCache(MaxSize);
+	 else
+	    WriteSharedCacheSize(Total + Buf.st_size);
+      }
+   }
+   if (_config->FindB("Debug::Acquire::Shared-Cache", false) == true && Added == true)
+      std::clog << "Added " << From << " as " << File << std::endl;
+   _error->RevertToStack();
+}
+									/*}}}*/
 static std::string GetDiffIndexFileName(std::string const &Name)	/*{{{*/
 {
    return Name + ".diff/Index";
@@ -2765,6 +2968,10 @@ void pkgAcqIndex::Init(string const &URI, string const &URIDesc,
    Desc.Owner = this;
    Desc.ShortDesc = ShortDesc;
 
+   // Maybe another root has downloaded a file with this hash already
+   if (TransactionManager->IMSHit == false && GetFromSharedCache(GetExpectedHashes(), DestFile) == true)
+      return StageDownloadDone("Filename: " + DestFile);
+
    QueueURI(Desc);
 }
 									/*}}}*/
@@ -2829,6 +3036,9 @@ void pkgAcqIndex::Done(string const &Message,
    switch(Stage) 
    {
       case STAGE_DOWNLOAD:
+         if (StringToBool(LookupTag(Message,"IMS-Hit"),false) == false &&
+	       LookupTag(Message,"Filename") == DestFile)
+	    AddToSharedCache(Hashes, DestFile);
          StageDownloadDone(Message);
          break;
       case STAGE_DECOMPRESS_AND_VERIFY:
@@ -3111,6 +3321,16 @@ bool pkgAcqArchive::QueueNext()
 	 return true;
       }
 
+      // Maybe another root has downloaded a file with this hash already
+      if (LocalSource == false && GetFromSharedCache(ExpectedHashes, FinalFile) == true)
+      {
+	 Complete = true;
+	 Local = true;
+	 Status = StatDone;
+	 StoreFilename = DestFile = FinalFile;
+	 return true;
+      }
+
       // Create the item
       Local = false;
       QueueURI(Desc);
@@ -3144,6 +3364,8 @@ void pkgAcqArchive::Done(string const &Message, HashStringList const &Hashes,
    Rename(DestFile,FinalFile);
    StoreFilename = DestFile = FinalFile;
    Complete = true;
+   if (LocalSource == false)
+      AddToSharedCache(Hashes, FinalFile);
 }
 									/*}}}*/
 // AcqArchive::Failed - Failure handler					/*{{{*/
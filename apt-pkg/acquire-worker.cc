@@ -33,6 +33,7 @@
 #include <unistd.h>
 #include <signal.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <sstream>
 
@@ -41,9 +42,22 @@
 
 using namespace std;
 
+class pkgAcquire::Worker::Private
+{
+   public:
+   /** \brief data read from the method which isn't a complete message yet
+
+       Messages are framed in this buffer directly, so a message split
+       over several reads doesn't block the acquire loop till the rest
+       of it arrives. */
+   std::vector<char> Buffer;
+   size_t Used = 0;
+   size_t Scanned = 0;
+};
+
 // Worker::Worker - Constructor for Queue startup			/*{{{*/
 pkgAcquire::Worker::Worker(Queue *Q, MethodConfig *Cnf, pkgAcquireStatus *log) :
-   d(NULL), OwnerQ(Q), Log(log), Config(Cnf), Access(Cnf->Access),
+   d(new Private()), OwnerQ(Q), Log(log), Config(Cnf), Access(Cnf->Access),
    CurrentItem(nullptr), CurrentSize(0), TotalSize(0)
 {
    Construct();
@@ -76,6 +90,7 @@ pkgAcquire::Worker::~Worker()
 {
    close(InFd);
    close(OutFd);
+   delete d;
    
    if (Process > 0)
    {
@@ -145,11 +160,15 @@ bool pkgAcquire::Worker::Start()
    close(Pipes[2]);
    OutReady = false;
    InReady = true;
+   StateChanged();
 
    // Read the configuration data
-   if (WaitFd(InFd) == false ||
-       ReadMessages() == false)
-      return _error->Error(_("Method %s did not start correctly"),Method.c_str());
+   do
+   {
+      if (WaitFd(InFd) == false ||
+	  ReadMessages() == false)
+	 return _error->Error(_("Method %s did not start correctly"),Method.c_str());
+   } while (MessageQueue.empty() == true);
 
    RunMessages();
    if (OwnerQ != 0)
@@ -163,9 +182,65 @@ bool pkgAcquire::Worker::Start()
 /* */
 bool pkgAcquire::Worker::ReadMessages()
 {
-   if (::ReadMessages(InFd,MessageQueue) == false)
-      return MethodFailure();
-   return true;
+   auto &Buffer = d->Buffer;
+   while (true)
+   {
+      if (Buffer.size() - d->Used < 4096)
+	 Buffer.resize(std::max<size_t>(Buffer.size() * 2, 64000));
+      ssize_t const Res = read(InFd, Buffer.data() + d->Used, Buffer.size() - d->Used);
+      if (Res < 0 && errno == EINTR)
+	 continue;
+#if EAGAIN != EWOULDBLOCK
+      if (Res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+#else
+      if (Res < 0 && errno == EAGAIN)
+#endif
+	 return true;
+      // process we read from has died
+      if (Res <= 0)
+	 return MethodFailure();
+      d->Used += Res;
+
+      /* Messages end with an empty line with or without \r and all
+	 newlines following it belong to the end as well */
+      char const * const Begin = Buffer.data();
+      char const * const End = Begin + d->Used;
+      char const * Start = Begin;
+      char const * NL = Begin + d->Scanned;
+      while (true)
+      {
+	 for (; Start < End && (*Start == '\n' || *Start == '\r'); ++Start);
+	 if (NL < Start)
+	    NL = Start;
+	 NL = static_cast<char const *>(memchr(NL, '\n', End - NL));
+	 if (NL == nullptr)
+	 {
+	    NL = End;
+	    break;
+	 }
+	 char const * Next = NL + 1;
+	 if (Next < End && *Next == '\r')
+	    ++Next;
+	 if (Next == End)
+	    break;
+	 else if (*Next != '\n')
+	 {
+	    NL = Next;
+	    continue;
+	 }
+	 char const * Last = NL;
+	 for (; Last > Start && (Last[-1] == '\r' || Last[-1] == '\n'); --Last);
+	 MessageQueue.emplace_back(Start, Last);
+	 Start = Next + 1;
+	 NL = Start;
+      }
+      d->Scanned = NL - Start;
+      if (Start != Begin)
+      {
+	 d->Used = End - Start;
+	 memmove(Buffer.data(), Start, d->Used);
+      }
+   }
 }
 									/*}}}*/
 // Worker::RunMessage - Empty the message queue				/*{{{*/
@@ -191,11 +266,49 @@ static bool isDoomedItem(pkgAcquire::Item const * const Itm)
       return false;
    return TransItm->TransactionManager->State != pkgAcqTransactionItem::TransactionStarted;
 }
+/* Collects the <type>-Hash fields of a message in a single pass over it
+   rather than looking up each supported type on its own */
+static HashStringList HashesFromMessage(std::string const &Message)
+{
+   char const * const * const Types = HashString::SupportedHashes();
+   std::vector<std::pair<char const *, char const *>> Found;
+   for (char const * const * type = Types; *type != NULL; ++type)
+      Found.emplace_back(nullptr, nullptr);
+
+   char const * Line = Message.c_str();
+   char const * const End = Line + Message.length();
+   for (char const * EOL; Line < End; Line = EOL + 1)
+   {
+      EOL = static_cast<char const *>(memchr(Line, '\n', End - Line));
+      if (EOL == nullptr)
+	 EOL = End;
+      char const * const Colon = static_cast<char const *>(memchr(Line, ':', EOL - Line));
+      if (Colon == nullptr || Colon - Line <= 5 || stringcasecmp(Colon - 5, Colon, "-Hash") != 0)
+	 continue;
+      for (size_t i = 0; i < Found.size(); ++i)
+      {
+	 if (Found[i].first != nullptr || stringcasecmp(Line, Colon - 5, Types[i]) != 0)
+	    continue;
+	 char const * Value = Colon + 1;
+	 char const * ValueEnd = EOL;
+	 for (; Value < ValueEnd && isspace_ascii(*Value) != 0; ++Value);
+	 for (; ValueEnd > Value && isspace_ascii(ValueEnd[-1]) != 0; --ValueEnd);
+	 Found[i] = std::make_pair(Value, ValueEnd);
+	 break;
+      }
+   }
+
+   HashStringList List;
+   for (size_t i = 0; i < Found.size(); ++i)
+      if (Found[i].first != Found[i].second)
+	 List.push_back(HashString(Types[i], std::string(Found[i].first, Found[i].second)));
+   return List;
+}
 bool pkgAcquire::Worker::RunMessages()
 {
    while (MessageQueue.empty() == false)
    {
-      string Message = MessageQueue.front();
+      string Message = std::move(MessageQueue.front());
       MessageQueue.erase(MessageQueue.begin());
 
       if (Debug == true)
@@ -347,13 +460,7 @@ bool pkgAcquire::Worker::RunMessages()
 	       std::string const givenfilename = LookupTag(Message, "Filename");
 	       std::string const filename = givenfilename.empty() ? Itm->Owner->DestFile : givenfilename;
 	       // see if we got hashes to verify
-	       for (char const * const * type = HashString::SupportedHashes(); *type != NULL; ++type)
-	       {
-		  std::string const tagname = std::string(*type) + "-Hash";
-		  std::string const hashsum = LookupTag(Message, tagname.c_str());
-		  if (hashsum.empty() == false)
-		     ReceivedHashes.push_back(HashString(*type, hashsum));
-	       }
+	       ReceivedHashes = HashesFromMessage(Message);
 	       // not all methods always sent Hashes our way
 	       if (ReceivedHashes.usable() == false)
 	       {
@@ -585,6 +692,7 @@ bool pkgAcquire::Worker::MediaChange(string Message)
 	 clog << " -> " << Access << ':' << QuoteString(S,"\n") << endl;
       OutQueue += S;
       OutReady = true;
+      StateChanged();
       return true;
    }
 
@@ -594,6 +702,7 @@ bool pkgAcquire::Worker::MediaChange(string Message)
       clog << " -> " << Access << ':' << QuoteString(S,"\n") << endl;
    OutQueue += S;
    OutReady = true;
+   StateChanged();
    return true;
 }
 									/*}}}*/
@@ -619,6 +728,7 @@ bool pkgAcquire::Worker::SendConfiguration()
       clog << " -> " << Access << ':' << QuoteString(Message.str(),"\n") << endl;
    OutQueue += Message.str();
    OutReady = true;
+   StateChanged();
 
    return true;
 }
@@ -666,6 +776,7 @@ bool pkgAcquire::Worker::QueueItem(pkgAcquire::Queue::QItem *Item)
       clog << " -> " << Access << ':' << QuoteString(Message,"\n") << endl;
    OutQueue += Message;
    OutReady = true;
+   StateChanged();
 
    return true;
 }
@@ -687,7 +798,10 @@ bool pkgAcquire::Worker::OutFdReady()
 
    OutQueue.erase(0,Res);
    if (OutQueue.empty() == true)
+   {
       OutReady = false;
+      StateChanged();
+   }
 
    return true;
 }
@@ -722,10 +836,22 @@ bool pkgAcquire::Worker::MethodFailure()
    InReady = false;
    OutQueue = string();
    MessageQueue.erase(MessageQueue.begin(),MessageQueue.end());
+   d->Used = d->Scanned = 0;
+   StateChanged();
 
    return false;
 }
 									/*}}}*/
+// Worker::StateChanged - Tell the owner about changed Ready flags	/*{{{*/
+// ---------------------------------------------------------------------
+/* The acquire loop only looks again at workers which say something
+   changed instead of rebuilding its view of all of them each time. */
+void pkgAcquire::Worker::StateChanged()
+{
+   if (OwnerQ != nullptr)
+      OwnerQ->Owner->WorkerChanged(this);
+}
+									/*}}}*/
 // Worker::Pulse - Called periodically					/*{{{*/
 // ---------------------------------------------------------------------
 /* */
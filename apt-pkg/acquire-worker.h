@@ -46,8 +46,8 @@
  */
 class pkgAcquire::Worker : public WeakPointable
 {
-   /** \brief dpointer placeholder (for later in case we need it) */
-   void * const d;
+   class Private;
+   Private * const d;
   
    friend class pkgAcquire;
    
@@ -143,10 +143,11 @@ class pkgAcquire::Worker : public WeakPointable
    
    /** \brief Retrieve any available messages from the subprocess.
     *
-    *  The messages are retrieved as in \link strutl.h ReadMessages()\endlink, and
-    *  #MethodFailure() is invoked if an error occurs; in particular,
-    *  if the pipe to the subprocess dies unexpectedly while a message
-    *  is being read.
+    *  The messages are retrieved as in \link strutl.h ReadMessages()\endlink,
+    *  but without waiting for the rest of an incomplete message: it is
+    *  kept until the next call. #MethodFailure() is invoked if an error
+    *  occurs; in particular, if the pipe to the subprocess dies
+    *  unexpectedly while a message is being read.
     *
     *  \return \b true if the messages were successfully read, \b
     *  false otherwise.
@@ -328,6 +329,7 @@ class pkgAcquire::Worker : public WeakPointable
 
 private:
    APT_HIDDEN void PrepareFiles(char const * const caller, pkgAcquire::Queue::QItem const * const Itm);
+   APT_HIDDEN void StateChanged();
 };
 
 /** @} */
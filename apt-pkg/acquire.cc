@@ -24,8 +24,10 @@
 #include <apt-pkg/fileutl.h>
 
 #include <algorithm>
+#include <chrono>
 #include <numeric>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <iostream>
 #include <sstream>
@@ -43,23 +45,244 @@
 #include <sys/time.h>
 #include <sys/select.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 #include <apti18n.h>
 									/*}}}*/
 
 using namespace std;
 
+// AcquirePoller - Wait for the fds of the workers to become ready	/*{{{*/
+// ---------------------------------------------------------------------
+/* Run tells the poller only about changes in the fds it is interested
+   in. Acquire::Poller picks the implementation: epoll where available,
+   poll otherwise – neither is limited to FD_SETSIZE as select is. */
+class APT_HIDDEN AcquirePoller
+{
+   public:
+   /** \brief (un)register interest in a fd, forgetting it if neither */
+   virtual bool Watch(int const Fd, bool const Read, bool const Write) = 0;
+   /** \brief wait up to Timeout milliseconds for a watched fd to be ready
+    *
+    *  \return the number of ready fds stored in Ready, 0 on timeout
+    *  and -1 on errors */
+   virtual int Wait(int const Timeout, std::vector<int> &Ready) = 0;
+   virtual char const * Name() const = 0;
+   virtual ~AcquirePoller() {}
+};
+class APT_HIDDEN PollPoller : public AcquirePoller
+{
+   std::vector<struct pollfd> Fds;
+   std::unordered_map<int, size_t> Index;
+
+   public:
+   virtual bool Watch(int const Fd, bool const Read, bool const Write) APT_OVERRIDE
+   {
+      short const Events = (Read ? POLLIN : 0) | (Write ? POLLOUT : 0);
+      auto const I = Index.find(Fd);
+      if (I == Index.end())
+      {
+	 if (Events == 0)
+	    return true;
+	 Index.emplace(Fd, Fds.size());
+	 struct pollfd const P = { Fd, Events, 0 };
+	 Fds.push_back(P);
+      }
+      else if (Events != 0)
+	 Fds[I->second].events = Events;
+      else
+      {
+	 // fill the gap with the last one
+	 size_t const Pos = I->second;
+	 Index.erase(I);
+	 if (Pos != Fds.size() - 1)
+	 {
+	    Fds[Pos] = Fds.back();
+	    Index[Fds[Pos].fd] = Pos;
+	 }
+	 Fds.pop_back();
+      }
+      return true;
+   }
+   virtual int Wait(int const Timeout, std::vector<int> &Ready) APT_OVERRIDE
+   {
+      Ready.clear();
+      int const Res = poll(Fds.data(), Fds.size(), Timeout);
+      if (Res <= 0)
+	 return Res;
+      for (auto const &P : Fds)
+	 if (P.revents != 0)
+	    Ready.push_back(P.fd);
+      return Ready.size();
+   }
+   virtual char const * Name() const APT_OVERRIDE { return "poll"; }
+};
+#ifdef __linux__
+class APT_HIDDEN EpollPoller : public AcquirePoller
+{
+   int const EpollFd;
+   std::unordered_map<int, uint32_t> Watched;
+   std::vector<struct epoll_event> Events;
+
+   bool Control(int const Op, int const Fd, uint32_t const Wanted)
+   {
+      struct epoll_event Ev;
+      memset(&Ev, 0, sizeof(Ev));
+      Ev.events = Wanted;
+      Ev.data.fd = Fd;
+      return epoll_ctl(EpollFd, Op, Fd, &Ev) == 0;
+   }
+
+   public:
+   bool Usable() const { return EpollFd != -1; }
+   virtual bool Watch(int const Fd, bool const Read, bool const Write) APT_OVERRIDE
+   {
+      uint32_t const Wanted = (Read ? uint32_t(EPOLLIN) : 0) | (Write ? uint32_t(EPOLLOUT) : 0);
+      auto const I = Watched.find(Fd);
+      if (Wanted == 0)
+      {
+	 // the fd might have been closed already which removed it
+	 if (I != Watched.end())
+	 {
+	    epoll_ctl(EpollFd, EPOLL_CTL_DEL, Fd, nullptr);
+	    Watched.erase(I);
+	 }
+	 return true;
+      }
+      if (I != Watched.end() && I->second == Wanted)
+	 return true;
+      if (I == Watched.end())
+      {
+	 if (Control(EPOLL_CTL_ADD, Fd, Wanted) == false &&
+	       (errno != EEXIST || Control(EPOLL_CTL_MOD, Fd, Wanted) == false))
+	    return false;
+      }
+      else if (Control(EPOLL_CTL_MOD, Fd, Wanted) == false &&
+	    (errno != ENOENT || Control(EPOLL_CTL_ADD, Fd, Wanted) == false))
+	 return false;
+      Watched[Fd] = Wanted;
+      return true;
+   }
+   virtual int Wait(int const Timeout, std::vector<int> &Ready) APT_OVERRIDE
+   {
+      Ready.clear();
+      int const Res = epoll_wait(EpollFd, Events.data(), Events.size(), Timeout);
+      for (int I = 0; I < Res; ++I)
+	 Ready.push_back(Events[I].data.fd);
+      return Res;
+   }
+   virtual char const * Name() const APT_OVERRIDE { return "epoll"; }
+
+   EpollPoller() : EpollFd(epoll_create1(EPOLL_CLOEXEC)), Events(64) {}
+   virtual ~EpollPoller()
+   {
+      if (EpollFd != -1)
+	 close(EpollFd);
+   }
+};
+#endif
+static std::unique_ptr<AcquirePoller> CreatePoller()
+{
+   std::string const Type = _config->Find("Acquire::Poller", "epoll");
+#ifdef __linux__
+   if (Type == "epoll")
+   {
+      std::unique_ptr<EpollPoller> Epoll(new EpollPoller());
+      if (Epoll->Usable() == true)
+	 return std::unique_ptr<AcquirePoller>(Epoll.release());
+   }
+#endif
+   return std::unique_ptr<AcquirePoller>(new PollPoller());
+}
+									/*}}}*/
+class APT_HIDDEN pkgAcquire::Private
+{
+   public:
+   /** \brief workers which might watch other fds than the last time */
+   std::vector<Worker *> Changed;
+
+   /* The poller is only told about workers which changed what they wait
+      for, so a wakeup costs the same regardless of the number of workers */
+   std::unique_ptr<AcquirePoller> Poller;
+   std::unordered_map<int, Worker *> FdOwner;
+   std::unordered_map<Worker *, std::pair<int, int>> Watched;
+
+   void Unwatch(Worker * const W, int &Fd)
+   {
+      if (Fd == -1)
+	 return;
+      auto const O = FdOwner.find(Fd);
+      if (O != FdOwner.end() && O->second == W)
+      {
+	 Poller->Watch(Fd, false, false);
+	 FdOwner.erase(O);
+      }
+      Fd = -1;
+   }
+   void Forget(Worker * const W)
+   {
+      Changed.erase(std::remove(Changed.begin(), Changed.end(), W), Changed.end());
+      auto const I = Watched.find(W);
+      if (I == Watched.end())
+	 return;
+      if (Poller != nullptr)
+      {
+	 Unwatch(W, I->second.first);
+	 Unwatch(W, I->second.second);
+      }
+      Watched.erase(I);
+   }
+   bool SyncWorkers()
+   {
+      bool Okay = true;
+      // forget the old fds first as a closed fd might be reused by another worker
+      for (auto const W : Changed)
+      {
+	 auto &Fds = Watched[W];
+	 int const In = (W->InReady == true) ? W->InFd : -1;
+	 int const Out = (W->OutReady == true) ? W->OutFd : -1;
+	 if (Fds.first != In)
+	    Unwatch(W, Fds.first);
+	 if (Fds.second != Out)
+	    Unwatch(W, Fds.second);
+      }
+      for (auto const W : Changed)
+      {
+	 auto &Fds = Watched[W];
+	 int const In = (W->InReady == true) ? W->InFd : -1;
+	 int const Out = (W->OutReady == true) ? W->OutFd : -1;
+	 if (In != -1 && Fds.first != In)
+	 {
+	    Okay &= Poller->Watch(In, true, false);
+	    FdOwner[In] = W;
+	    Fds.first = In;
+	 }
+	 if (Out != -1 && Fds.second != Out)
+	 {
+	    Okay &= Poller->Watch(Out, false, true);
+	    FdOwner[Out] = W;
+	    Fds.second = Out;
+	 }
+      }
+      Changed.clear();
+      return Okay;
+   }
+};
+
 // Acquire::pkgAcquire - Constructor					/*{{{*/
 // ---------------------------------------------------------------------
 /* We grab some runtime state from the configuration space */
-pkgAcquire::pkgAcquire() : LockFD(-1), d(NULL), Queues(0), Workers(0), Configs(0), Log(NULL), ToFetch(0),
+pkgAcquire::pkgAcquire() : LockFD(-1), d(new Private()), Queues(0), Workers(0), Configs(0), Log(NULL), ToFetch(0),
 			   Debug(_config->FindB("Debug::pkgAcquire",false)),
 			   Running(false)
 {
    Initialize();
 }
-pkgAcquire::pkgAcquire(pkgAcquireStatus *Progress) : LockFD(-1), d(NULL), Queues(0), Workers(0),
+pkgAcquire::pkgAcquire(pkgAcquireStatus *Progress) : LockFD(-1), d(new Private()), Queues(0), Workers(0),
 			   Configs(0), Log(NULL), ToFetch(0),
 			   Debug(_config->FindB("Debug::pkgAcquire",false)),
 			   Running(false)
@@ -183,6 +406,8 @@ pkgAcquire::~pkgAcquire()
       Configs = Configs->Next;
       delete Jnk;
    }   
+
+   delete d;
 }
 									/*}}}*/
 // Acquire::Shutdown - Clean out the acquire object			/*{{{*/
@@ -241,6 +466,7 @@ void pkgAcquire::Add(Worker *Work)
 {
    Work->NextAcquire = Workers;
    Workers = Work;
+   WorkerChanged(Work);
 }
 									/*}}}*/
 // Acquire::Remove - Remove a worker					/*{{{*/
@@ -261,6 +487,14 @@ void pkgAcquire::Remove(Worker *Work)
       else
 	 I = &(*I)->NextAcquire;
    }
+   d->Forget(Work);
+}
+									/*}}}*/
+// Acquire::WorkerChanged - Note a worker to be looked at again	/*{{{*/
+void pkgAcquire::WorkerChanged(Worker * const Work)
+{
+   if (d->Changed.empty() == true || d->Changed.back() != Work)
+      d->Changed.push_back(Work);
 }
 									/*}}}*/
 // Acquire::Enqueue - Queue an URI for fetching				/*{{{*/
@@ -372,6 +606,7 @@ string pkgAcquire::QueueName(string Uri,MethodConfig const *&Config)
       long cpuCount = 10;
 #endif
       cpuCount = _config->FindI("Acquire::QueueHost::Limit", cpuCount);
+      cpuCount = _config->FindI("Acquire::" + U.Access + "::Max-Instances", cpuCount);
 
       if (cpuCount <= 0 || existing < cpuCount)
 	 strprintf(FullQueueName, "%s%ld", AccessSchema.c_str(), existing);
@@ -386,6 +621,10 @@ string pkgAcquire::QueueName(string Uri,MethodConfig const *&Config)
    } else
    {
       FullQueueName = AccessSchema + U.Host;
+      long const Connections = _config->FindI("Acquire::" + U.Access + "::Max-Connections-Per-Host",
+	    _config->FindI("Acquire::Max-Connections-Per-Host", 1));
+      if (Connections > 1)
+	 return HostQueueName(Uri, FullQueueName, Connections);
    }
    unsigned int Instances = 0, SchemaLength = AccessSchema.length();
 
@@ -409,6 +648,66 @@ string pkgAcquire::QueueName(string Uri,MethodConfig const *&Config)
    return FullQueueName;
 }
 									/*}}}*/
+// Acquire::HostQueueName - Pick one of the queues of a host		/*{{{*/
+// ---------------------------------------------------------------------
+/* A host can be served by up to Connections queues named host, host#1,
+   host#2 and so on, each with its own worker and so its own (pipelined)
+   connection. An URI already queued somewhere stays there so the fetch
+   is combined; otherwise a new queue is opened as long as all others are
+   busy and after that the one with the least bytes left to fetch wins. */
+string pkgAcquire::HostQueueName(string const &Uri, string const &HostQueue, long const Connections)
+{
+   string const Access = HostQueue.substr(0, HostQueue.find(':') + 1);
+   unsigned int Instances = 0;
+   long Shards = 0;
+   bool AllBusy = true;
+   Queue const *Best = nullptr;
+   unsigned long long BestBytes = 0, BestItems = 0;
+   for (Queue const *I = Queues; I != nullptr; I = I->Next)
+   {
+      if (I->Name.compare(0, Access.length(), Access) == 0)
+	 ++Instances;
+      if (I->Name != HostQueue && (I->Name.compare(0, HostQueue.length(), HostQueue) != 0 ||
+	       I->Name.length() <= HostQueue.length() || I->Name[HostQueue.length()] != '#'))
+	 continue;
+      ++Shards;
+
+      unsigned long long Bytes = 0, Items = 0;
+      for (Queue::QItem const *Q = I->Items; Q != nullptr; Q = Q->Next)
+      {
+	 if (Q->URI == Uri)
+	    return I->Name;
+	 ++Items;
+	 if (Q->Owner->FileSize > Q->Owner->PartialSize)
+	    Bytes += Q->Owner->FileSize - Q->Owner->PartialSize;
+      }
+      if (Items == 0)
+	 AllBusy = false;
+      if (Best == nullptr || Bytes < BestBytes || (Bytes == BestBytes && Items < BestItems))
+      {
+	 Best = I;
+	 BestBytes = Bytes;
+	 BestItems = Items;
+      }
+   }
+
+   bool const LimitReached = Instances >= (unsigned int)_config->FindI("Acquire::QueueHost::Limit",10);
+   string Name = HostQueue;
+   if (Best == nullptr && LimitReached)
+      Name = Access.substr(0, Access.length() - 1);
+   else if (Best != nullptr && (AllBusy == false || Shards >= Connections || LimitReached))
+      Name = Best->Name;
+   else if (Shards != 0)
+   {
+      // queues are only ever added, so the numbering has no gaps
+      strprintf(Name, "%s#%ld", HostQueue.c_str(), Shards);
+   }
+
+   if (Debug)
+      clog << "Chose queue " << Name << " of " << Shards << " for " << Uri << endl;
+   return Name;
+}
+									/*}}}*/
 // Acquire::GetConfig - Fetch the configuration information		/*{{{*/
 // ---------------------------------------------------------------------
 /* This locates the configuration structure for an access method. If 
@@ -490,7 +789,7 @@ bool pkgAcquire::RunFdsSane(fd_set *RSet,fd_set *WSet)
 									/*}}}*/
 // Acquire::Run - Run the fetch sequence				/*{{{*/
 // ---------------------------------------------------------------------
-/* This runs the queues. It manages a select loop for all of the
+/* This runs the queues. It manages a poll loop for all of the
    Worker tasks. The workers interact with the queues and items to
    manage the actual fetch. */
 static bool IsAccessibleBySandboxUser(std::string const &filename, bool const ReadWrite)
@@ -626,39 +925,58 @@ pkgAcquire::RunResult pkgAcquire::Run(int PulseIntervall)
    
    bool WasCancelled = false;
 
+   d->Poller = CreatePoller();
+   for (Worker *I = Workers; I != 0; I = I->NextAcquire)
+      WorkerChanged(I);
+
    // Run till all things have been acquired
-   struct timeval tv;
-   tv.tv_sec = 0;
-   tv.tv_usec = PulseIntervall; 
+   std::chrono::microseconds const Intervall(PulseIntervall);
+   auto NextPulse = std::chrono::steady_clock::now() + Intervall;
+   std::vector<int> Ready;
    while (ToFetch > 0)
    {
-      fd_set RFds;
-      fd_set WFds;
-      int Highest = 0;
-      FD_ZERO(&RFds);
-      FD_ZERO(&WFds);
-      SetFds(Highest,&RFds,&WFds);
-      
+      if (d->SyncWorkers() == false)
+      {
+	 _error->Errno(d->Poller->Name(), "Watching the methods has failed");
+	 break;
+      }
+
       int Res;
       do
       {
-	 Res = select(Highest+1,&RFds,&WFds,0,&tv);
+	 auto const Left = std::chrono::duration_cast<std::chrono::milliseconds>(
+	       NextPulse - std::chrono::steady_clock::now() + std::chrono::microseconds(999));
+	 Res = d->Poller->Wait(std::max<int>(0, Left.count()), Ready);
       }
       while (Res < 0 && errno == EINTR);
-      
+
       if (Res < 0)
       {
-	 _error->Errno("select","Select has failed");
+	 _error->Errno(d->Poller->Name(), "Select has failed");
 	 break;
       }
 
-      if(RunFdsSane(&RFds,&WFds) == false)
-         break;
+      // Dispatch active FDs over to the proper workers
+      bool Okay = true;
+      for (int const Fd : Ready)
+      {
+	 auto const O = d->FdOwner.find(Fd);
+	 if (O == d->FdOwner.end())
+	    continue;
+	 Worker * const W = O->second;
+	 if (W->InFd == Fd && W->InReady == true)
+	    Okay &= W->InFdReady();
+	 else if (W->OutFd == Fd && W->OutReady == true)
+	    Okay &= W->OutFdReady();
+      }
+      if (Okay == false)
+	 break;
 
       // Timeout, notify the log class
-      if (Res == 0 || (Log != 0 && Log->Update == true))
+      auto const Now = std::chrono::steady_clock::now();
+      if (Res == 0 || Now >= NextPulse || (Log != 0 && Log->Update == true))
       {
-	 tv.tv_usec = PulseIntervall;
+	 NextPulse = Now + Intervall;
 	 for (Worker *I = Workers; I != 0; I = I->NextAcquire)
 	    I->Pulse();
 	 if (Log != 0 && Log->Pulse(this) == false)
@@ -668,6 +986,10 @@ pkgAcquire::RunResult pkgAcquire::Run(int PulseIntervall)
 	 }
       }      
    }   
+   d->Changed.clear();
+   d->FdOwner.clear();
+   d->Watched.clear();
+   d->Poller.reset();
 
    if (Log != 0)
       Log->Stop();
@@ -737,6 +1059,7 @@ bool pkgAcquire::Clean(string Dir)
       // Skip some files..
       if (strcmp(Dir->d_name,"lock") == 0 ||
 	  strcmp(Dir->d_name,"partial") == 0 ||
+	  strcmp(Dir->d_name,"decompressed") == 0 ||
 	  strcmp(Dir->d_name,"lost+found") == 0 ||
 	  strcmp(Dir->d_name,".") == 0 ||
 	  strcmp(Dir->d_name,"..") == 0)
@@ -100,8 +100,8 @@ class pkgAcquire
    private:
    /** \brief FD of the Lock file we acquire in Setup (if any) */
    int LockFD;
-   /** \brief dpointer placeholder (for later in case we need it) */
-   void * const d;
+   class Private;
+   Private * const d;
 
    public:
    
@@ -390,6 +390,8 @@ class pkgAcquire
 
    private:
    APT_HIDDEN void Initialize();
+   APT_HIDDEN std::string HostQueueName(std::string const &Uri, std::string const &HostQueue, long const Connections);
+   APT_HIDDEN void WorkerChanged(Worker * const Work);
 };
 
 /** \brief Represents a single download source from which an item
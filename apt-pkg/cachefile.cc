@@ -71,6 +71,14 @@ public:
    ~ScopedErrorMerge() { _error->MergeWithStack(); }
 };
 
+static void LoadDepIndex(pkgCache &Cache)
+{
+   if (_config->FindB("APT::Cache-DepIndex", false) == false)
+      return;
+   std::string const CacheFile = _config->FindFile("Dir::Cache::pkgcache");
+   if (CacheFile.empty() == false)
+      Cache.LoadDepIndex(CacheFile + ".deps");
+}
 bool pkgCacheFile::BuildCaches(OpProgress *Progress, bool WithLock)
 {
    std::unique_ptr<pkgCache> Cache;
@@ -91,6 +99,7 @@ bool pkgCacheFile::BuildCaches(OpProgress *Progress, bool WithLock)
       Cache.reset(new pkgCache(Map.get()));
       if (_error->PendingError() == true)
 	 return false;
+      LoadDepIndex(*Cache);
 
       this->Cache = Cache.release();
       this->Map = Map.release();
@@ -126,6 +135,7 @@ bool pkgCacheFile::BuildCaches(OpProgress *Progress, bool WithLock)
       Cache.reset(new pkgCache(Map.get()));
    if (_error->PendingError() == true)
       return false;
+   LoadDepIndex(*Cache);
    this->Map = Map.release();
    this->Cache = Cache.release();
 
@@ -149,6 +159,27 @@ bool pkgCacheFile::BuildSourceList(OpProgress * /*Progress*/)
 }
 									/*}}}*/
 // CacheFile::BuildPolicy - Open and build all relevant preferences	/*{{{*/
+static void LoadPolicyTable(pkgPolicy &Policy, pkgSourceList * const SrcList)
+{
+   if (_config->FindB("APT::Cache-PolicyTable", false) == false)
+      return;
+   std::string const CacheFile = _config->FindFile("Dir::Cache::pkgcache");
+   if (CacheFile.empty() == true)
+      return;
+   std::string const FileName = CacheFile + ".policy";
+   if (Policy.LoadTable(FileName) == true)
+      return;
+   // a cache including volatile files is built just for this run
+   if (SrcList != nullptr && SrcList->GetVolatileFiles().empty() == false)
+      return;
+   if (access(flNotFile(FileName).c_str(), W_OK) != 0)
+      return;
+   // the table is an optimisation only, failing to store it isn't fatal
+   _error->PushToStack();
+   if (Policy.StoreTable(FileName) == false)
+      RemoveFile("LoadPolicyTable", FileName);
+   _error->RevertToStack();
+}
 // ---------------------------------------------------------------------
 /* */
 bool pkgCacheFile::BuildPolicy(OpProgress * /*Progress*/)
@@ -163,6 +194,7 @@ bool pkgCacheFile::BuildPolicy(OpProgress * /*Progress*/)
 
    if (ReadPinFile(*Policy) == false || ReadPinDir(*Policy) == false)
       return false;
+   LoadPolicyTable(*Policy, SrcList);
 
    this->Policy = Policy.release();
    return true;
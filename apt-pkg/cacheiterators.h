@@ -203,6 +203,11 @@ class pkgCache::VerIterator : public Iterator<Version, VerIterator> {
 
 	// Comparison
 	int CompareVer(const VerIterator &B) const;
+	/** \brief compares the version strings with the versioning system
+
+	    Unlike CompareVer this works for versions of different packages
+	    and compares sort keys of the versions first if possible. */
+	int CompareVerStr(const VerIterator &B) const;
 	/** \brief compares two version and returns if they are similar
 
 	    This method should be used to identify if two pseudo versions are
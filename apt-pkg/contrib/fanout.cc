@@ -0,0 +1,209 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   BlockFanOut - Hand the same data to several consumers in parallel
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <config.h>
+
+#include <apt-pkg/error.h>
+#include <apt-pkg/fanout.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <string.h>
+#include <unistd.h>
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#endif
+									/*}}}*/
+
+namespace APT {
+
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+class APT_HIDDEN BlockFanOutPrivate					/*{{{*/
+{
+public:
+   static constexpr size_t BlockSize = 64 * 1024;
+   static constexpr size_t MaxQueued = 16;
+
+   struct Block
+   {
+      std::unique_ptr<unsigned char[]> Data;
+      size_t Used;
+      Block() : Data(new unsigned char[BlockSize]), Used(0) {}
+   };
+   struct Worker
+   {
+      BlockFanOut::Consumer const Consume;
+      std::deque<std::shared_ptr<Block const>> Queue;
+      bool Result;
+      // errors are per-thread, so they are handed over in Finish
+      std::vector<std::pair<bool, std::string>> Messages;
+      std::thread Thread;
+      explicit Worker(BlockFanOut::Consumer const &Consume) : Consume(Consume), Result(true) {}
+   };
+
+   std::mutex Lock;
+   std::condition_variable Work, Space;
+   std::vector<std::unique_ptr<Worker>> Workers;
+   std::shared_ptr<Block> Current;
+   bool Stop;
+
+   void Run(Worker * const W)
+   {
+      std::unique_lock<std::mutex> Guard(Lock);
+      while (true)
+      {
+	 Work.wait(Guard, [&]() { return W->Queue.empty() == false || Stop == true; });
+	 if (W->Queue.empty() == true)
+	    break;
+	 std::shared_ptr<Block const> const B = std::move(W->Queue.front());
+	 W->Queue.pop_front();
+	 Space.notify_all();
+	 Guard.unlock();
+	 bool const Res = W->Consume(B->Data.get(), B->Used);
+	 Guard.lock();
+	 W->Result &= Res;
+      }
+      std::string Msg;
+      while (_error->empty(GlobalError::DEBUG) == false)
+      {
+	 bool const Type = _error->PopMessage(Msg);
+	 W->Messages.emplace_back(Type, Msg);
+      }
+   }
+   void Push()
+   {
+      if (Current == nullptr || Current->Used == 0)
+	 return;
+      std::unique_lock<std::mutex> Guard(Lock);
+      Space.wait(Guard, [&]() {
+	 return std::all_of(Workers.begin(), Workers.end(), [](std::unique_ptr<Worker> const &W) { return W->Queue.size() < MaxQueued; });
+      });
+      for (auto const &W : Workers)
+	 W->Queue.push_back(Current);
+      Work.notify_all();
+      Current.reset();
+   }
+
+   BlockFanOutPrivate() : Stop(false) {}
+};
+									/*}}}*/
+#else
+class APT_HIDDEN BlockFanOutPrivate {};
+#endif
+
+// BlockFanOut::Start - start a thread for each consumer		/*{{{*/
+bool BlockFanOut::Start(std::vector<Consumer> const &Consumers)
+{
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+   d->Stop = false;
+   try
+   {
+      for (auto const &Consume : Consumers)
+      {
+	 d->Workers.emplace_back(new BlockFanOutPrivate::Worker(Consume));
+	 BlockFanOutPrivate::Worker * const W = d->Workers.back().get();
+	 W->Thread = std::thread(&BlockFanOutPrivate::Run, d, W);
+      }
+   }
+   catch (std::system_error const &)
+   {
+      Finish();
+      return false;
+   }
+   return true;
+#else
+   (void)Consumers;
+   return false;
+#endif
+}
+									/*}}}*/
+// BlockFanOut::Reserve/Commit/Add - fill the current block		/*{{{*/
+unsigned char * BlockFanOut::Reserve(size_t &Size)
+{
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+   if (d->Current == nullptr)
+      d->Current = std::make_shared<BlockFanOutPrivate::Block>();
+   Size = BlockFanOutPrivate::BlockSize - d->Current->Used;
+   return d->Current->Data.get() + d->Current->Used;
+#else
+   Size = 0;
+   return nullptr;
+#endif
+}
+void BlockFanOut::Commit(size_t const Size)
+{
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+   d->Current->Used += Size;
+   if (d->Current->Used == BlockFanOutPrivate::BlockSize)
+      d->Push();
+#else
+   (void)Size;
+#endif
+}
+void BlockFanOut::Add(unsigned char const * Data, unsigned long long Size)
+{
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+   while (Size != 0)
+   {
+      size_t Free;
+      unsigned char * const To = Reserve(Free);
+      size_t const n = std::min<unsigned long long>(Free, Size);
+      memcpy(To, Data, n);
+      Commit(n);
+      Data += n;
+      Size -= n;
+   }
+#else
+   (void)Data;
+   (void)Size;
+#endif
+}
+									/*}}}*/
+// BlockFanOut::Finish - process the outstanding data and stop		/*{{{*/
+bool BlockFanOut::Finish()
+{
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+   d->Push();
+   {
+      std::lock_guard<std::mutex> Guard(d->Lock);
+      d->Stop = true;
+   }
+   d->Work.notify_all();
+   bool Res = true;
+   for (auto const &W : d->Workers)
+   {
+      if (W->Thread.joinable())
+	 W->Thread.join();
+      for (auto const &M : W->Messages)
+	 _error->Insert(M.first ? GlobalError::ERROR : GlobalError::WARNING, "%s", M.second.c_str());
+      Res &= W->Result;
+   }
+   d->Workers.clear();
+   return Res;
+#else
+   return true;
+#endif
+}
+									/*}}}*/
+BlockFanOut::BlockFanOut() : d(new BlockFanOutPrivate()) {}
+BlockFanOut::~BlockFanOut()
+{
+   Finish();
+   delete d;
+}
+
+}
@@ -0,0 +1,71 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   BlockFanOut - Hand the same data to several consumers in parallel
+
+   The data is collected in blocks which are shared read-only by all
+   consumers, each of which runs on a thread of its own. Used to hash or
+   compress a file in several ways at once instead of one after another.
+
+   ##################################################################### */
+									/*}}}*/
+#ifndef APTPKG_FANOUT_H
+#define APTPKG_FANOUT_H
+
+#include <apt-pkg/macros.h>
+
+#include <functional>
+#include <vector>
+
+#include <stddef.h>
+
+namespace APT {
+
+class BlockFanOutPrivate;
+/** \brief hand blocks of data to several consumers on threads of their own
+ *
+ * A block is freed once the slowest consumer is done with it. The number
+ * of blocks a consumer can fall behind is limited, so that a slow one
+ * slows down the producer rather than the memory usage growing with the
+ * size of the data.
+ */
+class BlockFanOut
+{
+   BlockFanOutPrivate * const d;
+
+public:
+   /** \brief called on its own thread for each block in order
+    *
+    * Errors it reports are handed over to the caller of #Finish.
+    * @return \b false if the data could not be processed
+    */
+   typedef std::function<bool(unsigned char const * const Data, size_t const Size)> Consumer;
+
+   /** \brief start a thread for each of the given consumers
+    *
+    * @return \b false if not all threads could be started (or threads
+    *  aren't supported), in which case none is running
+    */
+   bool Start(std::vector<Consumer> const &Consumers);
+
+   /** \brief free space in the current block to be filled by the caller */
+   unsigned char * Reserve(size_t &Size);
+   /** \brief mark Size bytes of the reserved space as filled */
+   void Commit(size_t const Size);
+   /** \brief copy the data into the blocks */
+   void Add(unsigned char const * Data, unsigned long long Size);
+
+   /** \brief hand all outstanding data to the consumers and stop them
+    *
+    * @return \b false if a consumer failed on any of the data
+    */
+   bool Finish();
+
+   BlockFanOut();
+   virtual ~BlockFanOut();
+};
+
+}
+
+#endif
@@ -54,6 +54,14 @@
 #include <algorithm>
 #include <memory>
 
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#endif
+
 #ifdef HAVE_ZLIB
 	#include <zlib.h>
 #endif
@@ -66,12 +74,21 @@
 #ifdef HAVE_LZ4
 	#include <lz4frame.h>
 #endif
+#ifdef HAVE_ZSTD
+	#include <zstd.h>
+#endif
 #include <endian.h>
 #include <stdint.h>
 
 #if __gnu_linux__
 #include <sys/prctl.h>
 #endif
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
 
 #include <apti18n.h>
 									/*}}}*/
@@ -156,6 +173,86 @@ bool RunScripts(const char *Cnf)
 }
 									/*}}}*/
 
+#ifdef __linux__
+// KernelCopy - Let the kernel copy the rest of a file			/*{{{*/
+// ---------------------------------------------------------------------
+/* Copies from the offset of From till its end to the offset of To without
+   passing the data through userspace: a whole file is cloned on
+   copy-on-write filesystems, otherwise copy_file_range lets the kernel (or
+   the server of a network filesystem) copy it with sendfile as fallback.
+   Only plain files are supported for which no data is buffered: a pending
+   write is flushed, but data already read can't be given back.
+   Returns 1 if done, 0 if nothing was copied as the files aren't supported
+   and -1 on errors with errno set. */
+static int KernelCopy(FileFd &FromFd, FileFd &ToFd)
+{
+   if (FromFd.IsCompressed() == true || ToFd.IsCompressed() == true)
+      return 0;
+   int const From = FromFd.Fd();
+   int const To = ToFd.Fd();
+   struct stat FromBuf, ToBuf;
+   if (fstat(From, &FromBuf) != 0 || fstat(To, &ToBuf) != 0 ||
+	 S_ISREG(FromBuf.st_mode) == false || S_ISREG(ToBuf.st_mode) == false ||
+	 FromBuf.st_size == 0) // e.g. files in /proc
+      return 0;
+   if (ToFd.Flush() == false)
+      return -1;
+   off_t const FromPos = lseek(From, 0, SEEK_CUR);
+   off_t const ToPos = lseek(To, 0, SEEK_CUR);
+   if (FromPos < 0 || ToPos < 0 || FromFd.Tell() != (unsigned long long)FromPos)
+      return 0;
+
+#ifdef FICLONE
+   if (FromPos == 0 && ToPos == 0 && ToBuf.st_size == 0 && ioctl(To, FICLONE, From) == 0)
+   {
+      if (lseek(From, FromBuf.st_size, SEEK_SET) < 0 || lseek(To, FromBuf.st_size, SEEK_SET) < 0)
+	 return -1;
+      return 1;
+   }
+#endif
+
+   constexpr size_t Chunk = 1 << 30;
+   bool Copied = false;
+#ifdef SYS_copy_file_range
+   bool UseSendfile = false;
+#else
+   bool const UseSendfile = true;
+#endif
+   while (true)
+   {
+      ssize_t Res;
+#ifdef SYS_copy_file_range
+      if (UseSendfile == false)
+	 Res = syscall(SYS_copy_file_range, From, nullptr, To, nullptr, Chunk, 0);
+      else
+#endif
+	 Res = sendfile(To, From, nullptr, Chunk);
+      if (Res > 0)
+      {
+	 Copied = true;
+	 continue;
+      }
+      else if (Res == 0 && (Copied == true || FromPos >= FromBuf.st_size))
+	 return 1;
+      else if (Res < 0 && errno == EINTR)
+	 continue;
+      else if (Copied == true)
+	 return -1;
+      // the kernel or filesystem doesn't support this (or claims EOF early)
+#ifdef SYS_copy_file_range
+      if (UseSendfile == false)
+      {
+	 UseSendfile = true;
+	 continue;
+      }
+#endif
+      if (Res == 0 || errno == ENOSYS || errno == EINVAL || errno == EXDEV || errno == EOPNOTSUPP)
+	 return 0;
+      return -1;
+   }
+}
+									/*}}}*/
+#endif
 // CopyFile - Buffered copy of a file					/*{{{*/
 // ---------------------------------------------------------------------
 /* The caller is expected to set things so that failure causes erasure */
@@ -165,6 +262,24 @@ bool CopyFile(FileFd &From,FileFd &To)
 	 From.Failed() == true || To.Failed() == true)
       return false;
 
+#ifdef __linux__
+   int const Res = KernelCopy(From, To);
+   if (Res < 0)
+   {
+      if (To.Failed() == true)
+	 return false;
+      To.OpFail();
+      return _error->Errno("CopyFile", _("Write error"));
+   }
+   else if (Res > 0)
+   {
+      // let both know about the new positions
+      From.Tell();
+      To.Tell();
+      return true;
+   }
+#endif
+
    // Buffered copy between fds
    constexpr size_t BufSize = APT_BUFFER_SIZE;
    std::unique_ptr<unsigned char[]> Buf(new unsigned char[BufSize]);
@@ -979,6 +1094,113 @@ struct APT_HIDDEN simple_buffer {							/*{{{*/
 };
 									/*}}}*/
 
+// SeekTable - random access into compressed files			/*{{{*/
+/* Files written with FileFd::Seekable consist of independent chunks (gzip
+   members or lz4 frames) of ChunkSize uncompressed bytes each followed by
+   a table of the compressed sizes of these chunks. The table is stored in
+   a way the decompressors skip over (the extra field of an empty gzip
+   member or a skippable lz4 frame), so the files remain valid for every
+   other tool. Seeking can then start decompressing at the chunk containing
+   the target instead of at the start of the file.
+
+   The table ends in a footer of the uncompressed size, the chunk size,
+   the number of chunks and a magic number (all little-endian), which is
+   followed by TrailerSize bytes of the container. */
+struct APT_HIDDEN SeekTable {
+   static constexpr uint32_t Magic = 0x53545041; // "APTS"
+   static constexpr size_t FooterSize = 20;
+   static constexpr uint32_t ChunkSize = 64 * 1024;
+
+   uint32_t Chunk = 0;
+   unsigned long long Total = 0;
+   // compressed offset of each chunk and the end of the last chunk
+   std::vector<unsigned long long> Offsets;
+   enum { UNKNOWN, MISSING, LOADED } State = UNKNOWN;
+
+   // while writing
+   std::vector<uint32_t> Sizes;
+   unsigned long long Filled = 0;
+   unsigned long long ChunkStart = 0;
+
+   /** \brief the table in the form written to the file */
+   std::string Payload() const
+   {
+      std::string Data;
+      Data.reserve(Sizes.size() * sizeof(uint32_t) + FooterSize);
+      auto const add = [&](void const * const V, size_t const L) { Data.append(static_cast<char const *>(V), L); };
+      for (auto const S: Sizes)
+      {
+	 uint32_t const V = htole32(S);
+	 add(&V, sizeof(V));
+      }
+      uint64_t const T = htole64(Total);
+      uint32_t const C = htole32(ChunkSize), N = htole32(Sizes.size()), M = htole32(Magic);
+      add(&T, sizeof(T));
+      add(&C, sizeof(C));
+      add(&N, sizeof(N));
+      add(&M, sizeof(M));
+      return Data;
+   }
+   /** \brief load the table from the end of the file iFd
+    *
+    *  \param Preamble is filled with the PreambleSize bytes in front of
+    *  the table for the caller to check the container */
+   bool Load(int const iFd, size_t const TrailerSize, size_t const PreambleSize, std::string &Preamble)
+   {
+      if (State != UNKNOWN)
+	 return State == LOADED;
+      State = MISSING;
+
+      struct stat Buf;
+      if (fstat(iFd, &Buf) != 0 || S_ISREG(Buf.st_mode) == false ||
+	    Buf.st_size < static_cast<off_t>(TrailerSize + FooterSize + PreambleSize))
+	 return false;
+      unsigned char Footer[FooterSize];
+      if (pread(iFd, Footer, FooterSize, Buf.st_size - TrailerSize - FooterSize) != FooterSize)
+	 return false;
+      uint64_t T;
+      uint32_t C, N, M;
+      memcpy(&T, Footer, sizeof(T));
+      memcpy(&C, Footer + 8, sizeof(C));
+      memcpy(&N, Footer + 12, sizeof(N));
+      memcpy(&M, Footer + 16, sizeof(M));
+      Total = le64toh(T);
+      Chunk = le32toh(C);
+      N = le32toh(N);
+      if (le32toh(M) != Magic || Chunk == 0 || N == 0 ||
+	    Total > static_cast<unsigned long long>(N) * Chunk ||
+	    Total <= static_cast<unsigned long long>(N - 1) * Chunk)
+	 return false;
+
+      off_t const TableSize = static_cast<off_t>(N) * sizeof(uint32_t);
+      off_t const TableStart = Buf.st_size - TrailerSize - FooterSize - TableSize;
+      if (TableStart < static_cast<off_t>(PreambleSize))
+	 return false;
+      std::vector<uint32_t> Table(N);
+      if (pread(iFd, Table.data(), TableSize, TableStart) != TableSize)
+	 return false;
+      Preamble.resize(PreambleSize);
+      if (pread(iFd, &Preamble[0], PreambleSize, TableStart - PreambleSize) != static_cast<ssize_t>(PreambleSize))
+	 return false;
+
+      Offsets.resize(N + 1);
+      Offsets[0] = 0;
+      for (uint32_t i = 0; i < N; ++i)
+	 Offsets[i + 1] = Offsets[i] + le32toh(Table[i]);
+      if (Offsets[N] > static_cast<unsigned long long>(TableStart - PreambleSize))
+	 return false;
+      State = LOADED;
+      return true;
+   }
+   /** \brief whether repositioning at a chunk is better than decompressing from From to To */
+   bool Worthwhile(unsigned long long const From, unsigned long long const To) const
+   {
+      if (State != LOADED || To >= Total)
+	 return false;
+      return To < From || To / Chunk != From / Chunk;
+   }
+};
+									/*}}}*/
 class APT_HIDDEN FileFdPrivate {							/*{{{*/
    friend class BufferedWriteFileFdPrivate;
 protected:
@@ -1172,6 +1394,7 @@ public:
    virtual bool InternalClose(std::string const &FileName) = 0;
    virtual bool InternalStream() const { return false; }
    virtual bool InternalAlwaysAutoClose() const { return true; }
+   virtual bool InternalRandomAccess() { return false; }
 
    virtual ~FileFdPrivate() {}
 };
@@ -1316,14 +1539,317 @@ public:
    {
       return wrapped->InternalAlwaysAutoClose();
    }
+   virtual bool InternalRandomAccess() APT_OVERRIDE
+   {
+      return wrapped->InternalRandomAccess();
+   }
    virtual ~BufferedWriteFileFdPrivate()
    {
       delete wrapped;
    }
 };
 									/*}}}*/
+// findCompressorThreads - threads requested in the compressor arguments	/*{{{*/
+/* Accepts the thread options of the compressor binaries (-T/--threads for
+   xz, -p/--processes for pigz), with 0 meaning one thread per core. */
+static unsigned int findCompressorThreads(std::vector<std::string> const &Args,
+					  char const Short, char const * const Long)
+{
+   std::string const LongArg = std::string("--").append(Long).append("=");
+   for (auto a = Args.rbegin(); a != Args.rend(); ++a)
+   {
+      std::string value;
+      if (a->compare(0, LongArg.length(), LongArg) == 0)
+	 value = a->substr(LongArg.length());
+      else if (a->length() > 2 && (*a)[0] == '-' && (*a)[1] == Short)
+	 value = a->substr(2);
+      else
+	 continue;
+      char *end;
+      unsigned long const threads = strtoul(value.c_str(), &end, 10);
+      if (*end != '\0')
+	 continue;
+      if (threads != 0)
+	 return threads;
+      return std::max(1l, sysconf(_SC_NPROCESSORS_ONLN));
+   }
+   return 1;
+}
+									/*}}}*/
+#if defined(HAVE_ZLIB) && defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+// GzipBlockWriter - deflate the blocks of a gzip file in parallel	/*{{{*/
+/* Like pigz the input is cut into blocks, which are deflated on their own
+   with the end of the previous block as dictionary. The raw deflate streams
+   are joined with sync flushes, so the result is a single gzip member any
+   gzip implementation can read. It is the same regardless of the number of
+   threads, but not the same as the output of zlib on its own. */
+class APT_HIDDEN GzipBlockWriter
+{
+   static constexpr size_t BlockSize = 128 * 1024;
+   static constexpr size_t DictSize = 32 * 1024;
+
+   struct Job
+   {
+      std::string Input;
+      std::string Dictionary;
+      std::string Output;
+      bool Last;
+      bool Done;
+      bool Result;
+      uLong Crc;
+      Job() : Last(false), Done(false), Result(false), Crc(0) {}
+   };
+
+   int const iFd;
+   size_t const MaxPending;
+   std::mutex Lock;
+   std::condition_variable Work, Finished;
+   std::deque<std::shared_ptr<Job>> Queue;
+   std::deque<std::shared_ptr<Job>> Pending;
+   std::vector<std::thread> Workers;
+   std::string Current;
+   std::string Dictionary;
+   uLong Crc;
+   unsigned long long Total;
+   bool Stop;
+
+   static void Deflate(Job &J)
+   {
+      J.Crc = crc32(0, reinterpret_cast<Bytef const *>(J.Input.data()), J.Input.size());
+      z_stream z;
+      memset(&z, 0, sizeof(z));
+      if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	 return;
+      if (J.Dictionary.empty() == false && deflateSetDictionary(&z,
+	       reinterpret_cast<Bytef const *>(J.Dictionary.data()), J.Dictionary.size()) != Z_OK)
+      {
+	 deflateEnd(&z);
+	 return;
+      }
+      J.Output.resize(deflateBound(&z, J.Input.size()) + 16);
+      z.next_in = reinterpret_cast<Bytef *>(&J.Input[0]);
+      z.avail_in = J.Input.size();
+      int const flush = J.Last ? Z_FINISH : Z_SYNC_FLUSH;
+      while (true)
+      {
+	 z.next_out = reinterpret_cast<Bytef *>(&J.Output[z.total_out]);
+	 z.avail_out = J.Output.size() - z.total_out;
+	 int const res = deflate(&z, flush);
+	 if (res == Z_STREAM_ERROR)
+	    break;
+	 if (J.Last ? (res == Z_STREAM_END) : (z.avail_out != 0))
+	 {
+	    J.Result = true;
+	    break;
+	 }
+	 J.Output.resize(J.Output.size() * 2);
+      }
+      J.Output.resize(z.total_out);
+      deflateEnd(&z);
+   }
+   void Run()
+   {
+      std::unique_lock<std::mutex> Guard(Lock);
+      while (true)
+      {
+	 Work.wait(Guard, [&]() { return Queue.empty() == false || Stop == true; });
+	 if (Queue.empty() == true)
+	    return;
+	 std::shared_ptr<Job> const J = std::move(Queue.front());
+	 Queue.pop_front();
+	 Guard.unlock();
+	 Deflate(*J);
+	 Guard.lock();
+	 J->Done = true;
+	 Finished.notify_all();
+      }
+   }
+   /** \brief write the finished blocks in order, waiting for them as needed */
+   bool WriteDone(size_t const Keep)
+   {
+      while (Pending.empty() == false)
+      {
+	 std::shared_ptr<Job> J;
+	 {
+	    std::unique_lock<std::mutex> Guard(Lock);
+	    if (Pending.size() > Keep)
+	       Finished.wait(Guard, [&]() { return Pending.front()->Done; });
+	    else if (Pending.front()->Done == false)
+	       return true;
+	    J = std::move(Pending.front());
+	    Pending.pop_front();
+	 }
+	 if (J->Result == false)
+	    return _error->Error("deflate: %s", _("Write error"));
+	 Crc = crc32_combine(Crc, J->Crc, J->Input.size());
+	 if (FileFd::Write(iFd, J->Output.data(), J->Output.size()) == false)
+	    return false;
+      }
+      return true;
+   }
+   bool Submit(bool const Last)
+   {
+      std::shared_ptr<Job> J = std::make_shared<Job>();
+      J->Last = Last;
+      J->Dictionary.swap(Dictionary);
+      // all but the last block are full, so bigger than the dictionary
+      if (Last == false)
+	 Dictionary.assign(Current, Current.size() - DictSize, DictSize);
+      J->Input.swap(Current);
+      Current.reserve(BlockSize);
+      {
+	 std::lock_guard<std::mutex> Guard(Lock);
+	 Queue.push_back(J);
+	 Pending.push_back(J);
+      }
+      Work.notify_one();
+      return WriteDone(Last ? 0 : MaxPending);
+   }
+   void StopWorkers()
+   {
+      {
+	 std::lock_guard<std::mutex> Guard(Lock);
+	 Stop = true;
+      }
+      Work.notify_all();
+      for (auto &W : Workers)
+	 W.join();
+      Workers.clear();
+   }
+
+public:
+   unsigned long long Tell() const { return Total; }
+   ssize_t Write(void const * const From, unsigned long long const Size)
+   {
+      size_t const towrite = std::min<unsigned long long>(Size, BlockSize - Current.size());
+      Current.append(static_cast<char const *>(From), towrite);
+      Total += towrite;
+      if (Current.size() == BlockSize && Submit(false) == false)
+	 return -1;
+      return towrite;
+   }
+   /** \brief write the last block and the gzip trailer */
+   bool Finish()
+   {
+      bool const Res = Submit(true);
+      StopWorkers();
+      if (Res == false)
+	 return false;
+      uint32_t const Trailer[] = { htole32(static_cast<uint32_t>(Crc)), htole32(static_cast<uint32_t>(Total)) };
+      return FileFd::Write(iFd, Trailer, sizeof(Trailer));
+   }
+   /** \brief start the threads and write the gzip header
+    *
+    * \return \b false if no thread could be started */
+   bool Start(unsigned int const Threads, bool &Written)
+   {
+      try
+      {
+	 for (unsigned int I = 0; I < Threads; ++I)
+	    Workers.emplace_back(&GzipBlockWriter::Run, this);
+      }
+      catch (std::system_error const &)
+      {
+	 if (Workers.empty() == true)
+	    return false;
+      }
+      // no file name, no modification time and unix as os like gzip -n
+      Written = FileFd::Write(iFd, "\x1f\x8b\x08\0\0\0\0\0\0\x03", 10);
+      return true;
+   }
+
+   GzipBlockWriter(int const iFd, unsigned int const Threads) : iFd(iFd), MaxPending(2 * Threads),
+      Crc(crc32(0, nullptr, 0)), Total(0), Stop(false)
+   {
+      Current.reserve(BlockSize);
+   }
+   ~GzipBlockWriter() { StopWorkers(); }
+};
+									/*}}}*/
+#endif
 class APT_HIDDEN GzipFileFdPrivate: public FileFdPrivate {				/*{{{*/
 #ifdef HAVE_ZLIB
+   SeekTable table;
+   // uncompressed offset of the member gz was opened at
+   unsigned long long chunkbase;
+   bool seekable;
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+   // used instead of gz to write with more than one thread
+   std::unique_ptr<GzipBlockWriter> blocks;
+#endif
+
+   bool LoadTable()
+   {
+      if ((openmode & FileFd::ReadWrite) != FileFd::ReadOnly)
+	 return false;
+      if (table.State != SeekTable::UNKNOWN)
+	 return table.State == SeekTable::LOADED;
+      // the table is in the extra field of an empty member at the end
+      std::string Preamble;
+      size_t const TrailerSize = 10;
+      if (table.Load(filefd->iFd, TrailerSize, 16, Preamble) == false)
+	 return false;
+      uint16_t const PayloadSize = (table.Offsets.size() - 1) * sizeof(uint32_t) + SeekTable::FooterSize;
+      uint16_t const XLen = htole16(PayloadSize + 4), Len = htole16(PayloadSize);
+      std::string Header("\x1f\x8b\x08\x04", 4);
+      char Trailer[TrailerSize];
+      struct stat Buf;
+      if (Preamble.compare(0, 4, Header) != 0 || memcmp(Preamble.data() + 10, &XLen, 2) != 0 ||
+	    Preamble.compare(12, 2, "AP") != 0 || memcmp(Preamble.data() + 14, &Len, 2) != 0 ||
+	    fstat(filefd->iFd, &Buf) != 0 ||
+	    pread(filefd->iFd, Trailer, TrailerSize, Buf.st_size - TrailerSize) != TrailerSize ||
+	    memcmp(Trailer, "\x03\0\0\0\0\0\0\0\0\0", TrailerSize) != 0)
+      {
+	 table.State = SeekTable::MISSING;
+	 return false;
+      }
+      return true;
+   }
+   bool SeekChunk(unsigned long long const To)
+   {
+      // gz owns its descriptor, so keep a copy to reopen at the chunk
+      size_t const Chunk = To / table.Chunk;
+      int const iFd = dup(filefd->iFd);
+      if (iFd == -1)
+	 return filefd->FileFdErrno("dup", "Unable to seek to %llu", To);
+      gzclose(gz);
+      filefd->iFd = iFd;
+      if (lseek(iFd, table.Offsets[Chunk], SEEK_SET) < 0 || (gz = gzdopen(iFd, "r")) == nullptr)
+	 return filefd->FileFdErrno("lseek", "Unable to seek to %llu", To);
+      chunkbase = Chunk * table.Chunk;
+      buffer.reset();
+      if (To != chunkbase && gzseek(gz, To - chunkbase, SEEK_SET) != static_cast<off_t>(To - chunkbase))
+	 return filefd->FileFdError("Unable to seek to %llu", To);
+      seekpos = To;
+      return true;
+   }
+   bool FinishChunk()
+   {
+      if (gzflush(gz, Z_FINISH) != Z_OK)
+	 return false;
+      off_t const End = lseek(filefd->iFd, 0, SEEK_CUR);
+      if (End < 0)
+	 return false;
+      table.Sizes.push_back(End - table.ChunkStart);
+      table.ChunkStart = End;
+      table.Filled = 0;
+      return true;
+   }
+   bool WriteTable(int const iFd)
+   {
+      std::string const Payload = table.Payload();
+      if (table.Sizes.empty() == true || Payload.size() + 4 > UINT16_MAX)
+	 return true;
+      std::string Member("\x1f\x8b\x08\x04\0\0\0\0\0\xff", 10);
+      uint16_t const XLen = htole16(Payload.size() + 4), Len = htole16(Payload.size());
+      Member.append(reinterpret_cast<char const *>(&XLen), sizeof(XLen));
+      Member.append("AP", 2);
+      Member.append(reinterpret_cast<char const *>(&Len), sizeof(Len));
+      Member.append(Payload);
+      // an empty final block, the crc and size of no data
+      Member.append("\x03\0\0\0\0\0\0\0\0\0", 10);
+      return FileFd::Write(iFd, Member.data(), Member.size());
+   }
 public:
    gzFile gz;
    virtual bool InternalOpen(int const iFd, unsigned int const Mode) APT_OVERRIDE
@@ -1331,7 +1857,28 @@ public:
       if ((Mode & FileFd::ReadWrite) == FileFd::ReadWrite)
 	 gz = gzdopen(iFd, "r+");
       else if ((Mode & FileFd::WriteOnly) == FileFd::WriteOnly)
+      {
+	 if ((Mode & FileFd::Seekable) == FileFd::Seekable)
+	 {
+	    off_t const Start = lseek(iFd, 0, SEEK_CUR);
+	    seekable = (Start == 0);
+	 }
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+	 unsigned int const threads = findCompressorThreads(compressor.CompressArgs, 'p', "processes");
+	 if (seekable == false && threads > 1)
+	 {
+	    bool written = false;
+	    blocks.reset(new GzipBlockWriter(iFd, threads));
+	    if (blocks->Start(threads, written) == true)
+	    {
+	       filefd->Flags |= FileFd::Compressed;
+	       return written;
+	    }
+	    blocks.reset();
+	 }
+#endif
 	 gz = gzdopen(iFd, "w");
+      }
       else
 	 gz = gzdopen(iFd, "r");
       filefd->Flags |= FileFd::Compressed;
@@ -1355,20 +1902,49 @@ public:
    }
    virtual ssize_t InternalWrite(void const * const From, unsigned long long const Size) APT_OVERRIDE
    {
-      return gzwrite(gz,From,Size);
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+      if (blocks != nullptr)
+	 return blocks->Write(From, Size);
+#endif
+      if (seekable == false)
+	 return gzwrite(gz,From,Size);
+      unsigned long long const towrite = std::min<unsigned long long>(Size, SeekTable::ChunkSize - table.Filled);
+      int const res = gzwrite(gz, From, towrite);
+      if (res <= 0)
+	 return res;
+      table.Filled += res;
+      table.Total += res;
+      if (table.Filled == SeekTable::ChunkSize && FinishChunk() == false)
+	 return -1;
+      return res;
    }
    virtual bool InternalWriteError() APT_OVERRIDE
    {
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+      // the details were reported while the blocks were written
+      if (blocks != nullptr)
+	 return filefd->FileFdError("gzwrite: %s", _("Write error"));
+#endif
+      if (gz == nullptr)
+	 return FileFdPrivate::InternalWriteError();
       int err;
       char const * const errmsg = gzerror(gz, &err);
       if (err != Z_ERRNO)
 	 return filefd->FileFdError("gzwrite: %s (%d: %s)", _("Write error"), err, errmsg);
       return FileFdPrivate::InternalWriteError();
    }
+   virtual bool InternalRandomAccess() APT_OVERRIDE
+   {
+      return LoadTable();
+   }
    virtual bool InternalSeek(unsigned long long const To) APT_OVERRIDE
    {
-      off_t const res = gzseek(gz, To, SEEK_SET);
-      if (res != (off_t)To)
+      if (LoadTable() == true && table.Worthwhile(InternalTell(), To) == true)
+	 return SeekChunk(To);
+      if (To < chunkbase)
+	 return filefd->FileFdError("Unable to seek to %llu", To);
+      off_t const res = gzseek(gz, To - chunkbase, SEEK_SET);
+      if (res != (off_t)(To - chunkbase))
 	 return filefd->FileFdError("Unable to seek to %llu", To);
       seekpos = To;
       buffer.reset();
@@ -1391,15 +1967,21 @@ public:
       off_t const res = gzseek(gz, Over, SEEK_CUR);
       if (res < 0)
 	 return filefd->FileFdError("Unable to seek ahead %llu",Over);
-      seekpos = res;
+      seekpos = chunkbase + res;
       return true;
    }
    virtual unsigned long long InternalTell() APT_OVERRIDE
    {
-      return gztell(gz) - buffer.size();
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+      if (blocks != nullptr)
+	 return blocks->Tell();
+#endif
+      return chunkbase + gztell(gz) - buffer.size();
    }
    virtual unsigned long long InternalSize() APT_OVERRIDE
    {
+      if (LoadTable() == true)
+	 return table.Total;
       unsigned long long filesize = FileFdPrivate::InternalSize();
       // only check gzsize if we are actually a gzip file, just checking for
       // "gz" is not sufficient as uncompressed files could be opened with
@@ -1434,17 +2016,48 @@ public:
    }
    virtual bool InternalClose(std::string const &FileName) APT_OVERRIDE
    {
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+      if (blocks != nullptr)
+      {
+	 // after a failed write the file can't be completed with a trailer
+	 bool const finished = filefd->Failed() == false && blocks->Finish();
+	 blocks.reset();
+	 // like gzclose, we own the descriptor
+	 if (close(filefd->iFd) != 0)
+	    return _error->Errno("close",_("Problem closing the gzip file %s"), FileName.c_str());
+	 if (finished == false)
+	    return filefd->FileFdError(_("Problem closing the gzip file %s"), FileName.c_str());
+	 return true;
+      }
+#endif
       if (gz == nullptr)
 	 return true;
+      int tableFd = -1;
+      if (seekable == true && filefd->Failed() == false)
+      {
+	 seekable = false;
+	 if (table.Filled != 0 && FinishChunk() == false)
+	    return filefd->FileFdError("gzflush: %s", _("Write error"));
+	 // the table has to come after everything gzclose might still write
+	 if (table.Sizes.empty() == false && (tableFd = dup(filefd->iFd)) == -1)
+	    return filefd->FileFdErrno("dup", _("Write error"));
+      }
       int const e = gzclose(gz);
       gz = nullptr;
+      if (tableFd != -1)
+      {
+	 bool const written = WriteTable(tableFd);
+	 close(tableFd);
+	 if (written == false)
+	    return false;
+      }
       // gzdclose() on empty files always fails with "buffer error" here, ignore that
       if (e != 0 && e != Z_BUF_ERROR)
 	 return _error->Errno("close",_("Problem closing the gzip file %s"), FileName.c_str());
       return true;
    }
 
-   explicit GzipFileFdPrivate(FileFd * const filefd) : FileFdPrivate(filefd), gz(nullptr) {}
+   explicit GzipFileFdPrivate(FileFd * const filefd) : FileFdPrivate(filefd), chunkbase(0), seekable(false), gz(nullptr) {}
    virtual ~GzipFileFdPrivate() { InternalClose(""); }
 #endif
 };
@@ -1514,6 +2127,66 @@ class APT_HIDDEN Lz4FileFdPrivate: public FileFdPrivate {				/*{{{*/
    simple_buffer lz4_buffer;
    // Count of bytes that the decompressor expects to read next, or buffer size.
    size_t next_to_load = APT_BUFFER_SIZE;
+   SeekTable table;
+   bool seekable = false;
+   // a frame is started, but not yet ended
+   bool frame_open = false;
+
+   static constexpr uint32_t LZ4_SKIPPABLE_MAGIC = 0x184D2A5A;
+   bool LoadTable()
+   {
+      if ((openmode & FileFd::ReadWrite) != FileFd::ReadOnly)
+	 return false;
+      if (table.State != SeekTable::UNKNOWN)
+	 return table.State == SeekTable::LOADED;
+      // the table is the content of a skippable frame at the end
+      std::string Preamble;
+      if (table.Load(filefd->iFd, 0, 8, Preamble) == false)
+	 return false;
+      uint32_t const Magic = htole32(LZ4_SKIPPABLE_MAGIC);
+      uint32_t const Size = htole32((table.Offsets.size() - 1) * sizeof(uint32_t) + SeekTable::FooterSize);
+      if (memcmp(Preamble.data(), &Magic, sizeof(Magic)) != 0 || memcmp(Preamble.data() + 4, &Size, sizeof(Size)) != 0)
+      {
+	 table.State = SeekTable::MISSING;
+	 return false;
+      }
+      return true;
+   }
+   bool SeekChunk(unsigned long long const To)
+   {
+      size_t const Chunk = To / table.Chunk;
+      if (backend.Seek(table.Offsets[Chunk]) == false)
+	 return false;
+      // start a fresh decompression at the beginning of the frame
+      LZ4F_freeDecompressionContext(dctx);
+      res = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+      if (LZ4F_isError(res))
+      {
+	 dctx = nullptr;
+	 return filefd->FileFdError("LZ4F: %s %s", filefd->FileName.c_str(), LZ4F_getErrorName(res));
+      }
+      lz4_buffer.reset();
+      next_to_load = APT_BUFFER_SIZE;
+      buffer.reset();
+      seekpos = Chunk * table.Chunk;
+      return filefd->Skip(To - seekpos);
+   }
+   bool WriteOut()
+   {
+      return LZ4F_isError(res) == false && backend.Write(lz4_buffer.buffer, res);
+   }
+   bool FinishChunk()
+   {
+      res = LZ4F_compressEnd(cctx, lz4_buffer.buffer, lz4_buffer.buffersize_max, nullptr);
+      if (WriteOut() == false)
+	 return false;
+      frame_open = false;
+      unsigned long long const End = backend.Tell();
+      table.Sizes.push_back(End - table.ChunkStart);
+      table.ChunkStart = End;
+      table.Filled = 0;
+      return true;
+   }
 public:
    virtual bool InternalOpen(int const iFd, unsigned int const Mode) APT_OVERRIDE
    {
@@ -1544,14 +2217,17 @@ public:
 	 res = LZ4F_compressBegin(cctx, lz4_buffer.buffer, lz4_buffer.buffersize_max, nullptr);
 	 if (LZ4F_isError(res) || backend.Write(lz4_buffer.buffer, res) == false)
 	    return false;
+	 frame_open = true;
+	 seekable = (Mode & FileFd::Seekable) == FileFd::Seekable && res == backend.Tell();
       }
 
       return true;
    }
    virtual ssize_t InternalUnbufferedRead(void * const To, unsigned long long const Size) APT_OVERRIDE
    {
-      /* Keep reading as long as the compressor still wants to read */
-      while (next_to_load) {
+      /* Keep reading as long as the compressor still wants to read or
+         another frame follows the one which just ended */
+      while (true) {
 	 // Fill compressed buffer;
 	 if (lz4_buffer.empty()) {
 	    unsigned long long read;
@@ -1562,7 +2238,9 @@ public:
 	    lz4_buffer.bufferend += read;
 
 	    /* Expected EOF */
-	    if (read == 0) {
+	    if (read == 0 && next_to_load == 0)
+	       return 0;
+	    else if (read == 0) {
 	       res = -1;
 	       return filefd->FileFdError("LZ4F: %s %s",
 					  filefd->FileName.c_str(),
@@ -1583,8 +2261,6 @@ public:
 	 if (out != 0)
 	    return out;
       }
-
-      return 0;
    }
    virtual bool InternalReadError() APT_OVERRIDE
    {
@@ -1594,7 +2270,18 @@ public:
    }
    virtual ssize_t InternalWrite(void const * const From, unsigned long long const Size) APT_OVERRIDE
    {
-      unsigned long long const towrite = std::min(APT_BUFFER_SIZE, Size);
+      unsigned long long towrite = std::min(APT_BUFFER_SIZE, Size);
+      if (seekable == true)
+      {
+	 if (frame_open == false)
+	 {
+	    res = LZ4F_compressBegin(cctx, lz4_buffer.buffer, lz4_buffer.buffersize_max, nullptr);
+	    if (WriteOut() == false)
+	       return -1;
+	    frame_open = true;
+	 }
+	 towrite = std::min<unsigned long long>(towrite, SeekTable::ChunkSize - table.Filled);
+      }
 
       res = LZ4F_compressUpdate(cctx,
 				lz4_buffer.buffer, lz4_buffer.buffersize_max,
@@ -1603,6 +2290,13 @@ public:
       if (LZ4F_isError(res) || backend.Write(lz4_buffer.buffer, res) == false)
 	 return -1;
 
+      if (seekable == true)
+      {
+	 table.Filled += towrite;
+	 table.Total += towrite;
+	 if (table.Filled == SeekTable::ChunkSize && FinishChunk() == false)
+	    return -1;
+      }
       return towrite;
    }
    virtual bool InternalWriteError() APT_OVERRIDE
@@ -1617,6 +2311,22 @@ public:
    {
       return backend.Flush();
    }
+   virtual bool InternalRandomAccess() APT_OVERRIDE
+   {
+      return LoadTable();
+   }
+   virtual bool InternalSeek(unsigned long long const To) APT_OVERRIDE
+   {
+      if (LoadTable() == true && table.Worthwhile(InternalTell(), To) == true)
+	 return SeekChunk(To);
+      return FileFdPrivate::InternalSeek(To);
+   }
+   virtual unsigned long long InternalSize() APT_OVERRIDE
+   {
+      if (LoadTable() == true)
+	 return table.Total;
+      return FileFdPrivate::InternalSize();
+   }
 
    virtual bool InternalClose(std::string const &) APT_OVERRIDE
    {
@@ -1628,9 +2338,26 @@ public:
       {
 	 if (filefd->Failed() == false)
 	 {
-	    res = LZ4F_compressEnd(cctx, lz4_buffer.buffer, lz4_buffer.buffersize_max, nullptr);
-	    if (LZ4F_isError(res) || backend.Write(lz4_buffer.buffer, res) == false)
-	       return false;
+	    if (seekable == true && table.Filled != 0)
+	    {
+	       if (FinishChunk() == false)
+		  return false;
+	    }
+	    else if (frame_open == true)
+	    {
+	       res = LZ4F_compressEnd(cctx, lz4_buffer.buffer, lz4_buffer.buffersize_max, nullptr);
+	       if (LZ4F_isError(res) || backend.Write(lz4_buffer.buffer, res) == false)
+		  return false;
+	    }
+	    if (seekable == true && table.Sizes.empty() == false)
+	    {
+	       std::string const Payload = table.Payload();
+	       uint32_t const Header[] = { htole32(LZ4_SKIPPABLE_MAGIC), htole32(Payload.size()) };
+	       if (backend.Write(Header, sizeof(Header)) == false ||
+		     backend.Write(Payload.data(), Payload.size()) == false)
+		  return false;
+	    }
+	    seekable = frame_open = false;
 	    if (!backend.Flush())
 	       return false;
 	 }
@@ -1660,6 +2387,178 @@ public:
       InternalClose("");
    }
 #endif
+};
+									/*}}}*/
+class APT_HIDDEN ZstdFileFdPrivate: public FileFdPrivate {				/*{{{*/
+#ifdef HAVE_ZSTD
+   ZSTD_DStream *dctx;
+   ZSTD_CStream *cctx;
+   size_t res;
+   FileFd backend;
+   simple_buffer zstd_buffer;
+   // Count of bytes that the decompressor expects to read next, or buffer size.
+   size_t next_to_load = APT_BUFFER_SIZE;
+   // the last decompression filled the output, so more might be pending
+   bool output_full = false;
+
+   static int findZstdLevel(std::vector<std::string> const &Args)
+   {
+      for (auto a = Args.rbegin(); a != Args.rend(); ++a)
+	 if (a->size() > 1 && (*a)[0] == '-' && isdigit((*a)[1]) != 0)
+	 {
+	    int const level = atoi(a->c_str() + 1);
+	    if (level > 0 && level <= ZSTD_maxCLevel())
+	       return level;
+	 }
+      return 19;
+   }
+public:
+   virtual bool InternalOpen(int const iFd, unsigned int const Mode) APT_OVERRIDE
+   {
+      if ((Mode & FileFd::ReadWrite) == FileFd::ReadWrite)
+	 return _error->Error("zstd only supports write or read mode");
+
+      if ((Mode & FileFd::WriteOnly) == FileFd::WriteOnly) {
+	 cctx = ZSTD_createCStream();
+	 if (cctx == nullptr)
+	    return false;
+	 res = ZSTD_initCStream(cctx, findZstdLevel(compressor.CompressArgs));
+	 zstd_buffer.reset(ZSTD_CStreamOutSize());
+      } else {
+	 dctx = ZSTD_createDStream();
+	 if (dctx == nullptr)
+	    return false;
+	 res = ZSTD_initDStream(dctx);
+	 zstd_buffer.reset(APT_BUFFER_SIZE);
+      }
+
+      filefd->Flags |= FileFd::Compressed;
+
+      if (ZSTD_isError(res))
+	 return false;
+
+      unsigned int flags = (Mode & (FileFd::WriteOnly|FileFd::ReadOnly));
+      if (backend.OpenDescriptor(iFd, flags, FileFd::None, true) == false)
+	 return false;
+
+      return true;
+   }
+   virtual ssize_t InternalUnbufferedRead(void * const To, unsigned long long const Size) APT_OVERRIDE
+   {
+      /* Keep reading as long as the decompressor still wants to read or
+         another frame follows the one which just ended */
+      while (true) {
+	 // Fill compressed buffer, unless an unfinished frame has output pending
+	 if (zstd_buffer.empty() && (output_full == false || res == 0)) {
+	    unsigned long long read;
+	    zstd_buffer.reset(next_to_load);
+	    if (backend.Read(zstd_buffer.getend(), zstd_buffer.free(), &read) == false)
+	       return -1;
+	    zstd_buffer.bufferend += read;
+
+	    if (read == 0) {
+	       /* Expected EOF */
+	       if (res == 0)
+		  return 0;
+	       res = -1;
+	       return filefd->FileFdError("ZSTD: %s %s",
+					  filefd->FileName.c_str(),
+					  _("Unexpected end of file")), -1;
+	    }
+	 }
+	 // Drain compressed buffer as far as possible.
+	 ZSTD_inBuffer in = { zstd_buffer.get(), zstd_buffer.size(), 0 };
+	 ZSTD_outBuffer out = { To, Size, 0 };
+
+	 res = ZSTD_decompressStream(dctx, &out, &in);
+	 if (ZSTD_isError(res))
+	    return -1;
+
+	 // a frame has ended if zero, so read whatever follows
+	 next_to_load = (res == 0) ? APT_BUFFER_SIZE : std::max<size_t>(res, 1);
+	 output_full = out.pos == out.size;
+	 zstd_buffer.bufferstart += in.pos;
+
+	 if (out.pos != 0)
+	    return out.pos;
+      }
+   }
+   virtual bool InternalReadError() APT_OVERRIDE
+   {
+      char const * const errmsg = ZSTD_getErrorName(res);
+
+      return filefd->FileFdError("ZSTD: %s %s (%zu: %s)", filefd->FileName.c_str(), _("Read error"), res, errmsg);
+   }
+   virtual ssize_t InternalWrite(void const * const From, unsigned long long const Size) APT_OVERRIDE
+   {
+      ZSTD_inBuffer in = { From, std::min(APT_BUFFER_SIZE, Size), 0 };
+      while (in.pos < in.size) {
+	 ZSTD_outBuffer out = { zstd_buffer.buffer, zstd_buffer.buffersize_max, 0 };
+	 res = ZSTD_compressStream(cctx, &out, &in);
+	 if (ZSTD_isError(res) || backend.Write(zstd_buffer.buffer, out.pos) == false)
+	    return -1;
+      }
+      return in.pos;
+   }
+   virtual bool InternalWriteError() APT_OVERRIDE
+   {
+      char const * const errmsg = ZSTD_getErrorName(res);
+
+      return filefd->FileFdError("ZSTD: %s %s (%zu: %s)", filefd->FileName.c_str(), _("Write error"), res, errmsg);
+   }
+   virtual bool InternalStream() const APT_OVERRIDE { return true; }
+
+   virtual bool InternalFlush() APT_OVERRIDE
+   {
+      return backend.Flush();
+   }
+
+   virtual bool InternalClose(std::string const &) APT_OVERRIDE
+   {
+      /* Reset variables */
+      res = 0;
+      next_to_load = APT_BUFFER_SIZE;
+      output_full = false;
+
+      if (cctx != nullptr)
+      {
+	 if (filefd->Failed() == false)
+	 {
+	    do {
+	       ZSTD_outBuffer out = { zstd_buffer.buffer, zstd_buffer.buffersize_max, 0 };
+	       res = ZSTD_endStream(cctx, &out);
+	       if (ZSTD_isError(res) || backend.Write(zstd_buffer.buffer, out.pos) == false)
+		  return false;
+	    } while (res > 0);
+	    if (!backend.Flush())
+	       return false;
+	 }
+	 if (!backend.Close())
+	    return false;
+
+	 res = ZSTD_freeCStream(cctx);
+	 cctx = nullptr;
+      }
+
+      if (dctx != nullptr)
+      {
+	 res = ZSTD_freeDStream(dctx);
+	 dctx = nullptr;
+      }
+      if (backend.IsOpen())
+      {
+	 backend.Close();
+	 filefd->iFd = -1;
+      }
+
+      return ZSTD_isError(res) == false;
+   }
+
+   explicit ZstdFileFdPrivate(FileFd * const filefd) : FileFdPrivate(filefd), dctx(nullptr), cctx(nullptr), res(0) {}
+   virtual ~ZstdFileFdPrivate() {
+      InternalClose("");
+   }
+#endif
 };
 									/*}}}*/
 class APT_HIDDEN LzmaFileFdPrivate: public FileFdPrivate {				/*{{{*/
@@ -1707,7 +2606,7 @@ class APT_HIDDEN LzmaFileFdPrivate: public FileFdPrivate {				/*{{{*/
    static uint32_t findXZlevel(std::vector<std::string> const &Args)
    {
       for (auto a = Args.rbegin(); a != Args.rend(); ++a)
-	 if (a->empty() == false && (*a)[0] == '-' && (*a)[1] != '-')
+	 if (a->empty() == false && (*a)[0] == '-' && (*a)[1] != '-' && (*a)[1] != 'T')
 	 {
 	    auto const number = a->find_last_of("0123456789");
 	    if (number == std::string::npos)
@@ -1754,6 +2653,21 @@ public:
 	 uint32_t const xzlevel = findXZlevel(compressor.CompressArgs);
 	 if (compressor.Name == "xz")
 	 {
+#if LZMA_VERSION >= 50020000
+	    // the multi-threaded encoder splits the stream into blocks
+	    uint32_t const threads = findCompressorThreads(compressor.CompressArgs, 'T', "threads");
+	    if (threads > 1)
+	    {
+	       lzma_mt mt;
+	       memset(&mt, 0, sizeof(mt));
+	       mt.threads = threads;
+	       mt.preset = xzlevel;
+	       mt.check = LZMA_CHECK_CRC64;
+	       if (lzma_stream_encoder_mt(&lzma->stream, &mt) != LZMA_OK)
+		  return false;
+	    }
+	    else
+#endif
 	    if (lzma_easy_encoder(&lzma->stream, xzlevel, LZMA_CHECK_CRC64) != LZMA_OK)
 	       return false;
 	 }
@@ -2070,6 +2984,11 @@ public:
    }
    virtual bool InternalClose(std::string const &) APT_OVERRIDE { return true; }
    virtual bool InternalAlwaysAutoClose() const APT_OVERRIDE { return false; }
+   virtual bool InternalRandomAccess() APT_OVERRIDE
+   {
+      struct stat Buf;
+      return fstat(filefd->iFd, &Buf) == 0 && S_ISREG(Buf.st_mode);
+   }
 
    explicit DirectFileFdPrivate(FileFd * const filefd) : FileFdPrivate(filefd) {}
    virtual ~DirectFileFdPrivate() { InternalClose(""); }
@@ -2154,6 +3073,7 @@ bool FileFd::Open(string FileName,unsigned int const Mode,CompressMode Compress,
       case Lzma: name = "lzma"; break;
       case Xz: name = "xz"; break;
       case Lz4: name = "lz4"; break;
+      case Zstd: name = "zstd"; break;
       case Auto:
       case Extension:
 	 // Unreachable
@@ -2271,6 +3191,7 @@ bool FileFd::OpenDescriptor(int Fd, unsigned int const Mode, CompressMode Compre
    case Lzma: name = "lzma"; break;
    case Xz: name = "xz"; break;
    case Lz4: name = "lz4"; break;
+   case Zstd: name = "zstd"; break;
    case Auto:
    case Extension:
       if (AutoClose == true && Fd != -1)
@@ -2335,6 +3256,9 @@ bool FileFd::OpenInternDescriptor(unsigned int const Mode, APT::Configuration::C
 #ifdef HAVE_LZ4
       APT_COMPRESS_INIT("lz4", Lz4FileFdPrivate);
 #endif
+#ifdef HAVE_ZSTD
+      APT_COMPRESS_INIT("zstd", ZstdFileFdPrivate);
+#endif
 #undef APT_COMPRESS_INIT
       else if (compressor.Name == "." || compressor.Binary.empty() == true)
 	 d = new DirectFileFdPrivate(this);
@@ -2590,6 +3514,14 @@ time_t FileFd::ModificationTime()
    return Buf.st_mtime;
 }
 									/*}}}*/
+// FileFd::IsRandomAccess - Seeking doesn't read through the file	/*{{{*/
+bool FileFd::IsRandomAccess()
+{
+   if (d == nullptr)
+      return false;
+   return d->InternalRandomAccess();
+}
+									/*}}}*/
 // FileFd::Size - Return the size of the content in the file		/*{{{*/
 unsigned long long FileFd::Size()
 {
@@ -46,6 +46,7 @@ class FileFd
    friend class Bz2FileFdPrivate;
    friend class LzmaFileFdPrivate;
    friend class Lz4FileFdPrivate;
+   friend class ZstdFileFdPrivate;
    friend class DirectFileFdPrivate;
    friend class PipedFileFdPrivate;
    protected:
@@ -68,6 +69,11 @@ class FileFd
 	Atomic = Exclusive | (1 << 4),
 	Empty = (1 << 5),
 	BufferedWrite = (1 << 6),
+	/** compress in independent chunks followed by a table of their
+	 *  offsets, so that Seek doesn't need to decompress the data in
+	 *  front of the target. Implemented for gzip and lz4, ignored
+	 *  otherwise. The file stays readable for all other tools. */
+	Seekable = (1 << 7),
 
 	WriteEmpty = ReadWrite | Create | Empty,
 	WriteExists = ReadWrite,
@@ -76,7 +82,7 @@ class FileFd
 	ReadOnlyGzip,
 	WriteAtomic = ReadWrite | Create | Atomic
    };
-   enum CompressMode { Auto = 'A', None = 'N', Extension = 'E', Gzip = 'G', Bzip2 = 'B', Lzma = 'L', Xz = 'X', Lz4='4' };
+   enum CompressMode { Auto = 'A', None = 'N', Extension = 'E', Gzip = 'G', Bzip2 = 'B', Lzma = 'L', Xz = 'X', Lz4='4', Zstd = 'Z' };
    
    inline bool Read(void *To,unsigned long long Size,bool AllowEof)
    {
@@ -138,6 +144,11 @@ class FileFd
    inline void OpFail() {Flags |= Fail;};
    inline bool Eof() {return (Flags & HitEof) == HitEof;};
    inline bool IsCompressed() {return (Flags & Compressed) == Compressed;};
+   /** \brief whether Seek can go to the target without reading the data in front of it
+    *
+    *  This is the case for files which aren't compressed (or piped) and
+    *  compressed files written with #Seekable. */
+   bool IsRandomAccess();
    inline std::string &Name() {return FileName;};
 
    FileFd(std::string FileName,unsigned int const Mode,unsigned long AccessMode = 0666);
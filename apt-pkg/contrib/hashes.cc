@@ -16,6 +16,7 @@
 #include <apt-pkg/hashes.h>
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/configuration.h>
+#include <apt-pkg/fanout.h>
 #include <apt-pkg/md5.h>
 #include <apt-pkg/sha1.h>
 #include <apt-pkg/sha2.h>
@@ -26,6 +27,8 @@
 #include <stdlib.h>
 #include <string>
 #include <iostream>
+#include <memory>
+#include <vector>
 									/*}}}*/
 
 const char * HashString::_SupportedHashes[] =
@@ -289,10 +292,22 @@ bool HashStringList::operator!=(HashStringList const &other) const
 									/*}}}*/
 
 // PrivateHashes							/*{{{*/
-class PrivateHashes {
+class APT_HIDDEN PrivateHashes {
 public:
    unsigned long long FileSize;
    unsigned int CalcHashes;
+   std::unique_ptr<APT::BlockFanOut> Pipeline;
+
+   bool StopPipeline()
+   {
+      if (Pipeline != nullptr)
+      {
+	 bool const Res = Pipeline->Finish();
+	 Pipeline.reset();
+	 return Res;
+      }
+      return true;
+   }
 
    explicit PrivateHashes(unsigned int const CalcHashes) : FileSize(0), CalcHashes(CalcHashes) {}
    explicit PrivateHashes(HashStringList const &Hashes) : FileSize(0) {
@@ -312,6 +327,12 @@ public:
 // Hashes::Add* - Add the contents of data or FD			/*{{{*/
 bool Hashes::Add(const unsigned char * const Data, unsigned long long const Size)
 {
+   d->FileSize += Size;
+   if (d->Pipeline != nullptr)
+   {
+      d->Pipeline->Add(Data, Size);
+      return true;
+   }
    bool Res = true;
 APT_IGNORE_DEPRECATED_PUSH
    if ((d->CalcHashes & MD5SUM) == MD5SUM)
@@ -323,35 +344,90 @@ APT_IGNORE_DEPRECATED_PUSH
    if ((d->CalcHashes & SHA512SUM) == SHA512SUM)
       Res &= SHA512.Add(Data, Size);
 APT_IGNORE_DEPRECATED_POP
-   d->FileSize += Size;
    return Res;
 }
 bool Hashes::Add(const unsigned char * const Data, unsigned long long const Size, unsigned int const Hashes)
 {
+   if (d->StopPipeline() == false)
+      return false;
    d->CalcHashes = Hashes;
    return Add(Data, Size);
 }
+// Hashes::StartPipeline - Calculate each hash on its own thread	/*{{{*/
+bool Hashes::StartPipeline()
+{
+   if (d->Pipeline != nullptr)
+      return true;
+   if (_config->FindB("APT::Hashes-Pipeline", true) == false)
+      return false;
+   std::vector<SummationImplementation *> Sums;
+APT_IGNORE_DEPRECATED_PUSH
+   if ((d->CalcHashes & MD5SUM) == MD5SUM)
+      Sums.push_back(&MD5);
+   if ((d->CalcHashes & SHA1SUM) == SHA1SUM)
+      Sums.push_back(&SHA1);
+   if ((d->CalcHashes & SHA256SUM) == SHA256SUM)
+      Sums.push_back(&SHA256);
+   if ((d->CalcHashes & SHA512SUM) == SHA512SUM)
+      Sums.push_back(&SHA512);
+APT_IGNORE_DEPRECATED_POP
+   // a single hash is calculated faster without the copying
+   if (Sums.size() < 2)
+      return false;
+   std::vector<APT::BlockFanOut::Consumer> Consumers;
+   for (auto const Sum : Sums)
+      Consumers.emplace_back([Sum](unsigned char const * const Data, size_t const Size) { return Sum->Add(Data, Size); });
+   std::unique_ptr<APT::BlockFanOut> Pipeline(new APT::BlockFanOut());
+   if (Pipeline->Start(Consumers) == false)
+      return false;
+   d->Pipeline = std::move(Pipeline);
+   return true;
+}
+									/*}}}*/
+/* Files are read into the blocks of the pipeline directly. It is only
+   started after the first MiB as threads aren't worth it for small files. */
+static constexpr unsigned long long PipelineThreshold = 1024 * 1024;
 bool Hashes::AddFD(int const Fd,unsigned long long Size)
 {
    unsigned char Buf[64*64];
    bool const ToEOF = (Size == UntilEOF);
+   unsigned long long Done = 0;
+   bool Started = false;
    while (Size != 0 || ToEOF)
    {
+      if (Started == false && Done >= PipelineThreshold)
+	 Started = StartPipeline();
+      unsigned char * To = Buf;
       unsigned long long n = sizeof(Buf);
+      if (d->Pipeline != nullptr)
+      {
+	 size_t Free;
+	 To = d->Pipeline->Reserve(Free);
+	 n = Free;
+      }
       if (!ToEOF) n = std::min(Size, n);
-      ssize_t const Res = read(Fd,Buf,n);
+      ssize_t const Res = read(Fd,To,n);
       if (Res < 0 || (!ToEOF && Res != (ssize_t) n)) // error, or short read
 	 return false;
       if (ToEOF && Res == 0) // EOF
 	 break;
       Size -= Res;
+      Done += Res;
+      if (d->Pipeline != nullptr)
+      {
+	 d->Pipeline->Commit(Res);
+	 d->FileSize += Res;
+	 continue;
+      }
       if (Add(Buf, Res) == false)
 	 return false;
    }
-   return true;
+   return Started == false || d->StopPipeline();
 }
 bool Hashes::AddFD(int const Fd,unsigned long long Size, unsigned int const Hashes)
 {
+   if (d->StopPipeline() == false)
+      return false;
    d->CalcHashes = Hashes;
    return AddFD(Fd, Size);
 }
@@ -359,12 +435,23 @@ bool Hashes::AddFD(FileFd &Fd,unsigned long long Size)
 {
    unsigned char Buf[64*64];
    bool const ToEOF = (Size == 0);
+   unsigned long long Done = 0;
+   bool Started = false;
    while (Size != 0 || ToEOF)
    {
+      if (Started == false && Done >= PipelineThreshold)
+	 Started = StartPipeline();
+      unsigned char * To = Buf;
       unsigned long long n = sizeof(Buf);
+      if (d->Pipeline != nullptr)
+      {
+	 size_t Free;
+	 To = d->Pipeline->Reserve(Free);
+	 n = Free;
+      }
       if (!ToEOF) n = std::min(Size, n);
       unsigned long long a = 0;
-      if (Fd.Read(Buf, n, &a) == false) // error
+      if (Fd.Read(To, n, &a) == false) // error
 	 return false;
       if (ToEOF == false)
       {
@@ -374,13 +461,22 @@ bool Hashes::AddFD(FileFd &Fd,unsigned long long Size)
       else if (a == 0) // EOF
 	 break;
       Size -= a;
+      Done += a;
+      if (d->Pipeline != nullptr)
+      {
+	 d->Pipeline->Commit(a);
+	 d->FileSize += a;
+	 continue;
+      }
       if (Add(Buf, a) == false)
 	 return false;
    }
-   return true;
+   return Started == false || d->StopPipeline();
 }
 bool Hashes::AddFD(FileFd &Fd,unsigned long long Size, unsigned int const Hashes)
 {
+   if (d->StopPipeline() == false)
+      return false;
    d->CalcHashes = Hashes;
    return AddFD(Fd, Size);
 }
@@ -388,6 +484,7 @@ bool Hashes::AddFD(FileFd &Fd,unsigned long long Size, unsigned int const Hashes
 HashStringList Hashes::GetHashStringList()
 {
    HashStringList hashes;
+   d->StopPipeline();
 APT_IGNORE_DEPRECATED_PUSH
    if ((d->CalcHashes & MD5SUM) == MD5SUM)
       hashes.push_back(HashString("MD5Sum", MD5.Result().Value()));
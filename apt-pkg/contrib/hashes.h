@@ -209,6 +209,18 @@ class Hashes
    bool AddFD(FileFd &Fd,unsigned long long Size = 0);
    APT_DEPRECATED_MSG("Construct accordingly instead of choosing hashes while adding") bool AddFD(FileFd &Fd,unsigned long long Size, unsigned int const Hashes);
 
+   /** \brief calculate each of the hashes on a thread of its own
+    *
+    * Data passed to #Add from now on is copied and hashed in the
+    * background while the caller can go on reading the next piece.
+    * #GetHashStringList waits for all of it to be processed.
+    * #AddFD does this on its own for big files already.
+    *
+    * @return \b false if the hashes are calculated on the calling
+    *  thread as before, e.g. if only one is calculated anyway.
+    */
+   bool StartPipeline();
+
    HashStringList GetHashStringList();
 
 APT_IGNORE_DEPRECATED_PUSH
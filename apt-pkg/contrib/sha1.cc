@@ -32,9 +32,23 @@
 #include <config.h>
 
 #include <apt-pkg/sha1.h>
+#include <apt-pkg/configuration.h>
 
 #include <stdint.h>
 #include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || __GNUC__ >= 5)
+#define SHA1_X86_SHA
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) && (defined(__clang__) || __GNUC__ >= 8)
+#define SHA1_ARM_SHA
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1 (1 << 5)
+#endif
+#endif
 									/*}}}*/
 
 // SHA1Transform - Alters an existing SHA-1 hash			/*{{{*/
@@ -175,6 +189,128 @@ static void SHA1Transform(uint32_t state[5],uint8_t const buffer[64])
 }
 									/*}}}*/
 
+// SHA1Blocks - Process whole blocks, with hardware support if available /*{{{*/
+// ---------------------------------------------------------------------
+/* x86 CPUs with the SHA extensions and ARMv8 CPUs with the cryptography
+   extensions have instructions doing four rounds at once, which are used
+   unless APT::Hashes-Hardware is disabled. */
+typedef void (*SHA1Blocks_t)(uint32_t state[5], uint8_t const *data, size_t blocks);
+
+static void SHA1BlocksPortable(uint32_t state[5], uint8_t const *data, size_t blocks)
+{
+   for (; blocks != 0; --blocks, data += 64)
+      SHA1Transform(state, data);
+}
+
+#ifdef SHA1_X86_SHA
+#define SHA1_X86_ROUNDS(i, f) \
+   if (i >= 4) \
+      W[i & 3] = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(W[i & 3], W[(i + 1) & 3]), W[(i + 2) & 3]), W[(i + 3) & 3]); \
+   E = (i == 0) ? _mm_add_epi32(E, W[0]) : _mm_sha1nexte_epu32(Next, W[i & 3]); \
+   Next = ABCD; \
+   ABCD = _mm_sha1rnds4_epu32(ABCD, E, f);
+
+__attribute__((target("sha,sse4.1")))
+static void SHA1BlocksX86(uint32_t state[5], uint8_t const *data, size_t blocks)
+{
+   __m128i const MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+   __m128i ABCD = _mm_shuffle_epi32(_mm_loadu_si128((__m128i const *)state), 0x1B);
+   __m128i E0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+   for (; blocks != 0; --blocks, data += 64)
+   {
+      __m128i const ABCD_SAVE = ABCD;
+      __m128i W[4], E = E0, Next;
+      for (int i = 0; i < 4; ++i)
+	 W[i] = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)(data + 16 * i)), MASK);
+
+      // the function and constant for the rounds change every 20 rounds
+      SHA1_X86_ROUNDS(0, 0)  SHA1_X86_ROUNDS(1, 0)  SHA1_X86_ROUNDS(2, 0)  SHA1_X86_ROUNDS(3, 0)  SHA1_X86_ROUNDS(4, 0)
+      SHA1_X86_ROUNDS(5, 1)  SHA1_X86_ROUNDS(6, 1)  SHA1_X86_ROUNDS(7, 1)  SHA1_X86_ROUNDS(8, 1)  SHA1_X86_ROUNDS(9, 1)
+      SHA1_X86_ROUNDS(10, 2) SHA1_X86_ROUNDS(11, 2) SHA1_X86_ROUNDS(12, 2) SHA1_X86_ROUNDS(13, 2) SHA1_X86_ROUNDS(14, 2)
+      SHA1_X86_ROUNDS(15, 3) SHA1_X86_ROUNDS(16, 3) SHA1_X86_ROUNDS(17, 3) SHA1_X86_ROUNDS(18, 3) SHA1_X86_ROUNDS(19, 3)
+
+      E0 = _mm_sha1nexte_epu32(Next, E0);
+      ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+   }
+
+   _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(ABCD, 0x1B));
+   state[4] = _mm_extract_epi32(E0, 3);
+}
+#undef SHA1_X86_ROUNDS
+
+static bool SHA1HaveX86()
+{
+   unsigned int eax, ebx, ecx, edx;
+   if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0 ||
+	 (ecx & bit_SSSE3) == 0 || (ecx & bit_SSE4_1) == 0 ||
+	 __get_cpuid_max(0, nullptr) < 7)
+      return false;
+   __cpuid_count(7, 0, eax, ebx, ecx, edx);
+   return (ebx & (1 << 29)) != 0; // bit_SHA
+}
+#endif
+
+#ifdef SHA1_ARM_SHA
+__attribute__((target("+crypto")))
+static void SHA1BlocksARM(uint32_t state[5], uint8_t const *data, size_t blocks)
+{
+   static uint32_t const K[] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+   uint32x4_t ABCD = vld1q_u32(state);
+   uint32_t E0 = state[4];
+
+   for (; blocks != 0; --blocks, data += 64)
+   {
+      uint32x4_t const ABCD_SAVE = ABCD;
+      uint32_t E = E0;
+      uint32x4_t W[4];
+      for (int i = 0; i < 4; ++i)
+	 W[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+
+      for (int i = 0; i < 20; ++i)
+      {
+	 if (i >= 4)
+	    W[i & 3] = vsha1su1q_u32(vsha1su0q_u32(W[i & 3], W[(i + 1) & 3], W[(i + 2) & 3]), W[(i + 3) & 3]);
+	 uint32x4_t const WK = vaddq_u32(W[i & 3], vdupq_n_u32(K[i / 5]));
+	 uint32_t const Next = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+	 if (i < 5)
+	    ABCD = vsha1cq_u32(ABCD, E, WK);
+	 else if (i >= 10 && i < 15)
+	    ABCD = vsha1mq_u32(ABCD, E, WK);
+	 else
+	    ABCD = vsha1pq_u32(ABCD, E, WK);
+	 E = Next;
+      }
+
+      ABCD = vaddq_u32(ABCD, ABCD_SAVE);
+      E0 += E;
+   }
+
+   vst1q_u32(state, ABCD);
+   state[4] = E0;
+}
+#endif
+
+static SHA1Blocks_t SHA1ChooseBlocks()
+{
+   if (_config->FindB("APT::Hashes-Hardware", true) == true)
+   {
+#if defined(SHA1_X86_SHA)
+      if (SHA1HaveX86() == true)
+	 return SHA1BlocksX86;
+#elif defined(SHA1_ARM_SHA)
+      if ((getauxval(AT_HWCAP) & HWCAP_SHA1) != 0)
+	 return SHA1BlocksARM;
+#endif
+   }
+   return SHA1BlocksPortable;
+}
+static void SHA1Blocks(uint32_t state[5], uint8_t const *data, size_t blocks)
+{
+   static SHA1Blocks_t const impl = SHA1ChooseBlocks();
+   impl(state, data, blocks);
+}
+									/*}}}*/
 // SHA1Summation::SHA1Summation - Constructor                           /*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -256,11 +392,10 @@ bool SHA1Summation::Add(const unsigned char *data,unsigned long long len)
    if ((j + len) > 63)
    {
       memcpy(&buffer[j],data,(i = 64 - j));
-      SHA1Transform(state,buffer);
-      for (; i + 63 < len; i += 64)
-      {
-	 SHA1Transform(state,&data[i]);
-      }
+      SHA1Blocks(state,buffer,1);
+      size_t const blocks = (len - i) / 64;
+      SHA1Blocks(state,&data[i],blocks);
+      i += blocks * 64;
       j = 0;
    }
    else
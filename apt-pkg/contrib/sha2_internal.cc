@@ -33,11 +33,34 @@
  */
 #include <config.h>
 
+#include <apt-pkg/configuration.h>
+
 #include <endian.h>
 #include <string.h>	/* memcpy()/memset() or bcopy()/bzero() */
 #include <assert.h>	/* assert() */
 #include "sha2_internal.h"
 
+/*
+ * HARDWARE ACCELERATION NOTE:
+ * On x86 CPUs with the SHA extensions and on ARMv8 CPUs with the
+ * cryptography extensions SHA-256 blocks are processed with the
+ * dedicated instructions instead of the portable transform below.
+ * The choice is made at runtime on first use, and can be overridden
+ * with APT::Hashes-Hardware "false".
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || __GNUC__ >= 5)
+#define SHA2_X86_SHA
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) && (defined(__clang__) || __GNUC__ >= 8)
+#define SHA2_ARM_SHA
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#endif
+
 /*
  * ASSERT NOTE:
  * Some sanity checking code is included using assert().  On my FreeBSD
@@ -528,6 +551,131 @@ static void SHA256_Transform(SHA256_CTX* context, const sha2_word32* data) {
 
 #endif /* SHA2_UNROLL_TRANSFORM */
 
+/*** SHA-256 block processing with hardware support *******************/
+typedef void (*SHA256_Blocks_t)(SHA256_CTX*, const sha2_byte*, size_t);
+
+static void SHA256_Blocks_Portable(SHA256_CTX* context, const sha2_byte* data, size_t blocks) {
+	for (; blocks != 0; --blocks, data += SHA256_BLOCK_LENGTH) {
+		/* The transform reads the data as words, so align it */
+		sha2_word32	buffer[SHA256_BLOCK_LENGTH / sizeof(sha2_word32)];
+		MEMCPY_BCOPY(buffer, data, SHA256_BLOCK_LENGTH);
+		SHA256_Transform(context, buffer);
+	}
+}
+
+#ifdef SHA2_X86_SHA
+/* The state is kept as ABEF and CDGH by sha256rnds2, each message
+ * vector holds four big-endian words of the block. */
+__attribute__((target("sha,sse4.1")))
+static void SHA256_Blocks_X86(SHA256_CTX* context, const sha2_byte* data, size_t blocks) {
+	const __m128i	MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i		STATE0, STATE1, TMP, MSG[4];
+
+	TMP = _mm_loadu_si128((const __m128i*)&context->state[0]);
+	STATE1 = _mm_loadu_si128((const __m128i*)&context->state[4]);
+	TMP = _mm_shuffle_epi32(TMP, 0xB1);		/* CDAB */
+	STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);	/* EFGH */
+	STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);	/* ABEF */
+	STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);	/* CDGH */
+
+	for (; blocks != 0; --blocks, data += SHA256_BLOCK_LENGTH) {
+		__m128i const	ABEF_SAVE = STATE0, CDGH_SAVE = STATE1;
+		int		j;
+
+		for (j = 0; j < 16; ++j) {
+			__m128i	W;
+			if (j < 4) {
+				W = MSG[j] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * j)), MASK);
+			} else {
+				/* W[t-16] + sigma0(W[t-15]) + W[t-7], then sigma1(W[t-2]) */
+				W = _mm_sha256msg1_epu32(MSG[j & 3], MSG[(j + 1) & 3]);
+				W = _mm_add_epi32(W, _mm_alignr_epi8(MSG[(j + 3) & 3], MSG[(j + 2) & 3], 4));
+				W = MSG[j & 3] = _mm_sha256msg2_epu32(W, MSG[(j + 3) & 3]);
+			}
+			W = _mm_add_epi32(W, _mm_loadu_si128((const __m128i*)&K256[4 * j]));
+			STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, W);
+			STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, _mm_shuffle_epi32(W, 0x0E));
+		}
+
+		STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+		STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+	}
+
+	TMP = _mm_shuffle_epi32(STATE0, 0x1B);		/* FEBA */
+	STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);	/* DCHG */
+	STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);	/* DCBA */
+	STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);	/* HGFE */
+	_mm_storeu_si128((__m128i*)&context->state[0], STATE0);
+	_mm_storeu_si128((__m128i*)&context->state[4], STATE1);
+}
+
+static int SHA256_Have_X86(void) {
+	unsigned int	eax, ebx, ecx, edx;
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0 ||
+	    (ecx & bit_SSSE3) == 0 || (ecx & bit_SSE4_1) == 0 ||
+	    __get_cpuid_max(0, 0) < 7) {
+		return 0;
+	}
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	/* bit_SHA in newer <cpuid.h> */
+	return (ebx & (1 << 29)) != 0;
+}
+#endif /* SHA2_X86_SHA */
+
+#ifdef SHA2_ARM_SHA
+__attribute__((target("+crypto")))
+static void SHA256_Blocks_ARM(SHA256_CTX* context, const sha2_byte* data, size_t blocks) {
+	uint32x4_t	STATE0, STATE1, MSG[4];
+
+	STATE0 = vld1q_u32(&context->state[0]);
+	STATE1 = vld1q_u32(&context->state[4]);
+
+	for (; blocks != 0; --blocks, data += SHA256_BLOCK_LENGTH) {
+		uint32x4_t const	ABCD_SAVE = STATE0, EFGH_SAVE = STATE1;
+		int			j;
+
+		for (j = 0; j < 16; ++j) {
+			uint32x4_t	W, TMP;
+			if (j < 4) {
+				MSG[j] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * j)));
+			} else {
+				MSG[j & 3] = vsha256su1q_u32(vsha256su0q_u32(MSG[j & 3], MSG[(j + 1) & 3]),
+							     MSG[(j + 2) & 3], MSG[(j + 3) & 3]);
+			}
+			W = vaddq_u32(MSG[j & 3], vld1q_u32(&K256[4 * j]));
+			TMP = STATE0;
+			STATE0 = vsha256hq_u32(STATE0, STATE1, W);
+			STATE1 = vsha256h2q_u32(STATE1, TMP, W);
+		}
+
+		STATE0 = vaddq_u32(STATE0, ABCD_SAVE);
+		STATE1 = vaddq_u32(STATE1, EFGH_SAVE);
+	}
+
+	vst1q_u32(&context->state[0], STATE0);
+	vst1q_u32(&context->state[4], STATE1);
+}
+#endif /* SHA2_ARM_SHA */
+
+static SHA256_Blocks_t SHA256_Choose_Blocks(void) {
+	if (_config->FindB("APT::Hashes-Hardware", true) == true) {
+#if defined(SHA2_X86_SHA)
+		if (SHA256_Have_X86())
+			return SHA256_Blocks_X86;
+#elif defined(SHA2_ARM_SHA)
+		if ((getauxval(AT_HWCAP) & HWCAP_SHA2) != 0)
+			return SHA256_Blocks_ARM;
+#endif
+	}
+	return SHA256_Blocks_Portable;
+}
+
+static void SHA256_Blocks(SHA256_CTX* context, const sha2_byte* data, size_t blocks) {
+	static SHA256_Blocks_t const impl = SHA256_Choose_Blocks();
+	impl(context, data, blocks);
+}
+
 void SHA256_Update(SHA256_CTX* context, const sha2_byte *data, size_t len) {
 	unsigned int	freespace, usedspace;
 
@@ -550,7 +698,7 @@ void SHA256_Update(SHA256_CTX* context, const sha2_byte *data, size_t len) {
 			context->bitcount += freespace << 3;
 			len -= freespace;
 			data += freespace;
-			SHA256_Transform(context, (sha2_word32*)context->buffer);
+			SHA256_Blocks(context, context->buffer, 1);
 		} else {
 			/* The buffer is not yet full */
 			MEMCPY_BCOPY(&context->buffer[usedspace], data, len);
@@ -560,14 +708,13 @@ void SHA256_Update(SHA256_CTX* context, const sha2_byte *data, size_t len) {
 			return;
 		}
 	}
-	while (len >= SHA256_BLOCK_LENGTH) {
+	if (len >= SHA256_BLOCK_LENGTH) {
 		/* Process as many complete blocks as we can */
-		sha2_byte buffer[SHA256_BLOCK_LENGTH];
-		MEMCPY_BCOPY(buffer, data, SHA256_BLOCK_LENGTH);
-		SHA256_Transform(context, (sha2_word32*)buffer);
-		context->bitcount += SHA256_BLOCK_LENGTH << 3;
-		len -= SHA256_BLOCK_LENGTH;
-		data += SHA256_BLOCK_LENGTH;
+		size_t const blocks = len / SHA256_BLOCK_LENGTH;
+		SHA256_Blocks(context, data, blocks);
+		context->bitcount += (sha2_word64)blocks * SHA256_BLOCK_LENGTH << 3;
+		len -= blocks * SHA256_BLOCK_LENGTH;
+		data += blocks * SHA256_BLOCK_LENGTH;
 	}
 	if (len > 0) {
 		/* There's left-overs, so save 'em */
@@ -579,7 +726,7 @@ void SHA256_Update(SHA256_CTX* context, const sha2_byte *data, size_t len) {
 }
 
 void SHA256_Final(sha2_byte digest[], SHA256_CTX* context) {
-	sha2_word32	*d = (sha2_word32*)digest;
+	sha2_byte	*d = digest;
 	unsigned int	usedspace;
 
 	/* Sanity check: */
@@ -604,7 +751,7 @@ void SHA256_Final(sha2_byte digest[], SHA256_CTX* context) {
 					MEMSET_BZERO(&context->buffer[usedspace], SHA256_BLOCK_LENGTH - usedspace);
 				}
 				/* Do second-to-last transform: */
-				SHA256_Transform(context, (sha2_word32*)context->buffer);
+				SHA256_Blocks(context, context->buffer, 1);
 
 				/* And set-up for the last transform: */
 				MEMSET_BZERO(context->buffer, SHA256_SHORT_BLOCK_LENGTH);
@@ -616,16 +763,12 @@ void SHA256_Final(sha2_byte digest[], SHA256_CTX* context) {
 			/* Begin padding with a 1 bit: */
 			*context->buffer = 0x80;
 		}
-		/* Set the bit count: */
-		union {
-			sha2_byte* c;
-			sha2_word64* l;
-		} bitcount;
-		bitcount.c = &context->buffer[SHA256_SHORT_BLOCK_LENGTH];
-		*(bitcount.l) = context->bitcount;
+		/* Set the bit count (copied as the buffer is read as words
+		 * by the transform, so storing it as a word would alias): */
+		MEMCPY_BCOPY(&context->buffer[SHA256_SHORT_BLOCK_LENGTH], &context->bitcount, sizeof(context->bitcount));
 
 		/* Final transform: */
-		SHA256_Transform(context, (sha2_word32*)context->buffer);
+		SHA256_Blocks(context, context->buffer, 1);
 
 #if BYTE_ORDER == LITTLE_ENDIAN
 		{
@@ -633,7 +776,8 @@ void SHA256_Final(sha2_byte digest[], SHA256_CTX* context) {
 			int	j;
 			for (j = 0; j < 8; j++) {
 				REVERSE32(context->state[j],context->state[j]);
-				*d++ = context->state[j];
+				MEMCPY_BCOPY(d, &context->state[j], sizeof(context->state[j]));
+				d += sizeof(context->state[j]);
 			}
 		}
 #else
@@ -941,20 +1085,15 @@ static void SHA512_Last(SHA512_CTX* context) {
 		*context->buffer = 0x80;
 	}
 	/* Store the length of input data (in bits): */
-	union {
-		sha2_byte* c;
-		sha2_word64* l;
-	} bitcount;
-	bitcount.c = &context->buffer[SHA512_SHORT_BLOCK_LENGTH];
-	bitcount.l[0] = context->bitcount[1];
-	bitcount.l[1] = context->bitcount[0];
+	MEMCPY_BCOPY(&context->buffer[SHA512_SHORT_BLOCK_LENGTH], &context->bitcount[1], sizeof(context->bitcount[1]));
+	MEMCPY_BCOPY(&context->buffer[SHA512_SHORT_BLOCK_LENGTH + 8], &context->bitcount[0], sizeof(context->bitcount[0]));
 
 	/* Final transform: */
 	SHA512_Transform(context, (sha2_word64*)context->buffer);
 }
 
 void SHA512_Final(sha2_byte digest[], SHA512_CTX* context) {
-	sha2_word64	*d = (sha2_word64*)digest;
+	sha2_byte	*d = digest;
 
 	/* Sanity check: */
 	assert(context != (SHA512_CTX*)0);
@@ -970,7 +1109,8 @@ void SHA512_Final(sha2_byte digest[], SHA512_CTX* context) {
 			int	j;
 			for (j = 0; j < 8; j++) {
 				REVERSE64(context->state[j],context->state[j]);
-				*d++ = context->state[j];
+				MEMCPY_BCOPY(d, &context->state[j], sizeof(context->state[j]));
+				d += sizeof(context->state[j]);
 			}
 		}
 #else
@@ -1029,7 +1169,7 @@ void SHA384_Update(SHA384_CTX* context, const sha2_byte* data, size_t len) {
 }
 
 void SHA384_Final(sha2_byte digest[], SHA384_CTX* context) {
-	sha2_word64	*d = (sha2_word64*)digest;
+	sha2_byte	*d = digest;
 
 	/* Sanity check: */
 	assert(context != (SHA384_CTX*)0);
@@ -1045,7 +1185,8 @@ void SHA384_Final(sha2_byte digest[], SHA384_CTX* context) {
 			int	j;
 			for (j = 0; j < 6; j++) {
 				REVERSE64(context->state[j],context->state[j]);
-				*d++ = context->state[j];
+				MEMCPY_BCOPY(d, &context->state[j], sizeof(context->state[j]));
+				d += sizeof(context->state[j]);
 			}
 		}
 #else
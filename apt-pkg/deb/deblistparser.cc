@@ -44,13 +44,37 @@ static const debListParser::WordList PrioList[] = {
    {"extra",pkgCache::State::Extra},
    {"", 0}};
 
+class APT_HIDDEN debListParserPrivate					/*{{{*/
+{
+public:
+   /* A section read ahead by Prepare: the data is a copy of the section,
+      the index the one built by pkgTagSection::Scan and the rest are the
+      values the cache generator asks for which do not need the cache */
+   struct PreparedSection
+   {
+      map_filesize_t Offset;
+      size_t Data;
+      size_t Index;
+      std::string Package;
+      unsigned short VersionHash;
+      MD5SumValue Description_md5;
+   };
+   std::vector<PreparedSection> Sections;
+   std::string Data;
+   std::vector<unsigned int> Index;
+   size_t Current;
+   bool Prepared;
+
+   debListParserPrivate() : Current(0), Prepared(false) {}
+};
+									/*}}}*/
 // ListParser::debListParser - Constructor				/*{{{*/
 // ---------------------------------------------------------------------
 /* Provide an architecture and only this one and "all" will be accepted
    in Step(), if no Architecture is given we will accept every arch
    we would accept in general with checkArchitecture() */
 debListParser::debListParser(FileFd *File) :
-   pkgCacheListParser(), d(NULL), Tags(File)
+   pkgCacheListParser(), d(new debListParserPrivate()), Tags(File, pkgTagFile::MMAP)
 {
 }
 									/*}}}*/
@@ -58,6 +82,9 @@ debListParser::debListParser(FileFd *File) :
 // ---------------------------------------------------------------------
 /* This is to return the name of the package this section describes */
 string debListParser::Package() {
+   if (d->Prepared == true)
+      return d->Sections[d->Current - 1].Package;
+
    string Result = Section.Find("Package").to_string();
 
    // Normalize mixed case package names to lower case, like dpkg does
@@ -268,6 +295,9 @@ std::vector<std::string> debListParser::AvailableDescriptionLanguages()
  */
 MD5SumValue debListParser::Description_md5()
 {
+   if (d->Prepared == true)
+      return d->Sections[d->Current - 1].Description_md5;
+
    StringView const value = Section.Find("Description-md5");
    if (value.empty() == true)
    {
@@ -330,6 +360,9 @@ bool debListParser::UsePackage(pkgCache::PkgIterator &Pkg,
 /* */
 unsigned short debListParser::VersionHash()
 {
+   if (d->Prepared == true)
+      return d->Sections[d->Current - 1].VersionHash;
+
    static const StringView Sections[] ={"Installed-Size",
                             "Depends",
                             "Pre-Depends",
@@ -970,10 +1003,65 @@ bool debListParser::GrabWord(StringView Word, WordList const *List, unsigned cha
 /* This has to be careful to only process the correct architecture */
 bool debListParser::Step()
 {
+   if (d->Prepared == true)
+   {
+      if (d->Current == d->Sections.size())
+	 return false;
+      auto const &S = d->Sections[d->Current++];
+      iOffset = S.Offset;
+      Section.Restore(d->Data.data() + S.Data, d->Index.data() + S.Index);
+      return true;
+   }
    iOffset = Tags.Offset();
    return Tags.Step(Section);
 }
 									/*}}}*/
+// ListParser::Prepare - Read and tokenize all sections in advance	/*{{{*/
+// ---------------------------------------------------------------------
+/* The sections are copied out of the (rotating) pkgTagFile buffer together
+   with their index, so that Step can later restore them without scanning
+   again. If anything generates a message we give up and leave it to a
+   normal run to show the messages in order. */
+bool debListParser::Prepare()
+{
+   if (d->Prepared == true)
+      return true;
+
+   _error->PushToStack();
+   while (true)
+   {
+      debListParserPrivate::PreparedSection S;
+      S.Offset = Tags.Offset();
+      if (Tags.Step(Section) == false)
+	 break;
+
+      const char *Start, *Stop;
+      Section.GetSection(Start, Stop);
+      S.Data = d->Data.size();
+      d->Data.append(Start, Stop - Start).append("\n");
+      S.Index = d->Index.size();
+      Section.Save(d->Index);
+
+      S.Package = Package();
+      S.VersionHash = VersionHash();
+      S.Description_md5 = Description_md5();
+      d->Sections.push_back(std::move(S));
+   }
+
+   if (_error->empty(GlobalError::DEBUG) == false)
+   {
+      _error->RevertToStack();
+      d->Sections.clear();
+      d->Data.clear();
+      d->Index.clear();
+      return false;
+   }
+   _error->MergeWithStack();
+   d->Current = 0;
+   d->Prepared = true;
+   return true;
+}
+									/*}}}*/
 // ListParser::GetPrio - Convert the priority from a string		/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -1022,4 +1110,7 @@ bool debDebFileParser::UsePackage(pkgCache::PkgIterator &Pkg,
    return res;
 }
 
-debListParser::~debListParser() {}
+debListParser::~debListParser()
+{
+   delete d;
+}
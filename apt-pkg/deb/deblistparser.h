@@ -28,6 +28,7 @@
 #endif
 
 class FileFd;
+class debListParserPrivate;
 
 class APT_HIDDEN debListParser : public pkgCacheListParser
 {
@@ -43,8 +44,7 @@ class APT_HIDDEN debListParser : public pkgCacheListParser
 #endif
 
    private:
-   /** \brief dpointer placeholder (for later in case we need it) */
-   void * const d;
+   debListParserPrivate * const d;
 
    protected:
    pkgTagFile Tags;
@@ -85,6 +85,7 @@ class APT_HIDDEN debListParser : public pkgCacheListParser
    virtual map_filesize_t Size() APT_OVERRIDE {return Section.size();};
 
    virtual bool Step() APT_OVERRIDE;
+   virtual bool Prepare() APT_OVERRIDE;
 
    bool LoadReleaseInfo(pkgCache::RlsFileIterator &FileI,FileFd &File,
 			std::string const &section);
@@ -220,8 +220,13 @@ bool debVersioningSystem::CheckDep(const char *PkgVer,
       return Op == pkgCache::Dep::Equals || Op == pkgCache::Dep::LessEq || Op == pkgCache::Dep::GreaterEq;
 
    // Perform the actual comparison.
-   int const Res = CmpVersion(PkgVer, DepVer);
-   switch (Op)
+   return CheckCompareOp(CmpVersion(PkgVer, DepVer), Op);
+}
+									/*}}}*/
+// debVS::CheckCompareOp - Check a comparison result against an operator/*{{{*/
+bool debVersioningSystem::CheckCompareOp(int const Res, int Op)
+{
+   switch (Op & 0x0F)
    {
       case pkgCache::Dep::LessEq:
       if (Res <= 0)
@@ -257,6 +262,111 @@ bool debVersioningSystem::CheckDep(const char *PkgVer,
    return false;
 }
 									/*}}}*/
+// debVS::SortKey - Build a key which sorts like the version		/*{{{*/
+// ---------------------------------------------------------------------
+/* Each fragment is encoded the way CmpFragment walks it: the characters
+   of a non-digit portion are mapped to bytes in the order() sequence and
+   followed by a terminator which sorts like the digits do there, a number
+   is stored as the count of its digits (without leading zeros) followed by
+   the digits. The end of a fragment sorts before all characters except ~.
+   The keys of epoch, upstream version and revision are concatenated after
+   splitting them like DoCmpVersion does. */
+static size_t const SortKeyLength = 32;
+static unsigned char const SortKeyTilde = 0x01;
+static unsigned char const SortKeyFragmentEnd = 0x02;
+static unsigned char const SortKeyPortionEnd = 0x03;
+static unsigned char const * SortKeyChars()
+{
+   static unsigned char Chars[256];
+   static bool const Initialised = [] {
+      // ~ sorts before everything, then letters before all other characters
+      unsigned char Next = SortKeyPortionEnd + 1;
+      Chars[static_cast<unsigned char>('~')] = SortKeyTilde;
+      for (int c = '!'; c <= '}'; ++c)
+	 if (isalpha(c) != 0)
+	    Chars[c] = Next++;
+      for (int c = '!'; c <= '}'; ++c)
+	 if (isalpha(c) == 0 && isdigit(c) == 0)
+	    Chars[c] = Next++;
+      return true;
+   }();
+   (void)Initialised;
+   return Chars;
+}
+static bool SortKeyFragment(std::string &Key, const char *A, const char *AEnd)
+{
+   unsigned char const * const Chars = SortKeyChars();
+   while (A != AEnd)
+   {
+      for (; A != AEnd && isdigit(*A) == 0; ++A)
+      {
+	 unsigned char const c = Chars[static_cast<unsigned char>(*A)];
+	 if (c == 0)
+	    return false;
+	 Key.push_back(c);
+      }
+      Key.push_back(SortKeyPortionEnd);
+
+      for (; A != AEnd && *A == '0'; ++A);
+      const char * const Number = A;
+      for (; A != AEnd && isdigit(*A) != 0; ++A);
+      if (A - Number > 250)
+	 return false;
+      Key.push_back(A - Number + 1);
+      Key.append(Number, A);
+   }
+   Key.push_back(SortKeyFragmentEnd);
+   return true;
+}
+static bool SortKeyVersion(std::string &Key, const char *A, const char *AEnd)
+{
+   if (A == AEnd)
+      return false;
+
+   const char *lhs = (const char*) memchr(A, ':', AEnd - A);
+   if (lhs == NULL)
+      lhs = A;
+   if (lhs != A)
+   {
+      for (; *A == '0'; ++A);
+      if (A == lhs)
+      {
+	 ++A;
+	 ++lhs;
+      }
+   }
+   if (SortKeyFragment(Key, A, lhs) == false)
+      return false;
+   if (lhs != A)
+      lhs++;
+
+   const char *dlhs = (const char*) memrchr(lhs, '-', AEnd - lhs);
+   if (dlhs == NULL)
+      dlhs = AEnd;
+   else if (dlhs == lhs)
+      return false; // DoCmpVersion looks in front of the string in this case
+   if (SortKeyFragment(Key, lhs, dlhs) == false)
+      return false;
+
+   // no debian revision need to be treated like -0
+   if (dlhs != AEnd)
+      return SortKeyFragment(Key, dlhs + 1, AEnd);
+   const char* null = "0";
+   return SortKeyFragment(Key, null, null + 1);
+}
+bool debVersioningSystem::SortKey(const char *A, const char *AEnd, std::string &Key)
+{
+   Key.clear();
+   if (SortKeyVersion(Key, A, AEnd) == false)
+   {
+      Key.clear();
+      return false;
+   }
+   if (Key.length() > SortKeyLength)
+      Key.erase(SortKeyLength);
+   return true;
+}
+									/*}}}*/
 // debVS::UpstreamVersion - Return the upstream version string		/*{{{*/
 // ---------------------------------------------------------------------
 /* This strips all the debian specific information from the version number */
@@ -33,6 +33,19 @@ class debVersioningSystem : public pkgVersioningSystem
    }
    virtual std::string UpstreamVersion(const char *A) APT_OVERRIDE;
 
+   /** \brief builds a key which sorts like the version
+    *
+    * Comparing the keys of two versions with strcmp gives the sign
+    * CmpVersion returns for them, unless the keys are equal: Keys are
+    * cut after a few bytes, so equal keys still need a full comparison.
+    * The key contains no \0 bytes.
+    *
+    * \return \b false if no key can be built for this version
+    */
+   static bool SortKey(const char *A, const char *AEnd, std::string &Key);
+   /** \brief checks the result of a comparison against a dependency operator */
+   APT_HIDDEN static bool CheckCompareOp(int const Res, int Op) APT_CONST;
+
    debVersioningSystem();
 };
 
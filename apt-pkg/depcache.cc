@@ -24,6 +24,7 @@
 #include <apt-pkg/cacheiterators.h>
 #include <apt-pkg/prettyprinters.h>
 #include <apt-pkg/cachefile.h>
+#include <apt-pkg/depindex.h>
 #include <apt-pkg/macros.h>
 
 #include <stdio.h>
@@ -35,8 +36,12 @@
 #include <algorithm>
 #include <iostream>
 #include <set>
+#include <system_error>
+#include <thread>
+#include <typeinfo>
 
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <apti18n.h>
 									/*}}}*/
@@ -63,6 +68,82 @@ ConfigValueInSubTree(const char* SubTree, const char *needle)
    return false;
 }
 									/*}}}*/
+class APT_HIDDEN pkgDepCachePrivate					/*{{{*/
+{
+public:
+   /* parents of the dependencies whose state changed in one Update, each
+      listed once: a package or version is listed if its stamp is current */
+   std::vector<map_pointer_t> DirtyPkgs;
+   std::vector<map_pointer_t> DirtyVers;
+   std::vector<unsigned int> PkgStamps;
+   std::vector<unsigned int> VerStamps;
+   unsigned int Stamp;
+
+   // reported with Debug::pkgDepCache::Update
+   bool DebugUpdate;
+   unsigned long long UpdatedDeps;
+   unsigned long long UpdatedParents;
+
+   // packages reached by MarkRequired and the versions still to follow
+   std::vector<bool> Marked;
+   std::vector<map_pointer_t> MarkTodo;
+   bool DebugAutoRemove;
+
+   /* DefaultRootSetFunc matches each package name against the regular
+      expressions in APT::NeverAutoRemove, so its answers are kept for as
+      long as these expressions stay the same */
+   std::string RootSetPatterns;
+   std::vector<bool> RootSetKnown;
+   std::vector<bool> RootSet;
+
+   void Init(pkgCache const &Cache)
+   {
+      PkgStamps.assign(Cache.HeaderP->PackageCount, 0);
+      VerStamps.assign(Cache.HeaderP->VersionCount, 0);
+      Stamp = 0;
+      Marked.assign(Cache.HeaderP->PackageCount, false);
+      RootSetKnown.assign(Cache.HeaderP->PackageCount, false);
+      RootSet.assign(Cache.HeaderP->PackageCount, false);
+   }
+   void PrepareRootSet()
+   {
+      std::string Patterns;
+      for (auto const &P : _config->FindVector("APT::NeverAutoRemove"))
+	 Patterns.append(P).append(1, '\n');
+      if (Patterns == RootSetPatterns)
+	 return;
+      RootSetPatterns.swap(Patterns);
+      std::fill(RootSetKnown.begin(), RootSetKnown.end(), false);
+   }
+   void Begin()
+   {
+      DirtyPkgs.clear();
+      DirtyVers.clear();
+      if (++Stamp != 0)
+	 return;
+      std::fill(PkgStamps.begin(), PkgStamps.end(), 0);
+      std::fill(VerStamps.begin(), VerStamps.end(), 0);
+      Stamp = 1;
+   }
+   void Dirty(pkgCache::DepIterator const &D)
+   {
+      ++UpdatedDeps;
+      unsigned int &VerStamp = VerStamps[D.ParentVer()->ID];
+      if (VerStamp == Stamp)
+	 return;
+      VerStamp = Stamp;
+      DirtyVers.push_back(D->ParentVer);
+      unsigned int &PkgStamp = PkgStamps[D.ParentPkg()->ID];
+      if (PkgStamp == Stamp)
+	 return;
+      PkgStamp = Stamp;
+      DirtyPkgs.push_back(D.ParentPkg().Index());
+   }
+
+   pkgDepCachePrivate() : Stamp(0), DebugUpdate(_config->FindB("Debug::pkgDepCache::Update", false)),
+      UpdatedDeps(0), UpdatedParents(0), DebugAutoRemove(false) {}
+};
+									/*}}}*/
 pkgDepCache::ActionGroup::ActionGroup(pkgDepCache &cache) :		/*{{{*/
   d(NULL), cache(cache), released(false)
 {
@@ -80,7 +161,17 @@ void pkgDepCache::ActionGroup::release()
 	  --cache.group_level;
 
 	  if(cache.group_level == 0)
+	  {
+	    pkgDepCachePrivate * const d = cache.d;
+	    if (d->DebugUpdate == true && d->UpdatedDeps != 0)
+	    {
+	      std::clog << "Update: " << d->UpdatedDeps << " dependencies changed, "
+		 << d->UpdatedParents << " of their packages updated ("
+		 << (d->UpdatedDeps - d->UpdatedParents) << " saved)" << std::endl;
+	      d->UpdatedDeps = d->UpdatedParents = 0;
+	    }
 	    cache.MarkAndSweep();
+	  }
 	}
 
       released = true;
@@ -98,7 +189,7 @@ pkgDepCache::ActionGroup::~ActionGroup()
 pkgDepCache::pkgDepCache(pkgCache * const pCache,Policy * const Plcy) :
   group_level(0), Cache(pCache), PkgState(0), DepState(0),
    iUsrSize(0), iDownloadSize(0), iInstCount(0), iDelCount(0), iKeepCount(0),
-   iBrokenCount(0), iPolicyBrokenCount(0), iBadCount(0), d(NULL)
+   iBrokenCount(0), iPolicyBrokenCount(0), iBadCount(0), d(new pkgDepCachePrivate())
 {
    DebugMarker = _config->FindB("Debug::pkgDepCache::Marker", false);
    DebugAutoInstall = _config->FindB("Debug::pkgDepCache::AutoInstall", false);
@@ -116,6 +207,7 @@ pkgDepCache::~pkgDepCache()
    delete [] PkgState;
    delete [] DepState;
    delete delLocalPolicy;
+   delete d;
 }
 									/*}}}*/
 // DepCache::Init - Generate the initial extra structures.		/*{{{*/
@@ -133,6 +225,7 @@ bool pkgDepCache::Init(OpProgress * const Prog)
    DepState = new unsigned char[Head().DependsCount];
    memset(PkgState,0,sizeof(*PkgState)*Head().PackageCount);
    memset(DepState,0,sizeof(*DepState)*Head().DependsCount);
+   d->Init(*Cache);
 
    if (Prog != 0)
    {
@@ -406,13 +499,40 @@ bool pkgDepCache::CheckDep(DepIterator const &Dep,int const Type,PkgIterator &Re
    return false;
 }
 									/*}}}*/
-// DepCache::AddSizes - Add the packages sizes to the counters		/*{{{*/
+// DepCacheCounters - changes to the size and state counters		/*{{{*/
 // ---------------------------------------------------------------------
-/* Call with Inverse = true to preform the inverse opration */
-void pkgDepCache::AddSizes(const PkgIterator &Pkg, bool const Inverse)
+/* AddSizes and AddStates compute the change a package causes here first,
+   so that Update can collect them per worker thread and add them up. The
+   unsigned counters wrap around, so the sum doesn't depend on the order. */
+namespace {
+struct DepCacheCounters
+{
+   signed long long UsrSize = 0;
+   unsigned long long DownloadSize = 0;
+   unsigned long InstCount = 0;
+   unsigned long DelCount = 0;
+   unsigned long KeepCount = 0;
+   unsigned long BrokenCount = 0;
+   unsigned long PolicyBrokenCount = 0;
+   unsigned long BadCount = 0;
+
+   DepCacheCounters &operator+=(DepCacheCounters const &O)
+   {
+      UsrSize += O.UsrSize;
+      DownloadSize += O.DownloadSize;
+      InstCount += O.InstCount;
+      DelCount += O.DelCount;
+      KeepCount += O.KeepCount;
+      BrokenCount += O.BrokenCount;
+      PolicyBrokenCount += O.PolicyBrokenCount;
+      BadCount += O.BadCount;
+      return *this;
+   }
+};
+}
+static void CountSizes(DepCacheCounters &C, pkgCache &Cache, pkgCache::PkgIterator const &Pkg,
+		       pkgDepCache::StateCache &P, bool const Inverse)
 {
-   StateCache &P = PkgState[Pkg->ID];
-   
    if (Pkg->VersionList == 0)
       return;
    
@@ -424,28 +544,28 @@ void pkgDepCache::AddSizes(const PkgIterator &Pkg, bool const Inverse)
    if (P.NewInstall() == true)
    {
       if (Inverse == false) {
-	 iUsrSize += P.InstVerIter(*this)->InstalledSize;
-	 iDownloadSize += P.InstVerIter(*this)->Size;
+	 C.UsrSize += P.InstVerIter(Cache)->InstalledSize;
+	 C.DownloadSize += P.InstVerIter(Cache)->Size;
       } else {
-	 iUsrSize -= P.InstVerIter(*this)->InstalledSize;
-	 iDownloadSize -= P.InstVerIter(*this)->Size;
+	 C.UsrSize -= P.InstVerIter(Cache)->InstalledSize;
+	 C.DownloadSize -= P.InstVerIter(Cache)->Size;
       }
       return;
    }
    
    // Upgrading
    if (Pkg->CurrentVer != 0 && 
-       (P.InstallVer != (Version *)Pkg.CurrentVer() || 
-	(P.iFlags & ReInstall) == ReInstall) && P.InstallVer != 0)
+       (P.InstallVer != (pkgCache::Version *)Pkg.CurrentVer() || 
+	(P.iFlags & pkgDepCache::ReInstall) == pkgDepCache::ReInstall) && P.InstallVer != 0)
    {
       if (Inverse == false) {
-	 iUsrSize -= Pkg.CurrentVer()->InstalledSize;
-	 iUsrSize += P.InstVerIter(*this)->InstalledSize;
-	 iDownloadSize += P.InstVerIter(*this)->Size;
+	 C.UsrSize -= Pkg.CurrentVer()->InstalledSize;
+	 C.UsrSize += P.InstVerIter(Cache)->InstalledSize;
+	 C.DownloadSize += P.InstVerIter(Cache)->Size;
       } else {
-	 iUsrSize -= P.InstVerIter(*this)->InstalledSize;
-	 iUsrSize += Pkg.CurrentVer()->InstalledSize;
-	 iDownloadSize -= P.InstVerIter(*this)->Size;
+	 C.UsrSize -= P.InstVerIter(Cache)->InstalledSize;
+	 C.UsrSize += Pkg.CurrentVer()->InstalledSize;
+	 C.DownloadSize -= P.InstVerIter(Cache)->Size;
       }
       return;
    }
@@ -455,9 +575,9 @@ void pkgDepCache::AddSizes(const PkgIterator &Pkg, bool const Inverse)
        P.Delete() == false)
    {
       if (Inverse == false)
-	 iDownloadSize += P.InstVerIter(*this)->Size;
+	 C.DownloadSize += P.InstVerIter(Cache)->Size;
       else
-	 iDownloadSize -= P.InstVerIter(*this)->Size;
+	 C.DownloadSize -= P.InstVerIter(Cache)->Size;
       return;
    }
    
@@ -465,66 +585,88 @@ void pkgDepCache::AddSizes(const PkgIterator &Pkg, bool const Inverse)
    if (Pkg->CurrentVer != 0 && P.InstallVer == 0)
    {
       if (Inverse == false)
-	 iUsrSize -= Pkg.CurrentVer()->InstalledSize;
+	 C.UsrSize -= Pkg.CurrentVer()->InstalledSize;
       else
-	 iUsrSize += Pkg.CurrentVer()->InstalledSize;
+	 C.UsrSize += Pkg.CurrentVer()->InstalledSize;
       return;
    }   
 }
-									/*}}}*/
-// DepCache::AddStates - Add the package to the state counter		/*{{{*/
-// ---------------------------------------------------------------------
-/* This routine is tricky to use, you must make sure that it is never 
-   called twice for the same package. This means the Remove/Add section
-   should be as short as possible and not encompass any code that will 
-   calld Remove/Add itself. Remember, dependencies can be circular so
-   while processing a dep for Pkg it is possible that Add/Remove
-   will be called on Pkg */
-void pkgDepCache::AddStates(const PkgIterator &Pkg, bool const Invert)
+static void CountStates(DepCacheCounters &C, pkgCache::PkgIterator const &Pkg,
+			pkgDepCache::StateCache const &State, bool const Invert)
 {
-   signed char const Add = (Invert == false) ? 1 : -1;
-   StateCache &State = PkgState[Pkg->ID];
+   unsigned long const Add = (Invert == false) ? 1 : -1;
 
    // The Package is broken (either minimal dep or policy dep)
-   if ((State.DepState & DepInstMin) != DepInstMin)
-      iBrokenCount += Add;
-   if ((State.DepState & DepInstPolicy) != DepInstPolicy)
-      iPolicyBrokenCount += Add;
+   if ((State.DepState & pkgDepCache::DepInstMin) != pkgDepCache::DepInstMin)
+      C.BrokenCount += Add;
+   if ((State.DepState & pkgDepCache::DepInstPolicy) != pkgDepCache::DepInstPolicy)
+      C.PolicyBrokenCount += Add;
 
    // Bad state
-   if (Pkg.State() != PkgIterator::NeedsNothing)
-      iBadCount += Add;
+   if (Pkg.State() != pkgCache::PkgIterator::NeedsNothing)
+      C.BadCount += Add;
 
    // Not installed
    if (Pkg->CurrentVer == 0)
    {
-      if (State.Mode == ModeDelete &&
-	  (State.iFlags & Purge) == Purge && Pkg.Purge() == false)
-	 iDelCount += Add;
+      if (State.Mode == pkgDepCache::ModeDelete &&
+	  (State.iFlags & pkgDepCache::Purge) == pkgDepCache::Purge && Pkg.Purge() == false)
+	 C.DelCount += Add;
 
-      if (State.Mode == ModeInstall)
-	 iInstCount += Add;
+      if (State.Mode == pkgDepCache::ModeInstall)
+	 C.InstCount += Add;
       return;
    }
 
    // Installed, no upgrade
    if (State.Status == 0)
    {
-      if (State.Mode == ModeDelete)
-	 iDelCount += Add;
+      if (State.Mode == pkgDepCache::ModeDelete)
+	 C.DelCount += Add;
       else
-	 if ((State.iFlags & ReInstall) == ReInstall)
-	    iInstCount += Add;
+	 if ((State.iFlags & pkgDepCache::ReInstall) == pkgDepCache::ReInstall)
+	    C.InstCount += Add;
       return;
    }
 
    // Alll 3 are possible
-   if (State.Mode == ModeDelete)
-      iDelCount += Add;
-   else if (State.Mode == ModeKeep)
-      iKeepCount += Add;
-   else if (State.Mode == ModeInstall)
-      iInstCount += Add;
+   if (State.Mode == pkgDepCache::ModeDelete)
+      C.DelCount += Add;
+   else if (State.Mode == pkgDepCache::ModeKeep)
+      C.KeepCount += Add;
+   else if (State.Mode == pkgDepCache::ModeInstall)
+      C.InstCount += Add;
+}
+									/*}}}*/
+// DepCache::AddSizes - Add the packages sizes to the counters		/*{{{*/
+// ---------------------------------------------------------------------
+/* Call with Inverse = true to preform the inverse opration */
+void pkgDepCache::AddSizes(const PkgIterator &Pkg, bool const Inverse)
+{
+   DepCacheCounters C;
+   CountSizes(C, *Cache, Pkg, PkgState[Pkg->ID], Inverse);
+   iUsrSize += C.UsrSize;
+   iDownloadSize += C.DownloadSize;
+}
+									/*}}}*/
+// DepCache::AddStates - Add the package to the state counter		/*{{{*/
+// ---------------------------------------------------------------------
+/* This routine is tricky to use, you must make sure that it is never 
+   called twice for the same package. This means the Remove/Add section
+   should be as short as possible and not encompass any code that will 
+   calld Remove/Add itself. Remember, dependencies can be circular so
+   while processing a dep for Pkg it is possible that Add/Remove
+   will be called on Pkg */
+void pkgDepCache::AddStates(const PkgIterator &Pkg, bool const Invert)
+{
+   DepCacheCounters C;
+   CountStates(C, Pkg, PkgState[Pkg->ID], Invert);
+   iInstCount += C.InstCount;
+   iDelCount += C.DelCount;
+   iKeepCount += C.KeepCount;
+   iBrokenCount += C.BrokenCount;
+   iPolicyBrokenCount += C.PolicyBrokenCount;
+   iBadCount += C.BadCount;
 }
 									/*}}}*/
 // DepCache::BuildGroupOrs - Generate the Or group dep data		/*{{{*/
@@ -534,7 +676,7 @@ void pkgDepCache::AddStates(const PkgIterator &Pkg, bool const Invert)
 void pkgDepCache::BuildGroupOrs(VerIterator const &V)
 {
    unsigned char Group = 0;
-   for (DepIterator D = V.DependsList(); D.end() != true; ++D)
+   for (pkgDepIndex::DepIterator D(Cache->DepIndex(), V); D.end() != true; ++D)
    {
       // Build the dependency state.
       unsigned char &State = DepState[D->ID];
@@ -651,26 +793,17 @@ void pkgDepCache::UpdateVerState(PkgIterator const &Pkg)
    dependencies based on the current policy. */
 void pkgDepCache::Update(OpProgress * const Prog)
 {   
-   iUsrSize = 0;
-   iDownloadSize = 0;
-   iInstCount = 0;
-   iDelCount = 0;
-   iKeepCount = 0;
-   iBrokenCount = 0;
-   iPolicyBrokenCount = 0;
-   iBadCount = 0;
-
-   // Perform the depends pass
-   int Done = 0;
-   for (PkgIterator I = PkgBegin(); I.end() != true; ++I, ++Done)
-   {
-      if (Prog != 0 && Done%20 == 0)
-	 Prog->Progress(Done);
-      for (VerIterator V = I.VersionList(); V.end() != true; ++V)
+   /* Computes the states of all dependencies of all versions of the package
+      and the package itself and counts its sizes and states. Only the states
+      of the package and its own dependencies are written, so this can run
+      for different packages in parallel. */
+   pkgDepIndex const * const Index = Cache->DepIndex();
+   auto const UpdatePackage = [this, Index](DepCacheCounters &Counters, PkgIterator const &Pkg) {
+      for (VerIterator V = Pkg.VersionList(); V.end() != true; ++V)
       {
 	 unsigned char Group = 0;
 
-	 for (DepIterator D = V.DependsList(); D.end() != true; ++D)
+	 for (pkgDepIndex::DepIterator D(Index, V); D.end() != true; ++D)
 	 {
 	    // Build the dependency state.
 	    unsigned char &State = DepState[D->ID];
@@ -689,13 +822,87 @@ void pkgDepCache::Update(OpProgress * const Prog)
       }
 
       // Compute the package dependency state and size additions
-      AddSizes(I);
-      UpdateVerState(I);
-      AddStates(I);
+      CountSizes(Counters, *Cache, Pkg, PkgState[Pkg->ID], false);
+      UpdateVerState(Pkg);
+      CountStates(Counters, Pkg, PkgState[Pkg->ID], false);
+   };
+
+   // Perform the depends pass
+   std::vector<PkgIterator> Pkgs;
+   Pkgs.reserve(Head().PackageCount);
+   for (PkgIterator I = PkgBegin(); I.end() != true; ++I)
+      Pkgs.push_back(I);
+
+   DepCacheCounters Counters;
+   size_t Threads = 0;
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+   int const ConfThreads = _config->FindI("APT::DepCache-Threads", 0);
+   if (ConfThreads > 1)
+   {
+      // more threads than cores (or packages) would just wait on each other
+      Threads = std::min<size_t>(ConfThreads, Pkgs.size());
+      unsigned int const Cores = std::thread::hardware_concurrency();
+      if (Cores != 0 && Threads > Cores)
+	 Threads = Cores;
    }
+#endif
+   if (Threads < 2)
+   {
+      for (size_t Done = 0; Done < Pkgs.size(); ++Done)
+      {
+	 if (Prog != 0 && Done%20 == 0)
+	    Prog->Progress(Done);
+	 UpdatePackage(Counters, Pkgs[Done]);
+      }
+   }
+   else
+   {
+      /* Each package only writes the states of its own dependencies and
+	 itself, so the packages can be split up between the threads. The
+	 counters of each are added up at the end; the first part is done
+	 here so that we can still show some progress */
+      std::vector<DepCacheCounters> Parts(Threads);
+      std::vector<std::thread> Workers;
+      size_t const PartSize = (Pkgs.size() + Threads - 1) / Threads;
+      auto const UpdatePart = [&UpdatePackage, &Pkgs, &Parts, PartSize](size_t const T) {
+	 size_t const End = std::min(Pkgs.size(), (T + 1) * PartSize);
+	 for (size_t I = T * PartSize; I < End; ++I)
+	    UpdatePackage(Parts[T], Pkgs[I]);
+      };
+      try
+      {
+	 for (size_t T = 1; T < Threads; ++T)
+	    Workers.emplace_back(UpdatePart, T);
+      }
+      catch (std::system_error const &)
+      {
+	 // the parts without a thread are done here after the first one
+      }
+      for (size_t Done = 0; Done < PartSize; ++Done)
+      {
+	 if (Prog != 0 && Done%20 == 0)
+	    Prog->Progress(std::min(Done * (Workers.size() + 1), Pkgs.size()));
+	 UpdatePackage(Parts[0], Pkgs[Done]);
+      }
+      for (size_t T = Workers.size() + 1; T < Threads; ++T)
+	 UpdatePart(T);
+      for (auto &W : Workers)
+	 W.join();
+      for (auto const &P : Parts)
+	 Counters += P;
+   }
+
+   iUsrSize = Counters.UsrSize;
+   iDownloadSize = Counters.DownloadSize;
+   iInstCount = Counters.InstCount;
+   iDelCount = Counters.DelCount;
+   iKeepCount = Counters.KeepCount;
+   iBrokenCount = Counters.BrokenCount;
+   iPolicyBrokenCount = Counters.PolicyBrokenCount;
+   iBadCount = Counters.BadCount;
 
    if (Prog != 0)
-      Prog->Progress(Done);
+      Prog->Progress(Pkgs.size());
 
    readStateFile(Prog);
 }
@@ -707,20 +914,37 @@ void pkgDepCache::Update(OpProgress * const Prog)
 void pkgDepCache::Update(DepIterator D)
 {
    // Update the reverse deps
+   d->Begin();
    for (;D.end() != true; ++D)
-   {      
-      unsigned char &State = DepState[D->ID];
-      State = DependencyState(D);
-    
-      // Invert for Conflicts
-      if (D.IsNegative() == true)
-	 State = ~State;
+      UpdateDependencyState(D);
+   UpdateDirtyParents();
+}
+void pkgDepCache::UpdateDependencyState(DepIterator const &D)
+{
+   unsigned char &State = DepState[D->ID];
+   State = DependencyState(D);
 
-      RemoveStates(D.ParentPkg());
-      BuildGroupOrs(D.ParentVer());
-      UpdateVerState(D.ParentPkg());
-      AddStates(D.ParentPkg());
+   // Invert for Conflicts
+   if (D.IsNegative() == true)
+      State = ~State;
+
+   d->Dirty(D);
+}
+/* A package usually has several dependencies on a package and the packages
+   providing it, so its states are recalculated only once after the states
+   of all these dependencies are known */
+void pkgDepCache::UpdateDirtyParents()
+{
+   for (auto const V : d->DirtyVers)
+      BuildGroupOrs(VerIterator(*Cache, Cache->VerP + V));
+   for (auto const P : d->DirtyPkgs)
+   {
+      PkgIterator const Pkg(*Cache, Cache->PkgP + P);
+      RemoveStates(Pkg);
+      UpdateVerState(Pkg);
+      AddStates(Pkg);
    }
+   d->UpdatedParents += d->DirtyPkgs.size();
 }
 									/*}}}*/
 // DepCache::Update - Update the related deps of a package		/*{{{*/
@@ -735,19 +959,26 @@ void pkgDepCache::Update(PkgIterator const &Pkg)
    AddStates(Pkg);
    
    // Update the reverse deps
-   Update(Pkg.RevDependsList());
+   d->Begin();
+   pkgDepIndex const * const Index = Cache->DepIndex();
+   for (pkgDepIndex::RevDepIterator D(Index, Pkg); D.end() != true; ++D)
+      UpdateDependencyState(D);
 
    // Update the provides map for the current ver
    if (Pkg->CurrentVer != 0)
       for (PrvIterator P = Pkg.CurrentVer().ProvidesList(); 
 	   P.end() != true; ++P)
-	 Update(P.ParentPkg().RevDependsList());
+	 for (pkgDepIndex::RevDepIterator D(Index, P.ParentPkg()); D.end() != true; ++D)
+	    UpdateDependencyState(D);
 
    // Update the provides map for the candidate ver
    if (PkgState[Pkg->ID].CandidateVer != 0)
       for (PrvIterator P = PkgState[Pkg->ID].CandidateVerIter(*this).ProvidesList();
 	   P.end() != true; ++P)
-	 Update(P.ParentPkg().RevDependsList());
+	 for (pkgDepIndex::RevDepIterator D(Index, P.ParentPkg()); D.end() != true; ++D)
+	    UpdateDependencyState(D);
+
+   UpdateDirtyParents();
 }
 									/*}}}*/
 // DepCache::MarkKeep - Put the package in the keep state		/*{{{*/
@@ -1825,6 +2056,7 @@ bool pkgDepCache::MarkRequired(InRootSetFunc &userFunc)
       return true;
 
    bool const debug_autoremove = _config->FindB("Debug::pkgAutoRemove",false);
+   d->DebugAutoRemove = debug_autoremove;
 
    // init the states
    map_id_t const PackagesCount = Head().PackageCount;
@@ -1833,6 +2065,7 @@ bool pkgDepCache::MarkRequired(InRootSetFunc &userFunc)
       PkgState[i].Marked  = false;
       PkgState[i].Garbage = false;
    }
+   std::fill(d->Marked.begin(), d->Marked.end(), false);
    if (debug_autoremove)
       for(PkgIterator p = PkgBegin(); !p.end(); ++p)
 	 if(PkgState[p->ID].Flags & Flag::Auto)
@@ -1841,13 +2074,28 @@ bool pkgDepCache::MarkRequired(InRootSetFunc &userFunc)
    bool const follow_recommends = MarkFollowsRecommends();
    bool const follow_suggests   = MarkFollowsSuggests();
 
+   // derived classes might decide differently, so only ours is cached
+   bool const cacheRootSet = typeid(userFunc) == typeid(DefaultRootSetFunc);
+   if (cacheRootSet)
+      d->PrepareRootSet();
+   auto const InRootSet = [&](PkgIterator const &p) -> bool {
+      if (cacheRootSet == false)
+	 return userFunc.InRootSet(p);
+      if (d->RootSetKnown[p->ID] == false)
+      {
+	 d->RootSet[p->ID] = userFunc.InRootSet(p);
+	 d->RootSetKnown[p->ID] = true;
+      }
+      return d->RootSet[p->ID];
+   };
+
    // do the mark part, this is the core bit of the algorithm
    for(PkgIterator p = PkgBegin(); !p.end(); ++p)
    {
       if(!(PkgState[p->ID].Flags & Flag::Auto) ||
 	  (p->Flags & Flag::Essential) ||
 	  (p->Flags & Flag::Important) ||
-	  userFunc.InRootSet(p) ||
+	  InRootSet(p) ||
 	  // be nice even then a required package violates the policy (#583517)
 	  // and do the full mark process also for required packages
 	  (p.CurrentVer().end() != true &&
@@ -1869,125 +2117,111 @@ bool pkgDepCache::MarkRequired(InRootSetFunc &userFunc)
    return true;
 }
 									/*}}}*/
-// MarkPackage - mark a single package in Mark-and-Sweep		/*{{{*/
-void pkgDepCache::MarkPackage(const pkgCache::PkgIterator &pkg,
-			      const pkgCache::VerIterator &ver,
+// MarkPackage - mark a package and its dependencies in Mark-and-Sweep	/*{{{*/
+void pkgDepCache::MarkPackage(const pkgCache::PkgIterator &Pkg,
+			      const pkgCache::VerIterator &Ver,
 			      bool const &follow_recommends,
 			      bool const &follow_suggests)
 {
-   pkgDepCache::StateCache &state = PkgState[pkg->ID];
-
-   // if we are marked already we are done
-   if(state.Marked)
+   if (Ver.end() == true || d->Marked[Pkg->ID])
       return;
 
-   VerIterator const currver = pkg.CurrentVer();
-   VerIterator const instver = state.InstVerIter(*this);
-
-#if 0
-   VerIterator const candver = state.CandidateVerIter(*this);
-
-   // If a package was garbage-collected but is now being marked, we
-   // should re-select it 
-   // For cases when a pkg is set to upgrade and this trigger the
-   // removal of a no-longer used dependency.  if the pkg is set to
-   // keep again later it will result in broken deps
-   if(state.Delete() && state.RemoveReason = Unused) 
+   bool const debug_autoremove = d->DebugAutoRemove;
+   std::vector<map_pointer_t> &todo = d->MarkTodo;
+   todo.clear();
+   todo.push_back(Ver.Index());
+   while (todo.empty() == false)
    {
-      if(ver==candver)
-	 mark_install(pkg, false, false, NULL);
-      else if(ver==pkg.CurrentVer())
-	 MarkKeep(pkg, false, false);
-      
-      instver=state.InstVerIter(*this);
-   }
-#endif
+      VerIterator const ver(*Cache, Cache->VerP + todo.back());
+      todo.pop_back();
+      PkgIterator const pkg = ver.ParentPkg();
 
-   // For packages that are not going to be removed, ignore versions
-   // other than the InstVer.  For packages that are going to be
-   // removed, ignore versions other than the current version.
-   if(!(ver == instver && !instver.end()) &&
-      !(ver == currver && instver.end() && !ver.end()))
-      return;
+      // if we are marked already we are done
+      if (d->Marked[pkg->ID])
+	 continue;
 
-   bool const debug_autoremove = _config->FindB("Debug::pkgAutoRemove", false);
+      pkgDepCache::StateCache &state = PkgState[pkg->ID];
+      VerIterator const currver = pkg.CurrentVer();
+      VerIterator const instver = state.InstVerIter(*this);
 
-   if(debug_autoremove)
-     {
-       std::clog << "Marking: " << pkg.FullName();
-       if(!ver.end())
+      // For packages that are not going to be removed, ignore versions
+      // other than the InstVer.  For packages that are going to be
+      // removed, ignore versions other than the current version.
+      if(!(ver == instver && !instver.end()) &&
+	 !(ver == currver && instver.end()))
+	 continue;
+
+      if(debug_autoremove)
+      {
+	 std::clog << "Marking: " << pkg.FullName();
 	 std::clog << " " << ver.VerStr();
-       if(!currver.end())
-	 std::clog << ", Curr=" << currver.VerStr();
-       if(!instver.end())
-	 std::clog << ", Inst=" << instver.VerStr();
-       std::clog << std::endl;
-     }
+	 if(!currver.end())
+	    std::clog << ", Curr=" << currver.VerStr();
+	 if(!instver.end())
+	    std::clog << ", Inst=" << instver.VerStr();
+	 std::clog << std::endl;
+      }
 
-   state.Marked=true;
+      d->Marked[pkg->ID] = true;
+      state.Marked = true;
 
-   if(ver.end() == true)
-      return;
+      for(DepIterator D = ver.DependsList(); !D.end(); ++D)
+      {
+	 if(D->Type != Dep::Depends &&
+	    D->Type != Dep::PreDepends &&
+	    (!follow_recommends ||
+	     D->Type != Dep::Recommends) &&
+	    (!follow_suggests ||
+	     D->Type != Dep::Suggests))
+	    continue;
 
-     for(DepIterator d = ver.DependsList(); !d.end(); ++d)
-     {
-	if(d->Type == Dep::Depends ||
-	   d->Type == Dep::PreDepends ||
-	   (follow_recommends &&
-	    d->Type == Dep::Recommends) ||
-	   (follow_suggests &&
-	    d->Type == Dep::Suggests))
-        {
-	   // Try all versions of this package.
-	   for(VerIterator V = d.TargetPkg().VersionList(); 
-	       !V.end(); ++V)
-	   {
-	      if(d.IsSatisfied(V))
-	      {
-		if(debug_autoremove)
-		  {
-		    std::clog << "Following dep: " << d.ParentPkg().FullName()
-			      << " " << d.ParentVer().VerStr() << " "
-			      << d.DepType() << " " << d.TargetPkg().FullName();
-		    if((d->CompareOp & ~pkgCache::Dep::Or) != pkgCache::Dep::NoOp)
-		      {
-			std::clog << " (" << d.CompType() << " "
-				  << d.TargetVer() << ")";
-		      }
-		    std::clog << std::endl;
-		  }
-		 MarkPackage(V.ParentPkg(), V,
-			     follow_recommends, follow_suggests);
-	      }
-	   }
-	   // Now try virtual packages
-	   for(PrvIterator prv=d.TargetPkg().ProvidesList(); 
-	       !prv.end(); ++prv)
-	   {
-	      if(d.IsSatisfied(prv))
-	      {
-		if(debug_autoremove)
-		  {
-		    std::clog << "Following dep: " << d.ParentPkg().FullName() << " "
-			      << d.ParentVer().VerStr() << " "
-			      << d.DepType() << " " << d.TargetPkg().FullName() << " ";
-		    if((d->CompareOp & ~pkgCache::Dep::Or) != pkgCache::Dep::NoOp)
-		      {
-			std::clog << " (" << d.CompType() << " "
-				  << d.TargetVer() << ")";
-		      }
-		    std::clog << ", provided by "
-			      << prv.OwnerPkg().FullName() << " "
-			      << prv.OwnerVer().VerStr()
-			      << std::endl;
-		  }
-
-		 MarkPackage(prv.OwnerPkg(), prv.OwnerVer(),
-			     follow_recommends, follow_suggests);
-	      }
-	   }
-	}
-     }
+	 // Try all versions of this package.
+	 for(VerIterator V = D.TargetPkg().VersionList(); 
+	     !V.end(); ++V)
+	 {
+	    if(D.IsSatisfied(V) == false)
+	       continue;
+	    if(debug_autoremove)
+	    {
+	       std::clog << "Following dep: " << D.ParentPkg().FullName()
+			 << " " << D.ParentVer().VerStr() << " "
+			 << D.DepType() << " " << D.TargetPkg().FullName();
+	       if((D->CompareOp & ~pkgCache::Dep::Or) != pkgCache::Dep::NoOp)
+	       {
+		  std::clog << " (" << D.CompType() << " "
+			    << D.TargetVer() << ")";
+	       }
+	       std::clog << std::endl;
+	    }
+	    if (d->Marked[V.ParentPkg()->ID] == false)
+	       todo.push_back(V.Index());
+	 }
+	 // Now try virtual packages
+	 for(PrvIterator prv=D.TargetPkg().ProvidesList(); 
+	     !prv.end(); ++prv)
+	 {
+	    if(D.IsSatisfied(prv) == false)
+	       continue;
+	    if(debug_autoremove)
+	    {
+	       std::clog << "Following dep: " << D.ParentPkg().FullName() << " "
+			 << D.ParentVer().VerStr() << " "
+			 << D.DepType() << " " << D.TargetPkg().FullName() << " ";
+	       if((D->CompareOp & ~pkgCache::Dep::Or) != pkgCache::Dep::NoOp)
+	       {
+		  std::clog << " (" << D.CompType() << " "
+			    << D.TargetVer() << ")";
+	       }
+	       std::clog << ", provided by "
+			 << prv.OwnerPkg().FullName() << " "
+			 << prv.OwnerVer().VerStr()
+			 << std::endl;
+	    }
+	    if (d->Marked[prv.OwnerPkg()->ID] == false)
+	       todo.push_back(prv.OwnerVer().Index());
+	 }
+      }
+   }
 }
 									/*}}}*/
 bool pkgDepCache::Sweep()						/*{{{*/
@@ -60,6 +60,7 @@
 
 class OpProgress;
 class pkgVersioningSystem;
+class pkgDepCachePrivate;
 
 class pkgDepCache : protected pkgCache::Namespace
 {
@@ -77,8 +78,8 @@ class pkgDepCache : protected pkgCache::Namespace
    /** \brief Mark a single package and all its unmarked important
     *  dependencies during mark-and-sweep.
     *
-    *  Recursively invokes itself to mark all dependencies of the
-    *  package.
+    *  The dependencies still to be followed are kept in a worklist,
+    *  so long dependency chains don't need deep recursion.
     *
     *  \param pkg The package to mark.
     *
@@ -516,10 +517,12 @@ class pkgDepCache : protected pkgCache::Namespace
 	 bool const rPurge, unsigned long const Depth, bool const FromUser);
 
    private:
-   void * const d;
+   pkgDepCachePrivate * const d;
 
    APT_HIDDEN bool IsModeChangeOk(ModeList const mode, PkgIterator const &Pkg,
 			unsigned long const Depth, bool const FromUser);
+   APT_HIDDEN void UpdateDependencyState(DepIterator const &D);
+   APT_HIDDEN void UpdateDirtyParents();
 };
 
 #endif
@@ -0,0 +1,198 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   Dependency Index - flat adjacency arrays for the cache
+
+   The index is a single array of map_pointer_t: a header identifying the
+   cache it belongs to followed by the rows of the depends (by version ID),
+   reverse depends and provides (both by package ID). Each kind is stored
+   as an array of row starts with one extra element for the end of the
+   last row followed by the entries of all rows.
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <config.h>
+
+#include <apt-pkg/depindex.h>
+#include <apt-pkg/pkgcache.h>
+#include <apt-pkg/cacheiterators.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/mmap.h>
+#include <apt-pkg/error.h>
+
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include <apti18n.h>
+									/*}}}*/
+
+struct pkgDepIndex::Header						/*{{{*/
+{
+   uint32_t Signature;
+   uint32_t Version;
+   /** copy of the header of the cache the index was built for */
+   char CacheHeader[sizeof(pkgCache::Header)];
+   map_id_t DependsCount;
+   map_id_t RevDependsCount;
+   map_id_t ProvidesCount;
+
+   /** \brief number of map_pointer_t the header occupies in the index */
+   static size_t Words() { return (sizeof(Header) + sizeof(map_pointer_t) - 1) / sizeof(map_pointer_t); }
+   /** \brief copies the header of the cache in a comparable way */
+   void SetCache(pkgCache const &Cache)
+   {
+      pkgCache::Header Copy;
+      memcpy(&Copy, Cache.HeaderP, sizeof(Copy));
+      Copy.Dirty = false;
+      memcpy(CacheHeader, &Copy, sizeof(CacheHeader));
+   }
+};
+static uint32_t const DepIndexSignature = 0x44455053;
+static uint32_t const DepIndexVersion = 1;
+									/*}}}*/
+pkgDepIndex::pkgDepIndex(pkgCache &Cache) : Cache(Cache), Begin(NULL), Size(0),		/*{{{*/
+   DependsStart(NULL), Depends(NULL), RevDependsStart(NULL), RevDepends(NULL),
+   ProvidesStart(NULL), Provides(NULL)
+{
+}
+pkgDepIndex::~pkgDepIndex() {}
+									/*}}}*/
+// DepIndex::Setup - point the rows into the data of the index		/*{{{*/
+bool pkgDepIndex::Setup(map_pointer_t const * const Data, size_t const Size)
+{
+   if (Size < Header::Words())
+      return false;
+   Header Head;
+   memcpy(&Head, Data, sizeof(Head));
+   if (Head.Signature != DepIndexSignature || Head.Version != DepIndexVersion)
+      return false;
+
+   Header Current = {};
+   Current.SetCache(Cache);
+   if (memcmp(Head.CacheHeader, Current.CacheHeader, sizeof(Head.CacheHeader)) != 0)
+      return false;
+
+   size_t const VerCount = Cache.HeaderP->VersionCount;
+   size_t const PkgCount = Cache.HeaderP->PackageCount;
+   if (Size != Header::Words() + (VerCount + 1) + Head.DependsCount +
+	 (PkgCount + 1) + Head.RevDependsCount + (PkgCount + 1) + Head.ProvidesCount)
+      return false;
+
+   DependsStart = Data + Header::Words();
+   Depends = DependsStart + VerCount + 1;
+   RevDependsStart = Depends + Head.DependsCount;
+   RevDepends = RevDependsStart + PkgCount + 1;
+   ProvidesStart = RevDepends + Head.RevDependsCount;
+   Provides = ProvidesStart + PkgCount + 1;
+   if (DependsStart[VerCount] != Head.DependsCount ||
+	 RevDependsStart[PkgCount] != Head.RevDependsCount ||
+	 ProvidesStart[PkgCount] != Head.ProvidesCount)
+      return false;
+
+   Begin = Data;
+   this->Size = Size;
+   return true;
+}
+									/*}}}*/
+// DepIndex::Build - collect the lists of the cache into rows		/*{{{*/
+pkgDepIndex * pkgDepIndex::Build(pkgCache &Cache)
+{
+   std::unique_ptr<pkgDepIndex> Index(new pkgDepIndex(Cache));
+   size_t const VerCount = Cache.HeaderP->VersionCount;
+   size_t const PkgCount = Cache.HeaderP->PackageCount;
+
+   // first pass: the length of each row
+   std::vector<map_pointer_t> DepStart(VerCount + 1, 0);
+   std::vector<map_pointer_t> RevStart(PkgCount + 1, 0);
+   std::vector<map_pointer_t> PrvStart(PkgCount + 1, 0);
+   for (pkgCache::PkgIterator Pkg = Cache.PkgBegin(); Pkg.end() == false; ++Pkg)
+   {
+      for (pkgCache::DepIterator D = Pkg.RevDependsList(); D.end() == false; ++D)
+	 ++RevStart[Pkg->ID + 1];
+      for (pkgCache::PrvIterator P = Pkg.ProvidesList(); P.end() == false; ++P)
+	 ++PrvStart[Pkg->ID + 1];
+      for (pkgCache::VerIterator Ver = Pkg.VersionList(); Ver.end() == false; ++Ver)
+	 for (pkgCache::DepIterator D = Ver.DependsList(); D.end() == false; ++D)
+	    ++DepStart[Ver->ID + 1];
+   }
+   std::partial_sum(DepStart.begin(), DepStart.end(), DepStart.begin());
+   std::partial_sum(RevStart.begin(), RevStart.end(), RevStart.begin());
+   std::partial_sum(PrvStart.begin(), PrvStart.end(), PrvStart.begin());
+
+   Header Head = {};
+   Head.Signature = DepIndexSignature;
+   Head.Version = DepIndexVersion;
+   Head.SetCache(Cache);
+   Head.DependsCount = DepStart.back();
+   Head.RevDependsCount = RevStart.back();
+   Head.ProvidesCount = PrvStart.back();
+
+   std::vector<map_pointer_t> &Data = Index->Data;
+   Data.resize(Header::Words() + DepStart.size() + Head.DependsCount +
+	 RevStart.size() + Head.RevDependsCount + PrvStart.size() + Head.ProvidesCount, 0);
+   memcpy(Data.data(), &Head, sizeof(Head));
+   map_pointer_t * const Deps = std::copy(DepStart.begin(), DepStart.end(), Data.data() + Header::Words());
+   map_pointer_t * const Revs = std::copy(RevStart.begin(), RevStart.end(), Deps + Head.DependsCount);
+   map_pointer_t * const Prvs = std::copy(PrvStart.begin(), PrvStart.end(), Revs + Head.RevDependsCount);
+
+   // second pass: fill the rows, reusing the starts as write positions
+   for (pkgCache::PkgIterator Pkg = Cache.PkgBegin(); Pkg.end() == false; ++Pkg)
+   {
+      for (pkgCache::DepIterator D = Pkg.RevDependsList(); D.end() == false; ++D)
+	 Revs[RevStart[Pkg->ID]++] = D.Index();
+      for (pkgCache::PrvIterator P = Pkg.ProvidesList(); P.end() == false; ++P)
+	 Prvs[PrvStart[Pkg->ID]++] = P.Index();
+      for (pkgCache::VerIterator Ver = Pkg.VersionList(); Ver.end() == false; ++Ver)
+	 for (pkgCache::DepIterator D = Ver.DependsList(); D.end() == false; ++D)
+	    Deps[DepStart[Ver->ID]++] = D.Index();
+   }
+
+   if (Index->Setup(Data.data(), Data.size()) == false)
+   {
+      _error->Error("Internal error, built an invalid dependency index");
+      return NULL;
+   }
+   return Index.release();
+}
+									/*}}}*/
+// DepIndex::Open - map the index stored in a file			/*{{{*/
+pkgDepIndex * pkgDepIndex::Open(pkgCache &Cache, std::string const &FileName)
+{
+   if (FileExists(FileName) == false)
+      return NULL;
+   FileFd File(FileName, FileFd::ReadOnly);
+   if (File.IsOpen() == false || File.Failed())
+      return NULL;
+   if (File.Size() == 0 || File.Size() % sizeof(map_pointer_t) != 0)
+      return NULL;
+
+   std::unique_ptr<pkgDepIndex> Index(new pkgDepIndex(Cache));
+   Index->Map.reset(new MMap(File, MMap::Public | MMap::ReadOnly));
+   if (Index->Map->validData() == false)
+      return NULL;
+   if (Index->Setup(static_cast<map_pointer_t const *>(Index->Map->Data()),
+	    Index->Map->Size() / sizeof(map_pointer_t)) == false)
+      return NULL;
+   return Index.release();
+}
+									/*}}}*/
+// DepIndex::Write - store the index for Open				/*{{{*/
+bool pkgDepIndex::Write(std::string const &FileName) const
+{
+   FileFd File(FileName, FileFd::WriteAtomic);
+   if (File.IsOpen() == false || File.Failed())
+      return false;
+   fchmod(File.Fd(), 0644);
+   if (File.Write(Begin, Size * sizeof(map_pointer_t)) == false)
+      return _error->Error(_("IO Error saving source cache"));
+   return File.Close();
+}
+									/*}}}*/
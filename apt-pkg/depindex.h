@@ -0,0 +1,141 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/** \file depindex.h
+   Dependency Index - flat adjacency arrays for the cache
+
+   The dependencies, reverse dependencies and provides of the cache are
+   stored as singly linked lists spread over the whole mmap, so walking
+   them means jumping around in memory for each element. This index stores
+   the same lists as one array per kind sorted by the ID of their owner
+   (compressed sparse rows) so that a list can be read front to back.
+
+   The index is either built in memory from a cache or stored as a sidecar
+   file next to pkgcache.bin which is mapped read-only as-is. It stores
+   only offsets into the cache, so it stays valid for exactly the cache it
+   was built from and is rejected for any other.
+
+   The iterators provided here behave like the usual cache iterators they
+   are derived from and fall back to walking the linked lists if no index
+   is available, so callers can use them unconditionally. */
+									/*}}}*/
+#ifndef PKGLIB_DEPINDEX_H
+#define PKGLIB_DEPINDEX_H
+
+#include <apt-pkg/pkgcache.h>
+#include <apt-pkg/cacheiterators.h>
+#include <apt-pkg/macros.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+
+class MMap;
+
+class pkgDepIndex							/*{{{*/
+{
+   public:
+   template<typename Itr, typename Str, typename Tag> class ListIterator;
+   class DepIterator;
+   class RevDepIterator;
+   class PrvIterator;
+
+   /** \brief builds the index for the given cache in memory */
+   static pkgDepIndex * Build(pkgCache &Cache);
+   /** \brief maps the index stored in FileName for the given cache
+    *
+    *  \return the index or \b NULL if the file doesn't exist or was
+    *  built for a different cache. */
+   static pkgDepIndex * Open(pkgCache &Cache, std::string const &FileName);
+   /** \brief stores the index in FileName so that #Open can use it */
+   bool Write(std::string const &FileName) const;
+
+   virtual ~pkgDepIndex();
+
+   private:
+   struct Header;
+
+   explicit APT_HIDDEN pkgDepIndex(pkgCache &Cache);
+   APT_HIDDEN bool Setup(map_pointer_t const * const Data, size_t const Size);
+
+   pkgCache &Cache;
+   std::vector<map_pointer_t> Data;
+   std::unique_ptr<MMap> Map;
+   map_pointer_t const * Begin;
+   size_t Size;
+
+   // the row of owner ID is [Start[ID], Start[ID + 1]) in the entries
+   map_pointer_t const * DependsStart;
+   map_pointer_t const * Depends;
+   map_pointer_t const * RevDependsStart;
+   map_pointer_t const * RevDepends;
+   map_pointer_t const * ProvidesStart;
+   map_pointer_t const * Provides;
+};
+									/*}}}*/
+// ListIterator - walk a row of the index like a linked list		/*{{{*/
+template<typename Itr, typename Str, typename Tag> class pkgDepIndex::ListIterator : public Itr
+{
+   map_pointer_t const * Next;
+   map_pointer_t const * End;
+
+   void Load(pkgCache &Owner)
+   {
+      Itr const Stop(Owner, static_cast<Str *>(NULL), static_cast<Tag *>(NULL));
+      if (Next == End)
+	 Itr::operator=(Stop);
+      else
+	 Itr::operator=(Itr(Owner, Stop.OwnerPointer() + *Next++, static_cast<Tag *>(NULL)));
+   }
+
+   public:
+   inline ListIterator& operator ++()
+   {
+      if (Next == NULL)
+	 Itr::operator++();
+      else if (this->end() == false)
+	 Load(*this->Cache());
+      return *this;
+   }
+   inline ListIterator operator++(int) { ListIterator const tmp(*this); operator++(); return tmp; }
+
+   protected:
+   ListIterator(Itr const &Linked, map_pointer_t const * const Start,
+	 map_pointer_t const * const Entries, map_id_t const ID) :
+      Itr(Linked), Next(NULL), End(NULL)
+   {
+      if (Start == NULL || Linked.Cache() == NULL)
+	 return;
+      Next = Entries + Start[ID];
+      End = Entries + Start[ID + 1];
+      Load(*Linked.Cache());
+   }
+};
+									/*}}}*/
+/** \brief dependencies of a version in the order of DependsList() */
+class pkgDepIndex::DepIterator : public ListIterator<pkgCache::DepIterator, pkgCache::Dependency, pkgCache::Version>
+{
+   public:
+   DepIterator(pkgDepIndex const * const Index, pkgCache::VerIterator const &Ver) :
+      ListIterator(Ver.DependsList(), Index == NULL ? NULL : Index->DependsStart,
+	    Index == NULL ? NULL : Index->Depends, Ver->ID) {}
+};
+/** \brief dependencies on a package in the order of RevDependsList() */
+class pkgDepIndex::RevDepIterator : public ListIterator<pkgCache::DepIterator, pkgCache::Dependency, pkgCache::Package>
+{
+   public:
+   RevDepIterator(pkgDepIndex const * const Index, pkgCache::PkgIterator const &Pkg) :
+      ListIterator(Pkg.RevDependsList(), Index == NULL ? NULL : Index->RevDependsStart,
+	    Index == NULL ? NULL : Index->RevDepends, Pkg->ID) {}
+};
+/** \brief versions providing a package in the order of ProvidesList() */
+class pkgDepIndex::PrvIterator : public ListIterator<pkgCache::PrvIterator, pkgCache::Provides, pkgCache::Package>
+{
+   public:
+   PrvIterator(pkgDepIndex const * const Index, pkgCache::PkgIterator const &Pkg) :
+      ListIterator(Pkg.ProvidesList(), Index == NULL ? NULL : Index->ProvidesStart,
+	    Index == NULL ? NULL : Index->Provides, Pkg->ID) {}
+};
+
+#endif
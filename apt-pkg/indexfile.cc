@@ -340,20 +340,34 @@ pkgCacheListParser * pkgDebianIndexFile::CreateListParser(FileFd &Pkg)
    else
       return Parser;
 }
+pkgCacheListParser * pkgDebianIndexFile::PrepareListParser(FileFd &Pkg)
+{
+   if (OpenListFile(Pkg, IndexFileName()) == false)
+      return nullptr;
+   std::unique_ptr<pkgCacheListParser> Parser(CreateListParser(Pkg));
+   if (Parser == nullptr || Parser->Prepare() == false)
+      return nullptr;
+   return Parser.release();
+}
 bool pkgDebianIndexFile::Merge(pkgCacheGenerator &Gen,OpProgress * const Prog)
 {
    std::string const PackageFile = IndexFileName();
-   FileFd Pkg;
-   if (OpenListFile(Pkg, PackageFile) == false)
-      return false;
-   _error->PushToStack();
-   std::unique_ptr<pkgCacheListParser> Parser(CreateListParser(Pkg));
-   bool const newError = _error->PendingError();
-   _error->MergeWithStack();
-   if (newError == false && Parser == nullptr)
-      return true;
-   if (Parser == NULL)
-      return false;
+   std::unique_ptr<FileFd> Pkg;
+   std::unique_ptr<pkgCacheListParser> Parser;
+   if (Gen.TakePreparedList(this, Pkg, Parser) == false)
+   {
+      Pkg.reset(new FileFd());
+      if (OpenListFile(*Pkg, PackageFile) == false)
+	 return false;
+      _error->PushToStack();
+      Parser.reset(CreateListParser(*Pkg));
+      bool const newError = _error->PendingError();
+      _error->MergeWithStack();
+      if (newError == false && Parser == nullptr)
+	 return true;
+      if (Parser == NULL)
+	 return false;
+   }
 
    if (Prog != NULL)
       Prog->SubProgress(0, GetProgressDescription());
@@ -364,8 +378,8 @@ bool pkgDebianIndexFile::Merge(pkgCacheGenerator &Gen,OpProgress * const Prog)
    // Store the IMS information
    pkgCache::PkgFileIterator File = Gen.GetCurFile();
    pkgCacheGenerator::Dynamic<pkgCache::PkgFileIterator> DynFile(File);
-   File->Size = Pkg.FileSize();
-   File->mtime = Pkg.ModificationTime();
+   File->Size = Pkg->FileSize();
+   File->mtime = Pkg->ModificationTime();
 
    if (Gen.MergeList(*Parser) == false)
       return _error->Error("Problem with MergeList %s",PackageFile.c_str());
@@ -176,6 +176,14 @@ public:
    virtual bool Merge(pkgCacheGenerator &Gen, OpProgress* const Prog) APT_OVERRIDE;
    virtual pkgCache::PkgFileIterator FindInCache(pkgCache &Cache) const APT_OVERRIDE;
 
+   /** \brief opens the index and parses it ahead of #Merge
+    *
+    * Can be run on a worker thread as the cache isn't touched.
+    * \return the prepared parser reading from Pkg or \b nullptr
+    *  if the index can't (or shouldn't) be prepared.
+    */
+   APT_HIDDEN pkgCacheListParser * PrepareListParser(FileFd &Pkg);
+
    explicit pkgDebianIndexFile(bool const Trusted);
    virtual ~pkgDebianIndexFile();
 };
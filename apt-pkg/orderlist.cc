@@ -70,6 +70,7 @@
 #include <apt-pkg/error.h>
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/cacheiterators.h>
+#include <apt-pkg/depindex.h>
 #include <apt-pkg/pkgcache.h>
 
 #include <stdlib.h>
@@ -320,7 +321,7 @@ int pkgOrderList::Score(PkgIterator Pkg)
    if (IsFlag(Pkg,Immediate) == true)
       Score += ScoreImmediate;
 
-   for (DepIterator D = Cache[Pkg].InstVerIter(Cache).DependsList();
+   for (pkgDepIndex::DepIterator D(Cache.GetCache().DepIndex(), Cache[Pkg].InstVerIter(Cache));
 	D.end() == false; ++D)
       if (D->Type == pkgCache::Dep::PreDepends)
       {
@@ -25,19 +25,24 @@
 #include <apt-pkg/pkgcache.h>
 #include <apt-pkg/policy.h>
 #include <apt-pkg/version.h>
+#include <apt-pkg/debversion.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/aptconfiguration.h>
 #include <apt-pkg/mmap.h>
 #include <apt-pkg/macros.h>
+#include <apt-pkg/depindex.h>
 
 #include <stddef.h>
 #include <string.h>
 #include <sstream>
 #include <algorithm>
+#include <atomic>
 #include <vector>
 #include <string>
+#include <memory>
+#include <mutex>
 #include <sys/stat.h>
 #include <zlib.h>
 
@@ -47,6 +52,67 @@
 using std::string;
 using APT::StringView;
 
+// SortKeys - keys sorting like the versions of the cache		/*{{{*/
+/* The keys (see debVersioningSystem::SortKey) are built the first time a
+   version or the version of a dependency is compared and kept here by
+   ID rather than in the cache, so that the mapped structures stay as
+   they are. As the dependency states are calculated on several threads
+   each entry is claimed by the first thread needing it, the others fall
+   back to comparing the version strings until it is done. */
+class APT_HIDDEN pkgCacheSortKeys
+{
+   enum : unsigned char { UNKNOWN = 0, BUILDING, HAS_KEY, NO_KEY };
+   static constexpr size_t KeySize = 33;
+   std::unique_ptr<std::atomic<unsigned char>[]> States;
+   std::unique_ptr<char[]> Keys;
+   size_t Count;
+
+public:
+   char const * Get(size_t const ID, char const * const VerStr)
+   {
+      if (ID >= Count || VerStr == nullptr)
+	 return nullptr;
+      unsigned char State = UNKNOWN;
+      if (States[ID].compare_exchange_strong(State, BUILDING, std::memory_order_acquire) == false)
+	 return State == HAS_KEY ? Keys.get() + ID * KeySize : nullptr;
+      std::string Key;
+      if (debVersioningSystem::SortKey(VerStr, VerStr + strlen(VerStr), Key) == false || Key.length() >= KeySize)
+      {
+	 States[ID].store(NO_KEY, std::memory_order_release);
+	 return nullptr;
+      }
+      char * const Out = Keys.get() + ID * KeySize;
+      memcpy(Out, Key.c_str(), Key.length() + 1);
+      States[ID].store(HAS_KEY, std::memory_order_release);
+      return Out;
+   }
+
+   explicit pkgCacheSortKeys(size_t const Count) : States(new std::atomic<unsigned char>[Count]()),
+      Keys(new char[Count * KeySize]), Count(Count) {}
+};
+									/*}}}*/
+class APT_HIDDEN pkgCachePrivate
+{
+public:
+   std::unique_ptr<pkgDepIndex> DepIndex;
+
+   std::once_flag SortKeysSetup;
+   std::unique_ptr<pkgCacheSortKeys> VersionKeys;
+   std::unique_ptr<pkgCacheSortKeys> DependsKeys;
+
+   // only the debian versioning system has keys
+   bool SetupSortKeys(pkgCache const &Cache)
+   {
+      std::call_once(SortKeysSetup, [&]() {
+	 if (dynamic_cast<debVersioningSystem const *>(Cache.VS) == nullptr)
+	    return;
+	 VersionKeys.reset(new pkgCacheSortKeys(Cache.HeaderP->VersionCount));
+	 DependsKeys.reset(new pkgCacheSortKeys(Cache.HeaderP->DependsCount));
+      });
+      return VersionKeys != nullptr;
+   }
+};
+
 
 // Cache::Header::Header - Constructor					/*{{{*/
 // ---------------------------------------------------------------------
@@ -127,7 +193,7 @@ bool pkgCache::Header::CheckSizes(Header &Against) const
 // ---------------------------------------------------------------------
 /* */
 APT_IGNORE_DEPRECATED_PUSH
-pkgCache::pkgCache(MMap *Map, bool DoMap) : Map(*Map), VS(nullptr), d(NULL)
+pkgCache::pkgCache(MMap *Map, bool DoMap) : Map(*Map), VS(nullptr), d(new pkgCachePrivate())
 {
    // call getArchitectures() with cached=false to ensure that the 
    // architectures cache is re-evaulated. this is needed in cases
@@ -257,6 +323,20 @@ uint32_t pkgCache::CacheHash()
    return adler;
 }
 									/*}}}*/
+// Cache::DepIndex - Access the flat dependency lists			/*{{{*/
+pkgDepIndex const * pkgCache::DepIndex() const
+{
+   return d->DepIndex.get();
+}
+bool pkgCache::LoadDepIndex(std::string const &FileName)
+{
+   // the index is an optimisation, a missing or stale one isn't an error
+   _error->PushToStack();
+   d->DepIndex.reset(pkgDepIndex::Open(*this, FileName));
+   _error->RevertToStack();
+   return d->DepIndex != nullptr;
+}
+									/*}}}*/
 // Cache::FindPkg - Locate a package by name				/*{{{*/
 // ---------------------------------------------------------------------
 /* Returns 0 on error, pointer to the package otherwise */
@@ -783,6 +863,15 @@ bool pkgCache::DepIterator::IsIgnorable(PrvIterator const &Prv) const
 // DepIterator::IsSatisfied - check if a version satisfied the dependency /*{{{*/
 bool pkgCache::DepIterator::IsSatisfied(VerIterator const &Ver) const
 {
+   // different keys decide the comparison, equal ones need a closer look
+   if (S2->Version != 0 && Owner->d->SetupSortKeys(*Owner) == true)
+   {
+      char const * const VerKey = Owner->d->VersionKeys->Get(Ver->ID, Ver.VerStr());
+      char const * const DepKey = VerKey == nullptr ? nullptr : Owner->d->DependsKeys->Get(S->ID, TargetVer());
+      int const Res = DepKey == nullptr ? 0 : strcmp(VerKey, DepKey);
+      if (Res != 0)
+	 return debVersioningSystem::CheckCompareOp(Res, S2->CompareOp);
+   }
    return Owner->VS->CheckDep(Ver.VerStr(),S2->CompareOp,TargetVer());
 }
 bool pkgCache::DepIterator::IsSatisfied(PrvIterator const &Prv) const
@@ -853,6 +942,20 @@ int pkgCache::VerIterator::CompareVer(const VerIterator &B) const
    return -1;
 }
 									/*}}}*/
+// VerIterator::CompareVerStr - Compare the version strings		/*{{{*/
+int pkgCache::VerIterator::CompareVerStr(const VerIterator &B) const
+{
+   if (Owner->d->SetupSortKeys(*Owner) == true)
+   {
+      char const * const KeyA = Owner->d->VersionKeys->Get(S->ID, VerStr());
+      char const * const KeyB = KeyA == nullptr ? nullptr : Owner->d->VersionKeys->Get(B->ID, B.VerStr());
+      int const Res = KeyB == nullptr ? 0 : strcmp(KeyA, KeyB);
+      if (Res != 0)
+	 return Res;
+   }
+   return Owner->VS->CmpVersion(VerStr(), B.VerStr());
+}
+									/*}}}*/
 // VerIterator::Downloadable - Checks if the version is downloadable	/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -1072,4 +1175,4 @@ pkgCache::DescIterator pkgCache::VerIterator::TranslatedDescription() const
 
 									/*}}}*/
 
-pkgCache::~pkgCache() {}
+pkgCache::~pkgCache() { delete d; }
@@ -106,6 +106,8 @@ typedef uint8_t map_flags_t;
 typedef uint8_t map_number_t;
 
 class pkgVersioningSystem;
+class pkgDepIndex;
+class pkgCachePrivate;
 class pkgCache								/*{{{*/
 {
    public:
@@ -272,6 +274,11 @@ class pkgCache								/*{{{*/
    inline bool MultiArchCache() const { return MultiArchEnabled; }
    inline char const * NativeArch();
 
+   /** \brief the dependency index of this cache or \b NULL if none is loaded */
+   pkgDepIndex const * DepIndex() const;
+   /** \brief use the dependency index stored in FileName if it belongs to this cache */
+   APT_HIDDEN bool LoadDepIndex(std::string const &FileName);
+
    // Make me a function
    pkgVersioningSystem *VS;
    
@@ -284,7 +291,7 @@ class pkgCache								/*{{{*/
    virtual ~pkgCache();
 
 private:
-   void * const d;
+   pkgCachePrivate * const d;
    bool MultiArchEnabled;
 };
 									/*}}}*/
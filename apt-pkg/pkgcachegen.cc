@@ -28,6 +28,8 @@
 #include <apt-pkg/mmap.h>
 #include <apt-pkg/pkgcache.h>
 #include <apt-pkg/cacheiterators.h>
+#include <apt-pkg/aptconfiguration.h>
+#include <apt-pkg/depindex.h>
 
 #include <stddef.h>
 #include <string.h>
@@ -36,6 +38,10 @@
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <future>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -51,12 +57,51 @@ static bool IsDuplicateDescription(pkgCache::DescIterator Desc,
 using std::string;
 using APT::StringView;
 
+class APT_HIDDEN pkgCacheGeneratorPrivate				/*{{{*/
+{
+public:
+   // an index file read and tokenized (or being so) on a worker thread
+   struct PreparedList
+   {
+      pkgDebianIndexFile * const Index;
+      std::unique_ptr<FileFd> Fd;
+      std::unique_ptr<pkgCacheListParser> Parser;
+      std::future<bool> Ready;
+
+      explicit PreparedList(pkgDebianIndexFile * const Index) : Index(Index), Fd(new FileFd()) {}
+   };
+
+   unsigned int Threads;
+   std::vector<pkgDebianIndexFile *> Files;
+   std::vector<pkgDebianIndexFile *>::const_iterator NextFile;
+   std::deque<std::unique_ptr<PreparedList>> Running;
+
+   /* keep at most Threads files in preparation or prepared but not yet
+      merged, so that memory usage doesn't depend on the amount of files */
+   void StartJobs()
+   {
+      for (; Running.size() < Threads && NextFile != Files.end(); ++NextFile)
+      {
+	 PreparedList * const Job = new PreparedList(*NextFile);
+	 Running.emplace_back(Job);
+	 Job->Ready = std::async(std::launch::async, [Job]() {
+	    Job->Parser.reset(Job->Index->PrepareListParser(*Job->Fd));
+	    bool const Okay = Job->Parser != nullptr && _error->empty(GlobalError::DEBUG);
+	    _error->Discard();
+	    return Okay;
+	 });
+      }
+   }
+
+   pkgCacheGeneratorPrivate() : Threads(0), NextFile(Files.end()) {}
+};
+									/*}}}*/
 // CacheGenerator::pkgCacheGenerator - Constructor			/*{{{*/
 // ---------------------------------------------------------------------
 /* We set the dirty flag and make sure that is written to the disk */
 pkgCacheGenerator::pkgCacheGenerator(DynamicMMap *pMap,OpProgress *Prog) :
 		    Map(*pMap), Cache(pMap,false), Progress(Prog),
-		     CurrentRlsFile(NULL), CurrentFile(NULL), d(NULL)
+		     CurrentRlsFile(NULL), CurrentFile(NULL), d(new pkgCacheGeneratorPrivate())
 {
 }
 bool pkgCacheGenerator::Start()
@@ -134,6 +179,7 @@ bool pkgCacheGenerator::Start()
    advoid a problem during a crash */
 pkgCacheGenerator::~pkgCacheGenerator()
 {
+   delete d;
    if (_error->PendingError() == true || Map.validData() == false)
       return;
    if (Map.Sync() == false)
@@ -530,6 +576,372 @@ bool pkgCacheGenerator::AddNewDescription(ListParser &List, pkgCache::VerIterato
 }
 									/*}}}*/
 									/*}}}*/
+// CacheGenerator::PrepareIndexFiles - Parse indexes on worker threads	/*{{{*/
+void pkgCacheGenerator::PrepareIndexFiles(std::vector<pkgIndexFile *> const &Files)
+{
+   d->Running.clear();
+   d->Files.clear();
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+   d->Threads = _config->FindI("APT::Cache-Threads", 0);
+   if (d->Threads != 0)
+   {
+      // fill the caches here as the worker threads can't do it safely
+      APT::Configuration::getCompressors();
+      APT::Configuration::getLanguages();
+      APT::Configuration::getArchitectures();
+
+      for (auto const &I : Files)
+      {
+	 auto const Index = dynamic_cast<pkgDebianIndexFile *>(I);
+	 if (Index != nullptr && Index->HasPackages() == true && Index->Exists() == true)
+	    d->Files.push_back(Index);
+      }
+   }
+#endif
+   d->NextFile = d->Files.begin();
+   d->StartJobs();
+}
+									/*}}}*/
+// CacheGenerator::TakePreparedList - Hand over a prepared parser	/*{{{*/
+// ---------------------------------------------------------------------
+/* Index files are merged in the order they were prepared in. Jobs for
+   files skipped by the caller (e.g. as duplicates) are dropped on the way */
+bool pkgCacheGenerator::TakePreparedList(pkgIndexFile const * const Index,
+      std::unique_ptr<FileFd> &Fd, std::unique_ptr<ListParser> &Parser)
+{
+   auto Job = std::find_if(d->Running.begin(), d->Running.end(),
+	 [&](std::unique_ptr<pkgCacheGeneratorPrivate::PreparedList> const &P) { return P->Index == Index; });
+   if (Job == d->Running.end())
+   {
+      auto const File = std::find(d->NextFile, d->Files.cend(), Index);
+      if (File == d->Files.cend())
+	 return false;
+      d->Running.clear();
+      d->NextFile = File;
+      d->StartJobs();
+      Job = d->Running.begin();
+   }
+
+   std::unique_ptr<pkgCacheGeneratorPrivate::PreparedList> const Prepared = std::move(*Job);
+   d->Running.erase(d->Running.begin(), Job + 1);
+   d->StartJobs();
+
+   if (Prepared->Ready.get() == false)
+   {
+      if (_config->FindB("Debug::pkgCacheGen", false))
+	 std::clog << "Preparing " << Index->Describe() << " failed, merge it unprepared" << std::endl;
+      return false;
+   }
+   Fd = std::move(Prepared->Fd);
+   Parser = std::move(Prepared->Parser);
+   return true;
+}
+									/*}}}*/
+// CacheGenerator::DropStaleReleaseFiles - Unlink outdated releases	/*{{{*/
+// ---------------------------------------------------------------------
+/* A release is reused if it and all of its index files are still valid.
+   Everything else is unlinked: versions lose their files from dropped
+   releases and are unlinked if none remain, together with dependencies,
+   provides and descriptions only reachable from them. The space isn't
+   reclaimed, so if too much garbage accumulated we fail to force a rebuild */
+bool pkgCacheGenerator::DropStaleReleaseFiles(pkgSourceList const &List,
+      std::set<metaIndex const *> &Reused)
+{
+   bool const Debug = _config->FindB("Debug::pkgCacheGen", false);
+   std::vector<bool> KeepRls(Cache.HeaderP->ReleaseFileCount, false);
+   std::vector<bool> KeepFile(Cache.HeaderP->PackageFileCount, false);
+   std::vector<map_pointer_t> ReusedOrder;
+   bool SeenStale = false;
+   for (pkgSourceList::const_iterator i = List.begin(); i != List.end(); ++i)
+   {
+      pkgCache::RlsFileIterator const RlsFile = (*i)->FindInCache(Cache, true);
+      if (RlsFile.end() == true)
+      {
+	 SeenStale = true;
+	 continue;
+      }
+      else if (KeepRls[RlsFile->ID] == true)
+	 continue;
+
+      std::vector<map_id_t> Files;
+      bool Valid = true;
+      std::vector <pkgIndexFile *> const * const Indexes = (*i)->GetIndexFiles();
+      for (std::vector<pkgIndexFile *>::const_iterator I = Indexes->begin(); I != Indexes->end(); ++I)
+      {
+	 if ((*I)->HasPackages() == false || (*I)->Exists() == false)
+	    continue;
+	 pkgCache::PkgFileIterator const File = (*I)->FindInCache(Cache);
+	 if (File.end() == true || File->Release != RlsFile.Index())
+	 {
+	    Valid = false;
+	    break;
+	 }
+	 Files.push_back(File->ID);
+      }
+      // index files which are gone from disk are still in the cache
+      size_t InCache = 0;
+      for (pkgCache::PkgFileIterator File = Cache.FileBegin(); File.end() == false; ++File)
+	 if (File->Release == RlsFile.Index())
+	    ++InCache;
+      if (Valid == false || InCache != Files.size())
+      {
+	 SeenStale = true;
+	 continue;
+      }
+      /* The changed releases are merged after the reused ones, so they
+	 have to come last in the sources.list for the files, versions and
+	 so on to end up in the order a rebuild would give them */
+      if (SeenStale == true)
+      {
+	 if (Debug == true)
+	    std::clog << "RlsFile " << (*i)->Describe() << " follows a changed one" << std::endl;
+	 return false;
+      }
+
+      if (Debug == true)
+	 std::clog << "Reuse RlsFile " << (*i)->Describe() << " with ID " << RlsFile->ID << std::endl;
+      Reused.insert(*i);
+      ReusedOrder.push_back(RlsFile.Index());
+      KeepRls[RlsFile->ID] = true;
+      for (auto const ID : Files)
+	 KeepFile[ID] = true;
+   }
+   if (Reused.empty() == true)
+      return false;
+
+   // the reused releases must also have been merged in this order
+   std::vector<map_pointer_t> CacheOrder;
+   for (pkgCache::RlsFileIterator RlsFile = Cache.RlsFileBegin(); RlsFile.end() == false; ++RlsFile)
+      if (KeepRls[RlsFile->ID] == true)
+	 CacheOrder.push_back(RlsFile.Index());
+   if (std::equal(CacheOrder.rbegin(), CacheOrder.rend(), ReusedOrder.begin()) == false)
+   {
+      if (Debug == true)
+	 std::clog << "Reused releases were merged in a different order" << std::endl;
+      return false;
+   }
+
+   auto const Kept = [&](map_pointer_t const File) { return KeepFile[Cache.PkgFileP[File].ID]; };
+
+   // drop the files of the stale releases from the versions
+   std::vector<bool> DropVer(Cache.HeaderP->VersionCount, false);
+   std::map<std::pair<map_pointer_t, map_filesize_t>, map_pointer_t> Records;
+   map_id_t LiveVersions = 0;
+   for (pkgCache::PkgIterator Pkg = Cache.PkgBegin(); Pkg.end() == false; ++Pkg)
+   {
+      bool PkgTouched = false;
+      for (pkgCache::VerIterator Ver = Pkg.VersionList(); Ver.end() == false; ++Ver)
+      {
+	 std::vector<pkgCache::VerFile const *> Dropped;
+	 for (map_pointer_t *VF = &Ver->FileList; *VF != 0;)
+	 {
+	    pkgCache::VerFile * const F = Cache.VerFileP + *VF;
+	    if (Kept(F->File) == true)
+	    {
+	       VF = &F->NextFile;
+	       continue;
+	    }
+	    Dropped.push_back(F);
+	    *VF = F->NextFile;
+	 }
+	 if (Dropped.empty() == false)
+	    PkgTouched = true;
+	 if (Ver->FileList == 0)
+	 {
+	    DropVer[Ver->ID] = true;
+	    continue;
+	 }
+	 ++LiveVersions;
+	 for (auto const F : Dropped)
+	    Records[std::make_pair(F->File, F->Offset)] = Ver.Index();
+      }
+      if (PkgTouched == false)
+	 continue;
+      /* The flags are set by the stanzas of all files, so we can't tell
+	 if the remaining ones would still set them */
+      if ((Pkg->Flags & (pkgCache::Flag::Essential | pkgCache::Flag::Important)) != 0)
+      {
+	 for (pkgCache::VerIterator Ver = Pkg.VersionList(); Ver.end() == false; ++Ver)
+	    if (DropVer[Ver->ID] == false)
+	    {
+	       if (Debug == true)
+		  std::clog << "Flags of " << Pkg.FullName() << " depend on reused files" << std::endl;
+	       return false;
+	    }
+	 Pkg->Flags &= ~(pkgCache::Flag::Essential | pkgCache::Flag::Important);
+      }
+   }
+   if (Debug == true)
+      std::clog << LiveVersions << " of " << Cache.HeaderP->VersionCount << " versions are still alive" << std::endl;
+   if (Cache.HeaderP->VersionCount - LiveVersions > LiveVersions)
+      return false;
+
+   /* Unlink descriptions which have no file left. Descriptions are only
+      added by the file creating a version, so if that file was dropped
+      the description of a remaining version is read from another file */
+   std::vector<bool> CheckedDesc(Cache.HeaderP->DescriptionCount, false);
+   std::vector<bool> DropDesc(Cache.HeaderP->DescriptionCount, false);
+   for (pkgCache::PkgIterator Pkg = Cache.PkgBegin(); Pkg.end() == false; ++Pkg)
+      for (pkgCache::VerIterator Ver = Pkg.VersionList(); Ver.end() == false; ++Ver)
+      {
+	 if (DropVer[Ver->ID] == true)
+	    continue;
+	 for (map_pointer_t *D = &Ver->DescriptionList; *D != 0;)
+	 {
+	    pkgCache::Description * const Desc = Cache.DescP + *D;
+	    if (CheckedDesc[Desc->ID] == false)
+	    {
+	       CheckedDesc[Desc->ID] = true;
+	       pkgCache::DescFile * Record = nullptr;
+	       map_pointer_t Owner = 0;
+	       for (map_pointer_t *DF = &Desc->FileList; *DF != 0;)
+	       {
+		  pkgCache::DescFile * const F = Cache.DescFileP + *DF;
+		  if (Kept(F->File) == true)
+		  {
+		     DF = &F->NextFile;
+		     continue;
+		  }
+		  auto const R = Records.find(std::make_pair(F->File, F->Offset));
+		  if (Owner == 0 && R != Records.end())
+		  {
+		     Record = F;
+		     Owner = R->second;
+		  }
+		  *DF = F->NextFile;
+	       }
+	       if (Desc->FileList == 0 && Owner != 0)
+	       {
+		  pkgCache::VerFile const * const VF = Cache.VerFileP + Cache.VerP[Owner].FileList;
+		  Record->File = VF->File;
+		  Record->Offset = VF->Offset;
+		  Record->Size = VF->Size;
+		  Record->NextFile = 0;
+		  Desc->FileList = Record - Cache.DescFileP;
+	       }
+	       DropDesc[Desc->ID] = Desc->FileList == 0;
+	    }
+	    if (DropDesc[Desc->ID] == true)
+	       *D = Desc->NextDesc;
+	    else
+	       D = &Desc->NextDesc;
+	 }
+      }
+
+   /* Unlink the dropped versions and everything pointing to them. Packages
+      without any version left lose the implicit dependencies on them as
+      they are added again if a version reappears */
+   std::vector<bool> DropDep(Cache.HeaderP->DependsCount, false);
+   bool DroppedImplicit = false;
+   std::vector<map_pointer_t> Orphans;
+   for (pkgCache::PkgIterator Pkg = Cache.PkgBegin(); Pkg.end() == false; ++Pkg)
+   {
+      bool const HadVersions = Pkg->VersionList != 0;
+      bool const HadAnything = HadVersions || Pkg->RevDepends != 0 || Pkg->ProvidesList != 0;
+      for (map_pointer_t *V = &Pkg->VersionList; *V != 0;)
+      {
+	 pkgCache::Version * const Ver = Cache.VerP + *V;
+	 if (DropVer[Ver->ID] == true)
+	    *V = Ver->NextVer;
+	 else
+	    V = &Ver->NextVer;
+      }
+      for (map_pointer_t *D = &Pkg->RevDepends; *D != 0;)
+      {
+	 pkgCache::Dependency * const Dep = Cache.DepP + *D;
+	 if (DropVer[Cache.VerP[Dep->ParentVer].ID] == true)
+	    *D = Dep->NextRevDepends;
+	 else
+	    D = &Dep->NextRevDepends;
+      }
+      for (map_pointer_t *P = &Pkg->ProvidesList; *P != 0;)
+      {
+	 pkgCache::Provides * const Prv = Cache.ProvideP + *P;
+	 if (DropVer[Cache.VerP[Prv->Version].ID] == true)
+	    *P = Prv->NextProvides;
+	 else
+	    P = &Prv->NextProvides;
+      }
+      if (HadVersions == true && Pkg->VersionList == 0)
+	 for (map_pointer_t *D = &Pkg->RevDepends; *D != 0;)
+	 {
+	    pkgCache::Dependency * const Dep = Cache.DepP + *D;
+	    if ((Cache.DepDataP[Dep->DependencyData].CompareOp & pkgCache::Dep::MultiArchImplicit) == 0)
+	    {
+	       D = &Dep->NextRevDepends;
+	       continue;
+	    }
+	    DropDep[Dep->ID] = true;
+	    DroppedImplicit = true;
+	    *D = Dep->NextRevDepends;
+	 }
+      if (HadAnything == true)
+	 Orphans.push_back(Pkg.Index());
+   }
+   if (DroppedImplicit == true)
+      for (pkgCache::PkgIterator Pkg = Cache.PkgBegin(); Pkg.end() == false; ++Pkg)
+	 for (pkgCache::VerIterator Ver = Pkg.VersionList(); Ver.end() == false; ++Ver)
+	    for (map_pointer_t *D = &Ver->DependsList; *D != 0;)
+	    {
+	       pkgCache::Dependency * const Dep = Cache.DepP + *D;
+	       if (DropDep[Dep->ID] == true)
+		  *D = Dep->NextDepends;
+	       else
+		  D = &Dep->NextDepends;
+	    }
+
+   // packages nothing refers to anymore are removed from the hashtables
+   for (auto const P : Orphans)
+   {
+      pkgCache::Package * const Pkg = Cache.PkgP + P;
+      if (Pkg->VersionList != 0 || Pkg->RevDepends != 0 || Pkg->ProvidesList != 0)
+	 continue;
+      pkgCache::Group * const Grp = Cache.GrpP + Pkg->Group;
+      map_id_t const Hash = Cache.Hash(Cache.ViewString(Grp->Name));
+      map_pointer_t Prev = 0;
+      map_pointer_t *Link = &Cache.HeaderP->PkgHashTableP()[Hash];
+      if (Grp->FirstPackage != P)
+      {
+	 Prev = Grp->FirstPackage;
+	 Link = &Cache.PkgP[Prev].NextPackage;
+      }
+      while (*Link != P)
+      {
+	 Prev = *Link;
+	 Link = &Cache.PkgP[Prev].NextPackage;
+      }
+      *Link = Pkg->NextPackage;
+      if (Grp->FirstPackage == P)
+	 Grp->FirstPackage = (Grp->LastPackage == P) ? 0 : Pkg->NextPackage;
+      if (Grp->LastPackage == P)
+	 Grp->LastPackage = (Grp->FirstPackage == 0) ? 0 : Prev;
+      if (Grp->FirstPackage != 0)
+	 continue;
+      map_pointer_t *G = &Cache.HeaderP->GrpHashTableP()[Hash];
+      while (*G != Pkg->Group)
+	 G = &Cache.GrpP[*G].Next;
+      *G = Grp->Next;
+   }
+
+   for (map_pointer_t *F = &Cache.HeaderP->FileList; *F != 0;)
+   {
+      pkgCache::PackageFile * const File = Cache.PkgFileP + *F;
+      if (KeepFile[File->ID] == true)
+	 F = &File->NextFile;
+      else
+	 *F = File->NextFile;
+   }
+   for (map_pointer_t *F = &Cache.HeaderP->RlsFileList; *F != 0;)
+   {
+      pkgCache::ReleaseFile * const File = Cache.RlsFileP + *F;
+      if (KeepRls[File->ID] == true)
+	 F = &File->NextFile;
+      else
+	 *F = File->NextFile;
+   }
+   return true;
+}
+									/*}}}*/
 // CacheGenerator::NewGroup - Add a new group				/*{{{*/
 // ---------------------------------------------------------------------
 /* This creates a new group structure and adds it to the hash table */
@@ -1411,11 +1823,11 @@ static bool CheckValidity(const string &CacheFile,
       std::copy_if(Indexes->begin(), Indexes->end(), std::back_inserter(Files),
 	    [](pkgIndexFile const * const I) { return I->HasPackages(); });
    }
-   for (unsigned I = 0; I != Cache.HeaderP->ReleaseFileCount; ++I)
-      if (RlsVisited[I] == false)
+   for (pkgCache::RlsFileIterator RlsFile = Cache.RlsFileBegin(); RlsFile.end() == false; ++RlsFile)
+      if (RlsVisited[RlsFile->ID] == false)
       {
 	 if (Debug == true)
-	    std::clog << "RlsFile with ID" << I << " wasn't visited" << std::endl;
+	    std::clog << "RlsFile with ID" << RlsFile->ID << " wasn't visited" << std::endl;
 	 return false;
       }
 
@@ -1450,11 +1862,11 @@ static bool CheckValidity(const string &CacheFile,
 	 std::clog << "with ID " << File->ID << " is valid" << std::endl;
    }
 
-   for (unsigned I = 0; I != Cache.HeaderP->PackageFileCount; I++)
-      if (Visited[I] == false)
+   for (pkgCache::PkgFileIterator File = Cache.FileBegin(); File.end() == false; ++File)
+      if (Visited[File->ID] == false)
       {
 	 if (Debug == true)
-	    std::clog << "PkgFile with ID" << I << " wasn't visited" << std::endl;
+	    std::clog << "PkgFile with ID" << File->ID << " wasn't visited" << std::endl;
 	 return false;
       }
 
@@ -1479,13 +1891,16 @@ static bool CheckValidity(const string &CacheFile,
 // ---------------------------------------------------------------------
 /* Size is kind of an abstract notion that is only used for the progress
    meter */
-static map_filesize_t ComputeSize(pkgSourceList const * const List, FileIterator Start,FileIterator End)
+static map_filesize_t ComputeSize(pkgSourceList const * const List, FileIterator Start,FileIterator End,
+      std::set<metaIndex const *> const &Reused = {})
 {
    map_filesize_t TotalSize = 0;
    if (List !=  NULL)
    {
       for (pkgSourceList::const_iterator i = List->begin(); i != List->end(); ++i)
       {
+	 if (Reused.find(*i) != Reused.end())
+	    continue;
 	 std::vector <pkgIndexFile *> *Indexes = (*i)->GetIndexFiles();
 	 for (std::vector<pkgIndexFile *>::const_iterator j = Indexes->begin(); j != Indexes->end(); ++j)
 	    if ((*j)->HasPackages() == true)
@@ -1507,10 +1922,24 @@ static bool BuildCache(pkgCacheGenerator &Gen,
 		       OpProgress * const Progress,
 		       map_filesize_t &CurrentSize,map_filesize_t TotalSize,
 		       pkgSourceList const * const List,
-		       FileIterator const Start, FileIterator const End)
+		       FileIterator const Start, FileIterator const End,
+		       std::set<metaIndex const *> const &Reused = {})
 {
    bool mergeFailure = false;
 
+   std::vector<pkgIndexFile *> Files;
+   if (List != NULL)
+      for (pkgSourceList::const_iterator i = List->begin(); i != List->end(); ++i)
+      {
+	 if (Reused.find(*i) != Reused.end())
+	    continue;
+	 std::vector <pkgIndexFile *> const * const Indexes = (*i)->GetIndexFiles();
+	 if (Indexes != NULL)
+	    std::copy(Indexes->begin(), Indexes->end(), std::back_inserter(Files));
+      }
+   std::copy(Start, End, std::back_inserter(Files));
+   Gen.PrepareIndexFiles(Files);
+
    auto const indexFileMerge = [&](pkgIndexFile * const I) {
       if (I->HasPackages() == false || mergeFailure)
 	 return;
@@ -1540,6 +1969,9 @@ static bool BuildCache(pkgCacheGenerator &Gen,
       {
 	 if ((*i)->FindInCache(Gen.GetCache(), false).end() == false)
 	 {
+	    // kept from the previous cache, so not a duplicate
+	    if (Reused.find(*i) != Reused.end())
+	       continue;
 	    _error->Warning("Duplicate sources.list entry %s",
 		  (*i)->Describe().c_str());
 	    continue;
@@ -1609,6 +2041,22 @@ static bool writeBackMMapToFile(pkgCacheGenerator * const Gen, DynamicMMap * con
    Gen->GetCache().HeaderP->Dirty = true;
    return true;
 }
+static void writeBackDepIndex(pkgCache &Cache, std::string const &CacheFile)
+{
+   std::string const FileName = CacheFile + ".deps";
+   if (_config->FindB("APT::Cache-DepIndex", false) == false)
+   {
+      // a stale index is ignored anyway, but don't leave it lying around
+      if (FileExists(FileName) == true)
+	 RemoveFile("writeBackDepIndex", FileName);
+      return;
+   }
+   // the index is an optimisation only, failing to store it isn't fatal
+   ScopedErrorRevert ser;
+   std::unique_ptr<pkgDepIndex> Index(pkgDepIndex::Build(Cache));
+   if (Index == nullptr || Index->Write(FileName) == false)
+      RemoveFile("writeBackDepIndex", FileName);
+}
 static bool loadBackMMapFromFile(std::unique_ptr<pkgCacheGenerator> &Gen,
       std::unique_ptr<DynamicMMap> &Map, OpProgress * const Progress, std::string const &FileName)
 {
@@ -1629,6 +2077,35 @@ static bool loadBackMMapFromFile(std::unique_ptr<pkgCacheGenerator> &Gen,
    Gen.reset(new pkgCacheGenerator(Map.get(),Progress));
    return Gen->Start();
 }
+static bool loadBackIncremental(std::unique_ptr<pkgCacheGenerator> &Gen,
+      std::unique_ptr<DynamicMMap> &Map, OpProgress * const Progress, std::string const &FileName,
+      pkgSourceList const &List, std::set<metaIndex const *> &Reused)
+{
+   if (_config->FindB("APT::Cache-Incremental", false) == false ||
+	 FileName.empty() == true || FileExists(FileName) == false)
+      return false;
+
+   ScopedErrorRevert ser;
+   {
+      // ensure the old cache is intact and was built with the current settings
+      FileFd CacheF(FileName, FileFd::ReadOnly);
+      MMap CacheMap(CacheF, 0);
+      if (unlikely(CacheMap.validData()) == false)
+	 return false;
+      pkgCache Cache(&CacheMap);
+      if (_error->PendingError() == true)
+	 return false;
+   }
+
+   if (loadBackMMapFromFile(Gen, Map, Progress, FileName) == true &&
+	 Gen->DropStaleReleaseFiles(List, Reused) == true)
+      return true;
+
+   Reused.clear();
+   Gen.reset();
+   Map.reset(CreateDynamicMMap(NULL, 0));
+   return false;
+}
 bool pkgMakeStatusCache(pkgSourceList &List,OpProgress &Progress,
 			MMap **OutMap, bool AllowMem)
    { return pkgCacheGenerator::MakeStatusCache(List, &Progress, OutMap, AllowMem); }
@@ -1730,15 +2207,26 @@ bool pkgCacheGenerator::MakeStatusCache(pkgSourceList &List,OpProgress *Progress
    }
    else if (srcpkgcache_fine == false)
    {
-      if (Debug == true)
-	 std::clog << "srcpkgcache.bin is NOT valid - rebuild" << std::endl;
-      Gen.reset(new pkgCacheGenerator(Map.get(),Progress));
-      if (Gen->Start() == false)
-	 return false;
+      std::set<metaIndex const *> Reused;
+      if (loadBackIncremental(Gen, Map, Progress, SrcCacheFile, List, Reused) == true)
+      {
+	 if (Debug == true)
+	    std::clog << "srcpkgcache.bin is NOT valid - merge the changed releases into it" << std::endl;
+      }
+      else
+      {
+	 if (Debug == true)
+	    std::clog << "srcpkgcache.bin is NOT valid - rebuild" << std::endl;
+	 if (unlikely(Map->validData()) == false)
+	    return false;
+	 Gen.reset(new pkgCacheGenerator(Map.get(),Progress));
+	 if (Gen->Start() == false)
+	    return false;
+      }
 
-      TotalSize += ComputeSize(&List, Files.begin(),Files.end());
+      TotalSize += ComputeSize(&List, Files.begin(),Files.end(), Reused);
       if (BuildCache(*Gen, Progress, CurrentSize, TotalSize, &List,
-	       Files.end(),Files.end()) == false)
+	       Files.end(),Files.end(), Reused) == false)
 	 return false;
 
       if (Writeable == true && SrcCacheFile.empty() == false)
@@ -1755,8 +2243,11 @@ bool pkgCacheGenerator::MakeStatusCache(pkgSourceList &List,OpProgress *Progress
 	 return false;
 
       if (Writeable == true && CacheFile.empty() == false)
+      {
 	 if (writeBackMMapToFile(Gen.get(), Map.get(), CacheFile) == false)
 	    return false;
+	 writeBackDepIndex(Gen->GetCache(), CacheFile);
+      }
    }
 
    if (Debug == true)
@@ -26,7 +26,9 @@
 
 #include <vector>
 #include <string>
+#include <set>
 #if __cplusplus >= 201103L
+#include <memory>
 #include <unordered_set>
 #endif
 #ifdef APT_PKG_EXPOSE_STRING_VIEW
@@ -37,7 +39,9 @@ class FileFd;
 class pkgSourceList;
 class OpProgress;
 class pkgIndexFile;
+class metaIndex;
 class pkgCacheListParser;
+class pkgCacheGeneratorPrivate;
 
 class APT_HIDDEN pkgCacheGenerator					/*{{{*/
 {
@@ -140,6 +144,26 @@ class APT_HIDDEN pkgCacheGenerator					/*{{{*/
    bool SelectFile(const std::string &File,pkgIndexFile const &Index, std::string const &Architecture, std::string const &Component, unsigned long Flags = 0);
    bool SelectReleaseFile(const std::string &File, const std::string &Site, unsigned long Flags = 0);
    bool MergeList(ListParser &List,pkgCache::VerIterator *Ver = 0);
+   /** \brief unlinks the data of outdated releases from a loaded cache
+    *
+    * Releases which are unchanged on disk are kept and returned in Reused,
+    * everything coming from other releases is unlinked (but not freed), so
+    * that only the changed releases need to be merged again.
+    */
+   bool DropStaleReleaseFiles(pkgSourceList const &List, std::set<metaIndex const *> &Reused);
+#if __cplusplus >= 201103L
+   /** \brief starts parsing the given index files on worker threads
+    *
+    * With APT::Cache-Threads set the indexes are read and tokenized in the
+    * background while earlier ones are merged. Merging still happens in
+    * order on the calling thread, so the resulting cache is the same as
+    * the one built without threads.
+    */
+   void PrepareIndexFiles(std::vector<pkgIndexFile *> const &Files);
+   /** \brief hands over the parser prepared for this index (if any) */
+   bool TakePreparedList(pkgIndexFile const * const Index,
+	 std::unique_ptr<FileFd> &Fd, std::unique_ptr<ListParser> &Parser);
+#endif
    inline pkgCache &GetCache() {return Cache;};
    inline pkgCache::PkgFileIterator GetCurFile()
          {return pkgCache::PkgFileIterator(Cache,CurrentFile);};
@@ -159,7 +183,7 @@ class APT_HIDDEN pkgCacheGenerator					/*{{{*/
    virtual ~pkgCacheGenerator();
 
    private:
-   void * const d;
+   pkgCacheGeneratorPrivate * const d;
    APT_HIDDEN bool MergeListGroup(ListParser &List, std::string const &GrpName);
    APT_HIDDEN bool MergeListPackage(ListParser &List, pkgCache::PkgIterator &Pkg);
 #ifdef APT_PKG_EXPOSE_STRING_VIEW
@@ -235,6 +259,16 @@ class APT_HIDDEN pkgCacheListParser
    virtual bool CollectFileProvides(pkgCache &/*Cache*/,
 				    pkgCache::VerIterator &/*Ver*/) {return true;};
 
+   /** \brief reads and tokenizes all sections ahead of merging them
+    *
+    * Called on a worker thread before the parser is handed to
+    * pkgCacheGenerator::MergeList, so it must not touch the cache.
+    *
+    * \return \b true if the parser serves the prepared sections now,
+    *  \b false if it doesn't support this or failed to do so.
+    */
+   virtual bool Prepare() {return false;};
+
    pkgCacheListParser();
    virtual ~pkgCacheListParser();
 };
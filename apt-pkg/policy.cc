@@ -26,10 +26,13 @@
 #include <apt-pkg/pkgcache.h>
 #include <apt-pkg/versionmatch.h>
 #include <apt-pkg/version.h>
+#include <apt-pkg/mmap.h>
 
 #include <ctype.h>
 #include <stddef.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <memory>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -40,12 +43,110 @@
 
 using namespace std;
 
+// PolicyTable - Stored candidates and priorities			/*{{{*/
+/* The candidates and priorities calculated with the pins are stored in a
+   table: a header identifying the cache followed by the key describing
+   the preferences, the candidate version of each package by package ID
+   (0 for none) and the priority of each version by version ID. */
+class APT_HIDDEN pkgPolicyPrivate
+{
+public:
+   struct Header
+   {
+      uint32_t Signature;
+      uint32_t Version;
+      /** copy of the header of the cache the table was built for */
+      char CacheHeader[sizeof(pkgCache::Header)];
+      uint32_t KeySize;
+   };
+
+   std::vector<char> Data;
+   std::unique_ptr<MMap> Map;
+   map_pointer_t const * Candidates;
+   signed short const * Priorities;
+
+   static size_t Align(size_t const Size) { return (Size + sizeof(map_pointer_t) - 1) & ~(sizeof(map_pointer_t) - 1); }
+   bool Setup(pkgCache &Cache, char const * const Begin, size_t const Size, std::string const &Key);
+   void Reset()
+   {
+      Candidates = nullptr;
+      Priorities = nullptr;
+      Map.reset();
+      Data.clear();
+   }
+
+   pkgPolicyPrivate() : Candidates(nullptr), Priorities(nullptr) {}
+};
+static uint32_t const PolicyTableSignature = 0x504F4C54;
+static uint32_t const PolicyTableVersion = 1;
+
+static void SetCacheHeader(pkgPolicyPrivate::Header &Head, pkgCache const &Cache)
+{
+   pkgCache::Header Copy;
+   memcpy(&Copy, Cache.HeaderP, sizeof(Copy));
+   Copy.Dirty = false;
+   memcpy(Head.CacheHeader, &Copy, sizeof(Head.CacheHeader));
+}
+/* The cache header includes its hash, so everything else the result
+   depends on is the default release and the preferences files. Those are
+   identified by their modification time and size. */
+static std::string PolicyTableKey()
+{
+   std::ostringstream Key;
+   Key << "Default-Release: " << _config->Find("APT::Default-Release") << '\n';
+
+   std::vector<std::string> Files;
+   Files.push_back(_config->FindFile("Dir::Etc::Preferences"));
+   std::string const Dir = _config->FindDir("Dir::Etc::PreferencesParts");
+   if (DirectoryExists(Dir) == true)
+   {
+      _error->PushToStack();
+      std::vector<std::string> const Parts = GetListOfFilesInDir(Dir, "pref", true, true);
+      _error->RevertToStack();
+      Files.insert(Files.end(), Parts.begin(), Parts.end());
+   }
+   for (auto const &File : Files)
+   {
+      struct stat Buf;
+      if (File.empty() == true || stat(File.c_str(), &Buf) != 0)
+	 continue;
+      Key << File << ' ' << Buf.st_mtim.tv_sec << '.' << Buf.st_mtim.tv_nsec << ' ' << Buf.st_size << '\n';
+   }
+   return Key.str();
+}
+bool pkgPolicyPrivate::Setup(pkgCache &Cache, char const * const Begin, size_t const Size, std::string const &Key)
+{
+   if (Size < sizeof(Header))
+      return false;
+   Header Head;
+   memcpy(&Head, Begin, sizeof(Head));
+   if (Head.Signature != PolicyTableSignature || Head.Version != PolicyTableVersion)
+      return false;
+
+   Header Current = {};
+   SetCacheHeader(Current, Cache);
+   if (memcmp(Head.CacheHeader, Current.CacheHeader, sizeof(Head.CacheHeader)) != 0)
+      return false;
+
+   size_t const KeyStart = Align(sizeof(Header));
+   size_t const CandStart = Align(KeyStart + Head.KeySize);
+   size_t const PrioStart = CandStart + Cache.HeaderP->PackageCount * sizeof(map_pointer_t);
+   if (Size != PrioStart + Cache.HeaderP->VersionCount * sizeof(signed short))
+      return false;
+   if (Key.length() != Head.KeySize || Key.compare(0, std::string::npos, Begin + KeyStart, Head.KeySize) != 0)
+      return false;
+
+   Candidates = reinterpret_cast<map_pointer_t const *>(Begin + CandStart);
+   Priorities = reinterpret_cast<signed short const *>(Begin + PrioStart);
+   return true;
+}
+									/*}}}*/
 // Policy::Init - Startup and bind to a cache				/*{{{*/
 // ---------------------------------------------------------------------
 /* Set the defaults for operation. The default mode with no loaded policy
    file matches the V0 policy engine. */
 pkgPolicy::pkgPolicy(pkgCache *Owner) : Pins(nullptr), VerPins(nullptr),
-   PFPriority(nullptr), Cache(Owner), d(NULL)
+   PFPriority(nullptr), Cache(Owner), d(new pkgPolicyPrivate())
 {
    if (Owner == 0)
       return;
@@ -86,6 +187,8 @@ pkgPolicy::pkgPolicy(pkgCache *Owner) : Pins(nullptr), VerPins(nullptr),
 /* */
 bool pkgPolicy::InitDefaults()
 {   
+   d->Reset();
+
    // Initialize the priorities based on the status of the package file
    for (pkgCache::PkgFileIterator I = Cache->FileBegin(); I != Cache->FileEnd(); ++I)
    {
@@ -132,10 +235,17 @@ bool pkgPolicy::InitDefaults()
    best package is. */
 pkgCache::VerIterator pkgPolicy::GetCandidateVer(pkgCache::PkgIterator const &Pkg)
 {
+   if (d->Candidates != nullptr)
+   {
+      map_pointer_t const Ver = d->Candidates[Pkg->ID];
+      if (Ver == 0)
+	 return pkgCache::VerIterator();
+      return pkgCache::VerIterator(*Cache, Cache->VerP + Ver);
+   }
+
    pkgCache::VerIterator cand;
    pkgCache::VerIterator cur = Pkg.CurrentVer();
    int candPriority = -1;
-   pkgVersioningSystem *vs = Cache->VS;
 
    for (pkgCache::VerIterator ver = Pkg.VersionList(); ver.end() == false; ++ver) {
       int priority = GetPriority(ver, true);
@@ -145,7 +255,7 @@ pkgCache::VerIterator pkgPolicy::GetCandidateVer(pkgCache::PkgIterator const &Pk
 
       // TODO: Maybe optimize to not compare versions
       if (!cur.end() && priority < 1000
-	  && (vs->CmpVersion(ver.VerStr(), cur.VerStr()) < 0))
+	  && (ver.CompareVerStr(cur) < 0))
 	 continue;
 
       candPriority = priority;
@@ -164,6 +274,7 @@ pkgCache::VerIterator pkgPolicy::GetCandidateVer(pkgCache::PkgIterator const &Pk
 void pkgPolicy::CreatePin(pkgVersionMatch::MatchType Type,string Name,
 			  string Data,signed short Priority)
 {
+   d->Reset();
    if (Name.empty() == true)
    {
       Pin *P = &*Defaults.insert(Defaults.end(),Pin());
@@ -271,6 +382,8 @@ APT_PURE signed short pkgPolicy::GetPriority(pkgCache::PkgIterator const &Pkg)
 }
 APT_PURE signed short pkgPolicy::GetPriority(pkgCache::VerIterator const &Ver, bool ConsiderFiles)
 {
+   if (ConsiderFiles == true && d->Priorities != nullptr)
+      return d->Priorities[Ver->ID];
    if (VerPins[Ver->ID].Type != pkgVersionMatch::None)
       return VerPins[Ver->ID].Priority;
    if (!ConsiderFiles)
@@ -298,6 +411,75 @@ APT_PURE signed short pkgPolicy::GetPriority(pkgCache::PkgFileIterator const &Fi
    return PFPriority[File->ID];
 }
 									/*}}}*/
+// Policy::LoadTable - Use the stored candidates and priorities		/*{{{*/
+bool pkgPolicy::LoadTable(std::string const &FileName)
+{
+   d->Reset();
+   if (FileExists(FileName) == false)
+      return false;
+
+   // the table is an optimisation, a missing or stale one isn't an error
+   _error->PushToStack();
+   FileFd File(FileName, FileFd::ReadOnly);
+   if (File.IsOpen() == true && File.Failed() == false && File.Size() != 0)
+   {
+      d->Map.reset(new MMap(File, MMap::Public | MMap::ReadOnly));
+      if (d->Map->validData() == false ||
+	    d->Setup(*Cache, static_cast<char const *>(d->Map->Data()), d->Map->Size(), PolicyTableKey()) == false)
+	 d->Reset();
+   }
+   _error->RevertToStack();
+
+   if (d->Candidates != nullptr && _config->FindB("Debug::pkgPolicy",false) == true)
+      std::clog << "Using the candidates and priorities from " << FileName << std::endl;
+   return d->Candidates != nullptr;
+}
+									/*}}}*/
+// Policy::StoreTable - Calculate and store the candidates and priorities/*{{{*/
+bool pkgPolicy::StoreTable(std::string const &FileName)
+{
+   d->Reset();
+   std::string const Key = PolicyTableKey();
+
+   pkgPolicyPrivate::Header Head = {};
+   Head.Signature = PolicyTableSignature;
+   Head.Version = PolicyTableVersion;
+   SetCacheHeader(Head, *Cache);
+   Head.KeySize = Key.length();
+
+   size_t const KeyStart = pkgPolicyPrivate::Align(sizeof(Head));
+   size_t const CandStart = pkgPolicyPrivate::Align(KeyStart + Key.length());
+   size_t const PrioStart = CandStart + Cache->HeaderP->PackageCount * sizeof(map_pointer_t);
+   std::vector<char> Data(PrioStart + Cache->HeaderP->VersionCount * sizeof(signed short), 0);
+   memcpy(Data.data(), &Head, sizeof(Head));
+   memcpy(Data.data() + KeyStart, Key.data(), Key.length());
+
+   map_pointer_t * const Candidates = reinterpret_cast<map_pointer_t *>(Data.data() + CandStart);
+   signed short * const Priorities = reinterpret_cast<signed short *>(Data.data() + PrioStart);
+   for (pkgCache::PkgIterator Pkg = Cache->PkgBegin(); Pkg.end() == false; ++Pkg)
+   {
+      pkgCache::VerIterator const Cand = GetCandidateVer(Pkg);
+      Candidates[Pkg->ID] = Cand.end() ? 0 : Cand.Index();
+      for (pkgCache::VerIterator Ver = Pkg.VersionList(); Ver.end() == false; ++Ver)
+	 Priorities[Ver->ID] = GetPriority(Ver, true);
+   }
+
+   d->Data.swap(Data);
+   if (d->Setup(*Cache, d->Data.data(), d->Data.size(), Key) == false)
+   {
+      d->Reset();
+      return _error->Error("Internal error, built an invalid policy table");
+   }
+
+   FileFd File(FileName, FileFd::WriteAtomic);
+   if (File.IsOpen() == false || File.Failed())
+      return false;
+   fchmod(File.Fd(), 0644);
+   if (File.Write(d->Data.data(), d->Data.size()) == false)
+      return false;
+   return File.Close();
+}
+									/*}}}*/
 // ReadPinDir - Load the pin files from this dir into a Policy		/*{{{*/
 // ---------------------------------------------------------------------
 /* This will load each pin file in the given dir into a Policy. If the
@@ -416,4 +598,4 @@ bool ReadPinFile(pkgPolicy &Plcy,string File)
 }
 									/*}}}*/
 
-pkgPolicy::~pkgPolicy() {delete [] PFPriority; delete [] Pins; delete [] VerPins; }
+pkgPolicy::~pkgPolicy() {delete [] PFPriority; delete [] Pins; delete [] VerPins; delete d; }
@@ -44,6 +44,7 @@
 using std::vector;
 #endif
 
+class pkgPolicyPrivate;
 class pkgPolicy : public pkgDepCache::Policy
 {
    protected:
@@ -84,11 +85,21 @@ class pkgPolicy : public pkgDepCache::Policy
    virtual signed short GetPriority(pkgCache::PkgFileIterator const &File) APT_OVERRIDE;
 
    bool InitDefaults();
+
+   /** \brief use the candidates and priorities stored in FileName
+    *
+    *  The table is only used if it was stored for the same cache, default
+    *  release and preferences files. Creating a pin discards it again.
+    *  \return \b true if the table is used */
+   APT_HIDDEN bool LoadTable(std::string const &FileName);
+   /** \brief calculate all candidates and priorities and store them in
+    *  FileName for #LoadTable, using the table from now on */
+   APT_HIDDEN bool StoreTable(std::string const &FileName);
    
    explicit pkgPolicy(pkgCache *Owner);
    virtual ~pkgPolicy();
    private:
-   void * const d;
+   pkgPolicyPrivate * const d;
 };
 
 bool ReadPinFile(pkgPolicy &Plcy, std::string File = "");
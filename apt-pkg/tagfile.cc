@@ -18,14 +18,24 @@
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/string_view.h>
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/aptconfiguration.h>
 
 #include <list>
+#include <memory>
 
 #include <string>
 #include <stdio.h>
 #include <ctype.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
 
 #include <apti18n.h>
 									/*}}}*/
@@ -36,11 +46,22 @@ using APT::StringView;
 class APT_HIDDEN pkgTagFilePrivate					/*{{{*/
 {
 public:
-   void Reset(FileFd * const pFd, unsigned long long const pSize, pkgTagFile::Flags const pFlags)
+   void ReleaseBuffer()
    {
       if (Buffer != NULL)
-	 free(Buffer);
+      {
+	 if (MapLength != 0)
+	    munmap(Buffer, MapLength);
+	 else
+	    free(Buffer);
+      }
       Buffer = NULL;
+      MapLength = 0;
+      Whole = false;
+   }
+   void Reset(FileFd * const pFd, unsigned long long const pSize, pkgTagFile::Flags const pFlags)
+   {
+      ReleaseBuffer();
       Fd = pFd;
       Flags = pFlags;
       Start = NULL;
@@ -52,7 +73,8 @@ public:
       chunks.clear();
    }
 
-   pkgTagFilePrivate(FileFd * const pFd, unsigned long long const Size, pkgTagFile::Flags const pFlags) : Buffer(NULL)
+   pkgTagFilePrivate(FileFd * const pFd, unsigned long long const Size, pkgTagFile::Flags const pFlags) :
+      Buffer(NULL), MapLength(0), Whole(false)
    {
       Reset(pFd, Size, pFlags);
    }
@@ -65,6 +87,10 @@ public:
    unsigned long long iOffset;
    unsigned long long Size;
    bool isCommentedLine;
+   // the buffer is a mapping of this length rather than malloc'ed
+   size_t MapLength;
+   // the buffer holds the whole file, so there is nothing to fill up
+   bool Whole;
    struct FileChunk
    {
       bool const good;
@@ -75,8 +101,7 @@ public:
 
    ~pkgTagFilePrivate()
    {
-      if (Buffer != NULL)
-	 free(Buffer);
+      ReleaseBuffer();
    }
 };
 									/*}}}*/
@@ -113,7 +138,251 @@ static unsigned long AlphaHash(const char *Text, size_t Length)		/*{{{*/
    return Res & 0xFF;
 }
 									/*}}}*/
+// TagScanner - find the newlines and colons of a section		/*{{{*/
+/* Instead of a memchr call for each line and each tag the section is
+   classified in blocks of 64 bytes, each resulting in a bitmask of the
+   newlines and one of the colons in this block. Every byte is looked at
+   only once this way and the following lookups are just bit fiddling.
+   The classification is vectorized if the CPU we run on supports it. */
+typedef void (*TagScannerClassifier)(char const * const Block, uint64_t &Newlines, uint64_t &Colons);
+static void ClassifyScalar(char const * const Block, uint64_t &Newlines, uint64_t &Colons)
+{
+   Newlines = 0;
+   Colons = 0;
+   for (unsigned int i = 0; i < 64; ++i)
+   {
+      if (Block[i] == '\n')
+	 Newlines |= uint64_t(1) << i;
+      else if (Block[i] == ':')
+	 Colons |= uint64_t(1) << i;
+   }
+}
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+__attribute__((target("sse2")))
+static void ClassifySSE2(char const * const Block, uint64_t &Newlines, uint64_t &Colons)
+{
+   __m128i const NL = _mm_set1_epi8('\n');
+   __m128i const CO = _mm_set1_epi8(':');
+   Newlines = 0;
+   Colons = 0;
+   for (unsigned int i = 0; i < 64; i += 16)
+   {
+      __m128i const Data = _mm_loadu_si128(reinterpret_cast<__m128i const *>(Block + i));
+      Newlines |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(Data, NL)))) << i;
+      Colons |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(Data, CO)))) << i;
+   }
+}
+__attribute__((target("avx2")))
+static void ClassifyAVX2(char const * const Block, uint64_t &Newlines, uint64_t &Colons)
+{
+   __m256i const NL = _mm256_set1_epi8('\n');
+   __m256i const CO = _mm256_set1_epi8(':');
+   __m256i const Low = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(Block));
+   __m256i const High = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(Block + 32));
+   Newlines = uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(Low, NL)))) |
+      (uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(High, NL)))) << 32);
+   Colons = uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(Low, CO)))) |
+      (uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(High, CO)))) << 32);
+}
+#endif
+static TagScannerClassifier ChooseClassifier()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2"))
+      return ClassifyAVX2;
+   if (__builtin_cpu_supports("sse2"))
+      return ClassifySSE2;
+#endif
+   return ClassifyScalar;
+}
+class APT_HIDDEN TagScanner
+{
+   char const * const Begin;
+   char const * const End;
+   // the block the masks belong to
+   char const * Block;
+   uint64_t Newlines;
+   uint64_t Colons;
+
+   void Classify(char const * const NewBlock)
+   {
+      static TagScannerClassifier const Classifier = ChooseClassifier();
+      Block = NewBlock;
+      if (End - Block >= 64)
+	 Classifier(Block, Newlines, Colons);
+      else
+      {
+	 // never read behind the end of the buffer
+	 char Tail[64];
+	 memset(Tail, 0, sizeof(Tail));
+	 memcpy(Tail, Block, End - Block);
+	 Classifier(Tail, Newlines, Colons);
+      }
+   }
+   char const * Find(char const * From, uint64_t const TagScanner::* const Mask)
+   {
+      while (From < End)
+      {
+	 size_t const Offset = From - Begin;
+	 char const * const BlockStart = Begin + (Offset & ~size_t(63));
+	 if (BlockStart != Block)
+	    Classify(BlockStart);
+	 uint64_t const Bits = (this->*Mask) >> (Offset & 63);
+	 if (Bits != 0)
+	    return From + __builtin_ctzll(Bits);
+	 From = BlockStart + 64;
+      }
+      return NULL;
+   }
+
+   public:
+   /** \brief the first newline at or after From or \b NULL */
+   char const * Newline(char const * const From) { return Find(From, &TagScanner::Newlines); }
+   /** \brief the first colon at or after From or \b NULL */
+   char const * Colon(char const * const From) { return Find(From, &TagScanner::Colons); }
+
+   TagScanner(char const * const Begin, char const * const End) : Begin(Begin), End(End),
+      Block(NULL), Newlines(0), Colons(0) {}
+};
+									/*}}}*/
+
+// TagFile::LoadWholeFile - Map or read the whole file at once		/*{{{*/
+/* apt update keeps decompressed copies of the compressed lists (if
+   configured), so that they can be mapped directly instead of being
+   decompressed again. A copy is only used if it is still current, that is
+   it has the modification time of the compressed list and isn't older. */
+static std::string DecompressedCopy(FileFd &Fd)
+{
+   if (_config->FindB("Acquire::KeepDecompressedIndexes", false) == false)
+      return "";
+   std::string const ListDir = _config->FindDir("Dir::State::lists");
+   std::string const Name = Fd.Name();
+   if (Name.compare(0, ListDir.length(), ListDir) != 0 || Name.find('/', ListDir.length()) != std::string::npos)
+      return "";
+
+   std::string Base = flNotDir(Name);
+   for (auto const &Comp : APT::Configuration::getCompressors())
+      if (Comp.Extension.empty() == false && APT::String::Endswith(Base, Comp.Extension) == true)
+      {
+	 Base.erase(Base.length() - Comp.Extension.length());
+	 break;
+      }
+   std::string const Copy = ListDir + "decompressed/" + Base;
 
+   struct stat Source, Target;
+   if (stat(Name.c_str(), &Source) != 0 || stat(Copy.c_str(), &Target) != 0)
+      return "";
+   if (S_ISREG(Target.st_mode) && Target.st_mtime == Source.st_mtime && Target.st_ctime >= Source.st_ctime)
+      return Copy;
+   return "";
+}
+/* The mapping is followed by at least one page of zeros, so that the
+   double newline at the end can be added (and read behind) as usual. */
+static char * MapWithSlack(int const Fd, size_t const FileSize, size_t &Length)
+{
+   size_t const PageSize = sysconf(_SC_PAGESIZE);
+   Length = (FileSize / PageSize + 2) * PageSize;
+   void * const Reserved = mmap(NULL, Length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (Reserved == MAP_FAILED)
+      return NULL;
+   void * const Mapped = mmap(Reserved, FileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, Fd, 0);
+   if (Mapped == MAP_FAILED)
+   {
+      munmap(Reserved, Length);
+      return NULL;
+   }
+   return static_cast<char *>(Mapped);
+}
+static bool LoadWholeFile(pkgTagFilePrivate * const d)
+{
+   // pipes and the like can't be mapped (and asking them for a position fails)
+   struct stat Buf;
+   if (d->Fd->IsCompressed() == false &&
+	 (fstat(d->Fd->Fd(), &Buf) != 0 || S_ISREG(Buf.st_mode) == false || Buf.st_size == 0))
+      return false;
+   // offsets are relative to the start of the file, not the current position
+   if (d->Fd->Tell() != 0)
+      return false;
+
+   // whatever goes wrong here, we can still read the file piecewise
+   _error->PushToStack();
+   FileFd * Fd = d->Fd;
+   std::unique_ptr<FileFd> Copy;
+   if (Fd->IsCompressed() == true)
+   {
+      std::string const CopyName = DecompressedCopy(*Fd);
+      if (CopyName.empty() == false)
+      {
+	 Copy.reset(new FileFd(CopyName, FileFd::ReadOnly));
+	 if (Copy->IsOpen() == true && Copy->Failed() == false)
+	    Fd = Copy.get();
+      }
+      // decompressing everything is pointless if a jump is cheap anyhow
+      if (Fd == d->Fd && Fd->IsRandomAccess() == true)
+      {
+	 _error->RevertToStack();
+	 return false;
+      }
+   }
+
+   size_t Length = 0;
+   if (Fd->IsCompressed() == false)
+   {
+      if (fstat(Fd->Fd(), &Buf) != 0 || S_ISREG(Buf.st_mode) == false || Buf.st_size == 0)
+      {
+	 _error->RevertToStack();
+	 return false;
+      }
+      d->Buffer = MapWithSlack(Fd->Fd(), Buf.st_size, d->MapLength);
+      if (d->Buffer == NULL)
+      {
+	 d->MapLength = 0;
+	 _error->RevertToStack();
+	 return false;
+      }
+      Length = Buf.st_size;
+   }
+   else
+   {
+      // decompress once into memory, 4 extra chars as in Init
+      size_t Size = 1024 * 1024;
+      unsigned long long Actual = 0;
+      do {
+	 char * const newBuffer = static_cast<char *>(realloc(d->Buffer, Size + 4));
+	 if (newBuffer == NULL || Fd->Read(newBuffer + Length, Size - Length, &Actual) == false)
+	 {
+	    if (newBuffer != NULL)
+	       d->Buffer = newBuffer;
+	    d->ReleaseBuffer();
+	    d->Fd->Seek(0);
+	    _error->RevertToStack();
+	    return false;
+	 }
+	 d->Buffer = newBuffer;
+	 Length += Actual;
+	 if (Length == Size)
+	    Size *= 2;
+      } while (Actual != 0);
+   }
+   _error->RevertToStack();
+
+   d->Whole = true;
+   d->Done = true;
+   d->Size = Length;
+   d->Start = d->Buffer;
+   d->End = d->Buffer + Length;
+   // Append a double new line if one does not exist
+   unsigned int LineCount = 0;
+   for (const char *E = d->End - 1; E >= d->Buffer && d->End - E < 6 && (*E == '\n' || *E == '\r'); E--)
+      if (*E == '\n')
+	 ++LineCount;
+   for (; LineCount < 2; ++LineCount)
+      *d->End++ = '\n';
+   *d->End = '\0';
+   return true;
+}
+									/*}}}*/
 // TagFile::pkgTagFile - Constructor					/*{{{*/
 pkgTagFile::pkgTagFile(FileFd * const pFd,pkgTagFile::Flags const pFlags, unsigned long long const Size)
    : d(new pkgTagFilePrivate(pFd, Size + 4, pFlags))
@@ -135,6 +404,9 @@ void pkgTagFile::Init(FileFd * const pFd, pkgTagFile::Flags const pFlags, unsign
 
    if (d->Fd->IsOpen() == false)
       d->Start = d->End = d->Buffer = 0;
+   else if ((pFlags & pkgTagFile::MMAP) == pkgTagFile::MMAP &&
+	 (pFlags & pkgTagFile::SUPPORT_COMMENTS) == 0 && LoadWholeFile(d) == true)
+      return;
    else
       d->Buffer = (char*)malloc(sizeof(char) * Size);
 
@@ -203,7 +475,18 @@ bool pkgTagFile::Resize(unsigned long long const newSize)
  */
 bool pkgTagFile::Step(pkgTagSection &Tag)
 {
-   if(Tag.Scan(d->Start,d->End - d->Start) == false)
+   if (d->Whole == true)
+   {
+      // everything is in the buffer already, so this is the end or broken
+      if (Tag.Scan(d->Start, d->End - d->Start) == false)
+      {
+	 if (d->End - d->Start <= 3)
+	    return false;
+	 return _error->Error(_("Unable to parse package file %s (%d)"),
+	       d->Fd->Name().c_str(), 1);
+      }
+   }
+   else if(Tag.Scan(d->Start,d->End - d->Start) == false)
    {
       do
       {
@@ -427,6 +710,16 @@ bool pkgTagFile::Fill()
    that is there */
 bool pkgTagFile::Jump(pkgTagSection &Tag,unsigned long long Offset)
 {
+   if (d->Whole == true)
+   {
+      if (Offset >= static_cast<unsigned long long>(d->End - d->Buffer))
+	 return false;
+      // like the reload below, the section stays the next one for Step
+      d->Start = d->Buffer + Offset;
+      d->iOffset = Offset;
+      return Tag.Scan(d->Start, d->End - d->Start);
+   }
+
    if ((d->Flags & pkgTagFile::SUPPORT_COMMENTS) == 0 &&
    // We are within a buffer space of the next hit..
 	 Offset >= d->iOffset && d->iOffset + (d->End - d->Start) > Offset)
@@ -482,13 +775,14 @@ bool pkgTagSection::Scan(const char *Start,unsigned long MaxLength, bool const R
 {
    Section = Start;
    const char *End = Start + MaxLength;
+   TagScanner Scanner(Section, End);
 
    if (Restart == false && d->Tags.empty() == false)
    {
       Stop = Section + d->Tags.back().StartTag;
       if (End <= Stop)
 	 return false;
-      Stop = (const char *)memchr(Stop,'\n',End - Stop);
+      Stop = Scanner.Newline(Stop);
       if (Stop == NULL)
 	 return false;
       ++Stop;
@@ -537,7 +831,7 @@ bool pkgTagSection::Scan(const char *Start,unsigned long MaxLength, bool const R
 	 APT_IGNORE_DEPRECATED(++TagCount;)
 	 lastTagData = pkgTagSectionPrivate::TagData(Stop - Section);
 	 // find the colon separating tag and value
-	 char const * Colon = (char const *) memchr(Stop, ':', End - Stop);
+	 char const * Colon = Scanner.Colon(Stop);
 	 if (Colon == NULL)
 	    return false;
 	 // find the end of the tag (which might or might not be the colon)
@@ -558,7 +852,7 @@ bool pkgTagSection::Scan(const char *Start,unsigned long MaxLength, bool const R
 	 lastTagData.StartValue = Stop - Section;
       }
 
-      Stop = (const char *)memchr(Stop,'\n',End - Stop);
+      Stop = Scanner.Newline(Stop);
 
       if (Stop == 0)
 	 return false;
@@ -820,6 +1114,54 @@ void pkgTagSection::Get(const char *&Start,const char *&Stop,unsigned int I) con
    Stop = Section + d->Tags[I+1].StartTag;
 }
 									/*}}}*/
+// TagSection::Save - Store the index of the current section		/*{{{*/
+void pkgTagSection::Save(std::vector<unsigned int> &Index) const
+{
+   Index.push_back(Stop - Section);
+   Index.push_back(d->Tags.size());
+   for (auto const &T : d->Tags)
+   {
+      Index.push_back(T.StartTag);
+      Index.push_back(T.EndTag);
+      Index.push_back(T.StartValue);
+      Index.push_back(T.NextInBucket);
+   }
+   // only the used buckets are stored as most of them are empty
+   size_t const Buckets = Index.size();
+   Index.push_back(0);
+   for (unsigned int I = 0; I < sizeof(AlphaIndexes)/sizeof(AlphaIndexes[0]); ++I)
+   {
+      if (AlphaIndexes[I] == 0)
+	 continue;
+      Index.push_back(I);
+      Index.push_back(AlphaIndexes[I]);
+      ++Index[Buckets];
+   }
+}
+									/*}}}*/
+// TagSection::Restore - Reload a section stored by Save		/*{{{*/
+void pkgTagSection::Restore(const char * const Start, unsigned int const * Index)
+{
+   Section = Start;
+   Stop = Section + *Index++;
+
+   d->Tags.clear();
+   for (unsigned int Count = *Index++; Count != 0; --Count, Index += 4)
+   {
+      pkgTagSectionPrivate::TagData T(Index[0]);
+      T.EndTag = Index[1];
+      T.StartValue = Index[2];
+      T.NextInBucket = Index[3];
+      d->Tags.push_back(T);
+   }
+
+   APT_IGNORE_DEPRECATED_PUSH
+   memset(&AlphaIndexes, 0, sizeof(AlphaIndexes));
+   for (unsigned int Count = *Index++; Count != 0; --Count, Index += 2)
+      AlphaIndexes[Index[0]] = Index[1];
+   APT_IGNORE_DEPRECATED_POP
+}
+									/*}}}*/
 APT_PURE unsigned int pkgTagSection::Count() const {			/*{{{*/
    if (d->Tags.empty() == true)
       return 0;
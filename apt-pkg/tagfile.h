@@ -129,6 +129,20 @@ class pkgTagSection
 
    void Get(const char *&Start,const char *&Stop,unsigned int I) const;
 
+   /** \brief stores the index of the current section for later reuse
+    *
+    * The index built by #Scan is appended to the given storage. As it only
+    * contains offsets relative to the start of the section it can be used
+    * with #Restore on a copy of the section data, too.
+    */
+   APT_HIDDEN void Save(std::vector<unsigned int> &Index) const;
+   /** \brief reloads a section previously stored with #Save
+    *
+    * @param Start is the beginning of the section data
+    * @param Index points to the beginning of the stored index
+    */
+   APT_HIDDEN void Restore(const char * const Start, unsigned int const * Index);
+
    inline void GetSection(const char *&Start,const char *&Stop) const
    {
       Start = Section;
@@ -190,6 +204,13 @@ public:
    {
       STRICT = 0,
       SUPPORT_COMMENTS = 1 << 0,
+      /** map the whole file into memory instead of reading it piecewise.
+       *  Compressed files are decompressed once, see Acquire::KeepDecompressedIndexes.
+       *  Meant for reading a file from start to end, as the whole file is read
+       *  even if only a few sections are needed.
+       *  Can't be combined with SUPPORT_COMMENTS and falls back to reading
+       *  piecewise if the file can't be mapped. */
+      MMAP = 1 << 1,
    };
 
    void Init(FileFd * const F, pkgTagFile::Flags const Flags, unsigned long long Size = 32*1024);
@@ -2,6 +2,7 @@
 #include <config.h>
 
 #include <apt-pkg/acquire-item.h>
+#include <apt-pkg/aptconfiguration.h>
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
@@ -11,6 +12,12 @@
 #include <apt-pkg/update.h>
 
 #include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 
 #include <apti18n.h>
 									/*}}}*/
@@ -37,6 +44,103 @@ bool ListUpdate(pkgAcquireStatus &Stat,
    return AcquireUpdate(Fetcher, PulseInterval, true);
 }
 									/*}}}*/
+// CleanDecompressedLists - remove copies without a compressed list	/*{{{*/
+/* pkgTagFile keeps decompressed copies of compressed lists in a subdirectory
+   of the lists directory (see Acquire::KeepDecompressedIndexes). The copies
+   are checked for freshness on use, so only the orphaned ones need to go. */
+static bool CleanDecompressedLists(std::string const &ListDir)
+{
+   std::string const CopyDir = ListDir + "decompressed/";
+   if (DirectoryExists(CopyDir) == false)
+      return true;
+   DIR * const D = opendir(CopyDir.c_str());
+   if (D == NULL)
+      return _error->Errno("opendir",_("Unable to read %s"),CopyDir.c_str());
+
+   std::vector<APT::Configuration::Compressor> const Compressors = APT::Configuration::getCompressors();
+   for (struct dirent *Ent = readdir(D); Ent != NULL; Ent = readdir(D))
+   {
+      if (strcmp(Ent->d_name, ".") == 0 || strcmp(Ent->d_name, "..") == 0)
+	 continue;
+      std::string const Name = Ent->d_name;
+      bool Orphan = true;
+      for (auto const &Comp : Compressors)
+	 if (Comp.Extension.empty() == false && RealFileExists(ListDir + Name + Comp.Extension) == true)
+	 {
+	    Orphan = false;
+	    break;
+	 }
+      if (Orphan == true)
+	 RemoveFile("CleanDecompressedLists", CopyDir + Name);
+   }
+   closedir(D);
+   return true;
+}
+									/*}}}*/
+// KeepDecompressedLists - decompress the changed compressed lists	/*{{{*/
+/* Only done here as we hold the lists lock, readers just use the copies
+   which are still current, i.e. have the mtime of their compressed list
+   and are not older than it. */
+static void KeepDecompressedLists(std::string const &ListDir)
+{
+   std::string const CopyDir = ListDir + "decompressed/";
+   DIR * const D = opendir(ListDir.c_str());
+   if (D == NULL)
+      return;
+
+   _error->PushToStack();
+   std::vector<APT::Configuration::Compressor> const Compressors = APT::Configuration::getCompressors();
+   for (struct dirent *Ent = readdir(D); Ent != NULL; Ent = readdir(D))
+   {
+      std::string const Name = Ent->d_name;
+      std::string Base;
+      for (auto const &Comp : Compressors)
+	 if (Comp.Extension.empty() == false && APT::String::Endswith(Name, Comp.Extension) == true)
+	 {
+	    Base = Name.substr(0, Name.length() - Comp.Extension.length());
+	    break;
+	 }
+      if (Base.empty() == true)
+	 continue;
+
+      std::string const List = ListDir + Name;
+      std::string const Copy = CopyDir + Base;
+      struct stat Source, Target;
+      if (stat(List.c_str(), &Source) != 0 || S_ISREG(Source.st_mode) == false)
+	 continue;
+      if (stat(Copy.c_str(), &Target) == 0 && S_ISREG(Target.st_mode) &&
+	    Target.st_mtime == Source.st_mtime && Target.st_ctime >= Source.st_ctime)
+	 continue;
+
+      if (DirectoryExists(CopyDir) == false && mkdir(CopyDir.c_str(), 0755) != 0)
+	 break;
+      FileFd In(List, FileFd::ReadOnly, FileFd::Extension);
+      if (In.IsOpen() == false)
+	 continue;
+      {
+	 FileFd Out(Copy, FileFd::WriteAtomic);
+	 if (Out.IsOpen() == false || Out.Failed() == true)
+	    continue;
+	 fchmod(Out.Fd(), 0644);
+	 bool const Copied = CopyFile(In, Out);
+	 if (Out.Close() == false || Copied == false)
+	 {
+	    RemoveFile("KeepDecompressedLists", Copy);
+	    continue;
+	 }
+      }
+      struct timeval times[2];
+      times[0].tv_sec = Source.st_atime;
+      times[1].tv_sec = Source.st_mtime;
+      times[0].tv_usec = times[1].tv_usec = 0;
+      if (utimes(Copy.c_str(), times) != 0)
+	 RemoveFile("KeepDecompressedLists", Copy);
+   }
+   closedir(D);
+   // the copies are an optimisation only, so failing to create them is fine
+   _error->RevertToStack();
+}
+									/*}}}*/
 // AcquireUpdate - take Fetcher and update the cache files		/*{{{*/
 // ---------------------------------------------------------------------
 /* This is a simple wrapper to update the cache with a provided acquire
@@ -100,11 +204,15 @@ bool AcquireUpdate(pkgAcquire &Fetcher, int const PulseInterval,
 	_config->FindB("APT::List-Cleanup",true) == true))
    {
       if (Fetcher.Clean(_config->FindDir("Dir::State::lists")) == false ||
-	  Fetcher.Clean(_config->FindDir("Dir::State::lists") + "partial/") == false)
+	  Fetcher.Clean(_config->FindDir("Dir::State::lists") + "partial/") == false ||
+	  CleanDecompressedLists(_config->FindDir("Dir::State::lists")) == false)
 	 // something went wrong with the clean
 	 return false;
    }
 
+   if (_config->FindB("Acquire::KeepDecompressedIndexes", false) == true)
+      KeepDecompressedLists(_config->FindDir("Dir::State::lists"));
+
    bool Res = true;
    
    if (TransientNetworkFailure == true)
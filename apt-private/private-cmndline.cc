@@ -157,6 +157,7 @@ static bool addArgumentsAPTFTPArchive(std::vector<CommandLine::Args> &Args, char
    addArg(0,"readonly","APT::FTPArchive::ReadOnlyDB",0);
    addArg(0,"contents","APT::FTPArchive::Contents",0);
    addArg('a',"arch","APT::FTPArchive::Architecture",CommandLine::HasArg);
+   addArg('j',"threads","APT::FTPArchive::Threads",CommandLine::HasArg);
    return true;
 }
 									/*}}}*/
@@ -7,6 +7,7 @@
 #include <apt-pkg/cacheset.h>
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/cmndline.h>
+#include <apt-pkg/depindex.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/pkgcache.h>
 
@@ -61,23 +62,20 @@ static bool ShowDepends(CommandLine &CmdL, bool const RevDepends)
 
       std::cout << Pkg.FullName(true) << std::endl;
 
-      if (RevDepends == true)
-	 std::cout << "Reverse Depends:" << std::endl;
-      for (pkgCache::DepIterator D = RevDepends ? Pkg.RevDependsList() : Ver.DependsList();
-	    D.end() == false; ++D)
-      {
+      // returns if the dependency was shown rather than filtered
+      auto const ShowDependency = [&](pkgCache::DepIterator const &D) {
 	 switch (D->Type) {
-	    case pkgCache::Dep::PreDepends: if (!ShowPreDepends) continue; break;
-	    case pkgCache::Dep::Depends: if (!ShowDepends) continue; break;
-	    case pkgCache::Dep::Recommends: if (!ShowRecommends) continue; break;
-	    case pkgCache::Dep::Suggests: if (!ShowSuggests) continue; break;
-	    case pkgCache::Dep::Replaces: if (!ShowReplaces) continue; break;
-	    case pkgCache::Dep::Conflicts: if (!ShowConflicts) continue; break;
-	    case pkgCache::Dep::DpkgBreaks: if (!ShowBreaks) continue; break;
-	    case pkgCache::Dep::Enhances: if (!ShowEnhances) continue; break;
+	    case pkgCache::Dep::PreDepends: if (!ShowPreDepends) return false; break;
+	    case pkgCache::Dep::Depends: if (!ShowDepends) return false; break;
+	    case pkgCache::Dep::Recommends: if (!ShowRecommends) return false; break;
+	    case pkgCache::Dep::Suggests: if (!ShowSuggests) return false; break;
+	    case pkgCache::Dep::Replaces: if (!ShowReplaces) return false; break;
+	    case pkgCache::Dep::Conflicts: if (!ShowConflicts) return false; break;
+	    case pkgCache::Dep::DpkgBreaks: if (!ShowBreaks) return false; break;
+	    case pkgCache::Dep::Enhances: if (!ShowEnhances) return false; break;
 	 }
 	 if (ShowImplicit == false && D.IsImplicit())
-	    continue;
+	    return false;
 
 	 pkgCache::PkgIterator Trg = RevDepends ? D.ParentPkg() : D.TargetPkg();
 
@@ -125,10 +123,20 @@ static bool ShowDepends(CommandLine &CmdL, bool const RevDepends)
 	       verset.insert(APT::VersionSet::FromPackage(CacheFile, V.ParentPkg(), APT::CacheSetHelper::CANDIDATE, helper));
 	    }
 	 }
+	 return true;
+      };
 
-	 if (ShowOnlyFirstOr == true)
-	    while ((D->CompareOp & pkgCache::Dep::Or) == pkgCache::Dep::Or) ++D;
+      if (RevDepends == true)
+      {
+	 std::cout << "Reverse Depends:" << std::endl;
+	 for (pkgDepIndex::RevDepIterator D(Cache->DepIndex(), Pkg); D.end() == false; ++D)
+	    if (ShowDependency(D) == true && ShowOnlyFirstOr == true)
+	       while ((D->CompareOp & pkgCache::Dep::Or) == pkgCache::Dep::Or) ++D;
       }
+      else
+	 for (pkgDepIndex::DepIterator D(Cache->DepIndex(), Ver); D.end() == false; ++D)
+	    if (ShowDependency(D) == true && ShowOnlyFirstOr == true)
+	       while ((D->CompareOp & pkgCache::Dep::Or) == pkgCache::Dep::Or) ++D;
    }
 
    for (APT::PackageSet::const_iterator Pkg = helper.virtualPkgs.begin();
@@ -17,7 +17,7 @@
 #include <apt-private/private-utils.h>
 #include <apt-private/acqprogress.h>
 
-#include <fstream>
+#include <iostream>
 #include <string>
 #include <vector>
 
@@ -221,9 +221,10 @@ bool DoDownload(CommandLine &CmdL)
           filename != (*I)->DestFile &&
           (*I)->Status == pkgAcquire::Item::StatDone)
       {
-	 std::ifstream src((*I)->DestFile.c_str(), std::ios::binary);
-	 std::ofstream dst(filename.c_str(), std::ios::binary);
-	 dst << src.rdbuf();
+	 FileFd src((*I)->DestFile, FileFd::ReadOnly);
+	 FileFd dst(filename, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, 0644);
+	 if (CopyFile(src, dst) == false || dst.Close() == false)
+	    Failed = true;
 	 chmod(filename.c_str(), 0644);
       }
    }
@@ -18,6 +18,7 @@
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/init.h>
 #include <apt-pkg/fileutl.h>
+#include <apt-pkg/aptconfiguration.h>
 
 #include <apt-private/private-cmndline.h>
 #include <apt-private/private-output.h>
@@ -27,14 +28,26 @@
 #include <climits>
 #include <sys/time.h>
 #include <locale.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#endif
+
 #include "cachedb.h"
 #include "override.h"
 #include "apt-ftparchive.h"
@@ -776,6 +789,211 @@ static bool SimpleGenRelease(CommandLine &CmdL)
 }
 
 									/*}}}*/
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+// GenerateOutput - Collect the output of a generate job		/*{{{*/
+// ---------------------------------------------------------------------
+/* Replaces the buffer of a stream while the jobs run. Everything a worker
+   thread writes is kept in the output list of its current job, so that it
+   can be printed later in the order the serial run would have used. */
+typedef std::vector<std::pair<std::streambuf *, std::string>> GenerateOutputList;
+static thread_local GenerateOutputList *GenerateCapture = nullptr;
+class GenerateOutput : public std::streambuf
+{
+   std::ostream &Stream;
+   std::streambuf * const Original;
+   pid_t const Pid;
+
+   protected:
+   virtual std::streamsize xsputn(const char *S, std::streamsize N) APT_OVERRIDE
+   {
+      if (Original == nullptr)
+	 return 0;
+      // forked compress children write for themselves
+      if (GenerateCapture == nullptr || getpid() != Pid)
+	 return Original->sputn(S, N);
+      if (GenerateCapture->empty() == true || GenerateCapture->back().first != Original)
+	 GenerateCapture->emplace_back(Original, std::string());
+      GenerateCapture->back().second.append(S, N);
+      return N;
+   }
+   virtual int_type overflow(int_type C) APT_OVERRIDE
+   {
+      if (traits_type::eq_int_type(C, traits_type::eof()) == true)
+	 return traits_type::not_eof(C);
+      char const Chr = traits_type::to_char_type(C);
+      return xsputn(&Chr, 1) == 1 ? C : traits_type::eof();
+   }
+   virtual int sync() APT_OVERRIDE
+   {
+      if (GenerateCapture == nullptr || getpid() != Pid)
+	 return Original == nullptr ? 0 : Original->pubsync();
+      return 0;
+   }
+
+   public:
+   explicit GenerateOutput(std::ostream &Stream) : Stream(Stream), Original(Stream.rdbuf()), Pid(getpid())
+   {
+      Stream.rdbuf(this);
+   }
+   virtual ~GenerateOutput()
+   {
+      Stream.rdbuf(Original);
+   }
+};
+									/*}}}*/
+// DoGenerateThreaded - Generate the indexes on a pool of threads	/*{{{*/
+// ---------------------------------------------------------------------
+/* Each Packages and Sources file is a job. Jobs sharing a cache DB or a
+   translation file are run one after another on the same thread in their
+   serial order, as neither of them can be written from two threads.
+   The output, the errors and the statistics of each job are collected and
+   reported in the order of the serial run. */
+struct GenerateJob
+{
+   PackageMap *Map;
+   bool Source;
+   bool Result;
+   bool Finished;
+   struct CacheDB::Stats Stats;
+   GenerateOutputList Output;
+   std::vector<std::pair<bool, std::string>> Messages;
+
+   GenerateJob(PackageMap * const Map, bool const Source) : Map(Map), Source(Source),
+      Result(false), Finished(false) {}
+};
+static bool DoGenerateThreaded(Configuration &Setup,
+			       std::vector<PackageMap *> const &PkgMaps,
+			       std::vector<PackageMap *> const &SrcMaps,
+			       struct CacheDB::Stats &SrcStats,
+			       struct CacheDB::Stats &Stats,
+			       unsigned int Threads)
+{
+   std::vector<GenerateJob> Jobs;
+   for (auto const &M : PkgMaps)
+      Jobs.emplace_back(M, false);
+   for (auto const &M : SrcMaps)
+      Jobs.emplace_back(M, true);
+
+   // Put all jobs sharing a resource into the group of the first one
+   string const CacheDir = Setup.FindDir("Dir::CacheDir");
+   std::vector<size_t> Group(Jobs.size());
+   std::map<std::string, size_t> Users;
+   auto const FindGroup = [&Group](size_t J) {
+      while (Group[J] != J)
+	 J = Group[J] = Group[Group[J]];
+      return J;
+   };
+   auto const Use = [&](size_t const J, std::string const &Resource) {
+      auto const U = Users.emplace(Resource, J);
+      if (U.second == true)
+	 return;
+      size_t const A = FindGroup(U.first->second);
+      size_t const B = FindGroup(J);
+      Group[std::max(A, B)] = std::min(A, B);
+   };
+   for (size_t J = 0; J < Jobs.size(); ++J)
+   {
+      Group[J] = J;
+      PackageMap const * const M = Jobs[J].Map;
+      std::string const &DB = Jobs[J].Source ? M->SrcCacheDB : M->BinCacheDB;
+      if (DB.empty() == false)
+	 Use(J, "db:" + flCombine(CacheDir, DB));
+      if (Jobs[J].Source == false && M->TransWriter != nullptr)
+	 Use(J, "translation:" + std::to_string(reinterpret_cast<uintptr_t>(M->TransWriter)));
+   }
+   std::vector<std::vector<size_t>> Groups;
+   std::vector<size_t> GroupIndex(Jobs.size(), std::numeric_limits<size_t>::max());
+   for (size_t J = 0; J < Jobs.size(); ++J)
+   {
+      size_t const G = FindGroup(J);
+      if (GroupIndex[G] == std::numeric_limits<size_t>::max())
+      {
+	 GroupIndex[G] = Groups.size();
+	 Groups.emplace_back();
+      }
+      Groups[GroupIndex[G]].push_back(J);
+   }
+   Threads = std::min<size_t>(Threads, Groups.size());
+
+   // fill the caches of the library before the threads could race for it
+   APT::Configuration::getCompressors();
+
+   std::mutex Lock;
+   std::condition_variable Done;
+   size_t NextGroup = 0;
+   auto const Worker = [&]() {
+      while (true)
+      {
+	 size_t G;
+	 {
+	    std::lock_guard<std::mutex> Guard(Lock);
+	    if (NextGroup == Groups.size())
+	       return;
+	    G = NextGroup++;
+	 }
+	 for (auto const J : Groups[G])
+	 {
+	    GenerateJob &Job = Jobs[J];
+	    GenerateCapture = &Job.Output;
+	    if (Job.Source == true)
+	       Job.Result = Job.Map->GenSources(Setup, Job.Stats);
+	    else
+	       Job.Result = Job.Map->GenPackages(Setup, Job.Stats);
+	    GenerateCapture = nullptr;
+
+	    std::string Msg;
+	    while (_error->empty(GlobalError::DEBUG) == false)
+	    {
+	       bool const Type = _error->PopMessage(Msg);
+	       Job.Messages.emplace_back(Type, Msg);
+	    }
+	    {
+	       std::lock_guard<std::mutex> Guard(Lock);
+	       Job.Finished = true;
+	    }
+	    Done.notify_all();
+	 }
+      }
+   };
+
+   GenerateOutput Out0(c0out), Out1(c1out), Out2(c2out), Err(std::cerr);
+   std::vector<std::thread> Workers;
+   try
+   {
+      for (unsigned int I = 0; I < Threads; ++I)
+	 Workers.emplace_back(Worker);
+   }
+   catch (std::system_error const &)
+   {
+      // go on with the threads we got, or without any
+      if (Workers.empty() == true)
+	 Worker();
+   }
+
+   for (auto &Job : Jobs)
+   {
+      {
+	 std::unique_lock<std::mutex> Guard(Lock);
+	 Done.wait(Guard, [&Job]() { return Job.Finished; });
+      }
+      for (auto const &O : Job.Output)
+      {
+	 O.first->sputn(O.second.data(), O.second.size());
+	 O.first->pubsync();
+      }
+      for (auto const &M : Job.Messages)
+	 _error->Insert(M.first ? GlobalError::ERROR : GlobalError::WARNING, "%s", M.second.c_str());
+      if (Job.Result == false)
+	 _error->DumpErrors();
+      (Job.Source ? SrcStats : Stats).Add(Job.Stats);
+   }
+
+   for (auto &W : Workers)
+      W.join();
+   return true;
+}
+									/*}}}*/
+#endif
 // DoGeneratePackagesAndSources - Helper for Generate                   /*{{{*/
 // ---------------------------------------------------------------------
 static bool DoGeneratePackagesAndSources(Configuration &Setup,
@@ -784,14 +1002,13 @@ static bool DoGeneratePackagesAndSources(Configuration &Setup,
 					 struct CacheDB::Stats &Stats,
 					 CommandLine &CmdL)
 {
+   // Collect the entries to generate in the order we work on them
+   std::vector<PackageMap *> PkgMaps, SrcMaps;
    if (CmdL.FileSize() <= 2)
    {
       for (vector<PackageMap>::iterator I = PkgList.begin(); I != PkgList.end(); ++I)
-	 if (I->GenPackages(Setup,Stats) == false)
-	    _error->DumpErrors();
-      for (vector<PackageMap>::iterator I = PkgList.begin(); I != PkgList.end(); ++I)
-	 if (I->GenSources(Setup,SrcStats) == false)
-	    _error->DumpErrors();
+	 PkgMaps.push_back(&(*I));
+      SrcMaps = PkgMaps;
    }
    else
    {
@@ -818,34 +1035,41 @@ static bool DoGeneratePackagesAndSources(Configuration &Setup,
       }
       _error->DumpErrors();
       
-      // Do the generation for Packages
       for (End = List; End->Str != 0; ++End)
       {
 	 if (End->Hit == false)
 	    continue;
 	 
 	 PackageMap * const I = static_cast<PackageMap *>(End->UserData);
-	 if (I->PkgDone == true)
-	    continue;
-	 if (I->GenPackages(Setup,Stats) == false)
-	    _error->DumpErrors();
-      }
-      
-      // Do the generation for Sources
-      for (End = List; End->Str != 0; ++End)
-      {
-	 if (End->Hit == false)
-	    continue;
-	 
-	 PackageMap * const I = static_cast<PackageMap *>(End->UserData);
-	 if (I->SrcDone == true)
-	    continue;
-	 if (I->GenSources(Setup,SrcStats) == false)
-	    _error->DumpErrors();
+	 if (std::find(PkgMaps.begin(), PkgMaps.end(), I) == PkgMaps.end())
+	    PkgMaps.push_back(I);
       }
+      SrcMaps = PkgMaps;
       
       delete [] List;
    }
+
+   // Threads only pay off if there is more than one file to generate
+   PkgMaps.erase(std::remove_if(PkgMaps.begin(), PkgMaps.end(),
+	    [](PackageMap const * const M) { return M->PkgFile.empty(); }), PkgMaps.end());
+   SrcMaps.erase(std::remove_if(SrcMaps.begin(), SrcMaps.end(),
+	    [](PackageMap const * const M) { return M->SrcFile.empty(); }), SrcMaps.end());
+
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+   /* Delinking works with a byte limit for the whole run and changes
+      the archive itself, so it has to happen in the serial order */
+   int const Threads = _config->FindI("APT::FTPArchive::Threads", 1);
+   if (Threads > 1 && PkgMaps.size() + SrcMaps.size() > 1 &&
+	 std::none_of(PkgList.begin(), PkgList.end(), [](PackageMap const &M) { return M.DeLinkLimit != 0; }))
+      return DoGenerateThreaded(Setup, PkgMaps, SrcMaps, SrcStats, Stats, Threads);
+#endif
+
+   for (auto const &I : PkgMaps)
+      if (I->GenPackages(Setup,Stats) == false)
+	 _error->DumpErrors();
+   for (auto const &I : SrcMaps)
+      if (I->GenSources(Setup,SrcStats) == false)
+	 _error->DumpErrors();
    return true;
 }
 
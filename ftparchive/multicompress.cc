@@ -19,11 +19,15 @@
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/error.h>
+#include <apt-pkg/fanout.h>
 #include <apt-pkg/md5.h>
 #include <apt-pkg/aptconfiguration.h>
+#include <apt-pkg/configuration.h>
 #include <apt-pkg/hashsum_template.h>
 
 #include <ctype.h>
+#include <mutex>
+#include <set>
 #include <vector>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -36,6 +40,11 @@
 
 using namespace std;
 
+/* The pipes to all running writer children. A child forked for one output
+   must not keep the pipe of another one open, otherwise that writer would
+   not see the end of its input before this child exits. */
+static std::mutex ChildPipesLock;
+static std::set<int> ChildPipes;
 
 // MultiCompress::MultiCompress - Constructor				/*{{{*/
 // ---------------------------------------------------------------------
@@ -164,6 +173,8 @@ bool MultiCompress::GetStat(string const &Output,string const &Compress,struct s
 /* Fork a child and setup the communication pipe. */
 bool MultiCompress::Start()
 {
+   std::lock_guard<std::mutex> Guard(ChildPipesLock);
+
    // Create a data pipe
    int Pipe[2] = {-1,-1};
    if (pipe(Pipe) != 0)
@@ -176,6 +187,8 @@ bool MultiCompress::Start()
    if (Outputter == 0)
    {
       close(Pipe[1]);
+      for (auto const Fd : ChildPipes)
+	 close(Fd);
       Child(Pipe[0]);
       if (_error->PendingError() == true)
       {
@@ -188,6 +201,7 @@ bool MultiCompress::Start()
    close(Pipe[0]);
    if (Input.OpenDescriptor(Pipe[1], FileFd::WriteOnly, true) == false)
       return false;
+   ChildPipes.insert(Pipe[1]);
 
    if (Outputter == -1)
       return _error->Errno("fork",_("Failed to fork"));
@@ -202,7 +216,11 @@ bool MultiCompress::Die()
    if (Input.IsOpen() == false)
       return true;
 
-   Input.Close();
+   {
+      std::lock_guard<std::mutex> Guard(ChildPipesLock);
+      ChildPipes.erase(Input.Fd());
+      Input.Close();
+   }
    bool Res = ExecWait(Outputter,_("Compress child"),false);
    Outputter = -1;
    return Res;
@@ -284,26 +302,62 @@ bool MultiCompress::Child(int const &FD)
    unsigned char Buffer[32*1024];
    unsigned long long FileSize = 0;
    MD5Summation MD5;
-   while (1)
+   /* The input is read into blocks which are shared by all outputs, so
+      each compressor runs on its own core instead of one after another. */
+   std::vector<APT::BlockFanOut::Consumer> Writers;
+   for (Files *I = Outputs; I != 0; I = I->Next)
    {
-      WaitFd(FD,false);
-      int Res = read(FD,Buffer,sizeof(Buffer));
-      if (Res == 0)
-	 break;
-      if (Res < 0)
-	 continue;
+      FileFd * const Fd = &I->TmpFile;
+      Writers.emplace_back([Fd](unsigned char const * const Data, size_t const Size) {
+	 if (Fd->Write(Data, Size) == false)
+	    return _error->Errno("write",_("IO to subprocess/file failed"));
+	 return true;
+      });
+   }
+   APT::BlockFanOut Pipeline;
+   if (Writers.size() > 1 && _config->FindB("APT::FTPArchive::ParallelCompress", true) == true &&
+	 Pipeline.Start(Writers) == true)
+   {
+      while (1)
+      {
+	 size_t Free;
+	 unsigned char * const To = Pipeline.Reserve(Free);
+	 WaitFd(FD,false);
+	 int Res = read(FD,To,Free);
+	 if (Res == 0)
+	    break;
+	 if (Res < 0)
+	    continue;
 
-      MD5.Add(Buffer,Res);
-      FileSize += Res;
-      for (Files *I = Outputs; I != 0; I = I->Next)
+	 MD5.Add(To,Res);
+	 FileSize += Res;
+	 Pipeline.Commit(Res);
+      }
+      Pipeline.Finish();
+   }
+   else
+   {
+      while (1)
       {
-	 if (I->TmpFile.Write(Buffer, Res) == false)
-	 {
-	    _error->Errno("write",_("IO to subprocess/file failed"));
+	 WaitFd(FD,false);
+	 int Res = read(FD,Buffer,sizeof(Buffer));
+	 if (Res == 0)
 	    break;
+	 if (Res < 0)
+	    continue;
+
+	 MD5.Add(Buffer,Res);
+	 FileSize += Res;
+	 for (Files *I = Outputs; I != 0; I = I->Next)
+	 {
+	    if (I->TmpFile.Write(Buffer, Res) == false)
+	    {
+	       _error->Errno("write",_("IO to subprocess/file failed"));
+	       break;
+	    }
 	 }
-      }      
-   }   
+      }
+   }
 
    if (_error->PendingError() == true)
       return false;
@@ -52,7 +52,7 @@
 #include <apti18n.h>
 									/*}}}*/
 using namespace std;
-FTWScanner *FTWScanner::Owner;
+thread_local FTWScanner *FTWScanner::Owner;
 
 // ConfigToDoHashes - which hashes to generate				/*{{{*/
 static void SingleConfigToDoHashes(unsigned int &DoHashes, std::string const &Conf, unsigned int const Flag)
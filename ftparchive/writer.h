@@ -47,7 +47,7 @@ class FTWScanner
    // Stuff for the delinker
    bool NoLinkAct;
 
-   static FTWScanner *Owner;
+   static thread_local FTWScanner *Owner;
    static int ScannerFTW(const char *File,const struct stat *sb,int Flag);
    static int ScannerFile(const char *File, bool const &ReadLink);
 
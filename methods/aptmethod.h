@@ -3,10 +3,15 @@
 
 #include <apt-pkg/acquire-method.h>
 #include <apt-pkg/configuration.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
 
+#include <limits>
 #include <locale>
 #include <string>
 
+#include <sys/mman.h>
+
 class aptMethod : public pkgAcqMethod
 {
    char const * const Binary;
@@ -29,7 +34,26 @@ public:
    {
       Hashes Hash(Itm->ExpectedHashes);
       FileFd Fd;
-      if (Fd.Open(Res.Filename, FileFd::ReadOnly) == false || Hash.AddFD(Fd) == false)
+      if (Fd.Open(Res.Filename, FileFd::ReadOnly) == false)
+	 return false;
+      // hash straight from the page cache instead of reading it in pieces
+      unsigned long long const Size = Fd.FileSize();
+      if (Size != 0 && Size <= std::numeric_limits<size_t>::max())
+      {
+	 void * const Map = mmap(nullptr, Size, PROT_READ, MAP_SHARED, Fd.Fd(), 0);
+	 if (Map != MAP_FAILED)
+	 {
+	    madvise(Map, Size, MADV_SEQUENTIAL);
+	    if (Size >= 1024 * 1024)
+	       Hash.StartPipeline();
+	    bool const Okay = Hash.Add(static_cast<unsigned char const *>(Map), Size);
+	    if (Okay == true)
+	       Res.TakeHashes(Hash);
+	    munmap(Map, Size);
+	    return Okay;
+	 }
+      }
+      if (Hash.AddFD(Fd) == false)
 	 return false;
       Res.TakeHashes(Hash);
       return true;
@@ -41,11 +41,21 @@
 #include <cstring>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
+#include <algorithm>
 #include <iostream>
+#include <memory>
 #include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+#include <system_error>
+#include <thread>
+#endif
 
 #include "config.h"
 #include "connect.h"
@@ -63,10 +73,14 @@ const unsigned int CircleBuf::BW_HZ=10;
 // CircleBuf::CircleBuf - Circular input buffer				/*{{{*/
 // ---------------------------------------------------------------------
 /* */
-CircleBuf::CircleBuf(unsigned long long Size)
-   : Size(Size), Hash(NULL), TotalWriten(0)
+CircleBuf::CircleBuf(unsigned long long Size, unsigned long long MaxSize)
+   : Buf(NULL), Size(Size), MaxSize(std::max(Size, MaxSize)), Hash(NULL), TotalWriten(0)
 {
-   Buf = new unsigned char[Size];
+   // page-aligned, so that reads and writes of whole pages stay aligned
+   void *Mem = NULL;
+   if (posix_memalign(&Mem, sysconf(_SC_PAGESIZE), Size) != 0)
+      throw std::bad_alloc();
+   Buf = static_cast<unsigned char *>(Mem);
    Reset();
 
    CircleBuf::BwReadLimit = _config->FindI("Acquire::http::Dl-Limit",0)*1024;
@@ -80,6 +94,7 @@ void CircleBuf::Reset()
    InP = 0;
    OutP = 0;
    StrPos = 0;
+   Reads = 0;
    TotalWriten = 0;
    MaxGet = (unsigned long long)-1;
    OutQueue = string();
@@ -145,9 +160,47 @@ bool CircleBuf::Read(int Fd)
       if (InP == 0)
 	 gettimeofday(&Start,0);
       InP += Res;
+      ++Reads;
+
+      /* The fd had at least as much data as we had space for, so the
+	 buffer is smaller than what arrives between two of our wakeups:
+	 grow it towards the bandwidth-delay product of the connection */
+      if (InP - OutP == Size && Size < MaxSize && Grow() == false)
+	 return true;
    }
 }
 									/*}}}*/
+// CircleBuf::Grow - Double the size of the buffer			/*{{{*/
+// ---------------------------------------------------------------------
+/* The positions are absolute, so the data is placed in the new buffer
+   at the offsets they map to with the new size. */
+bool CircleBuf::Grow()
+{
+   unsigned long long const NewSize = std::min(Size * 2, MaxSize);
+   void *Mem = NULL;
+   if (posix_memalign(&Mem, sysconf(_SC_PAGESIZE), NewSize) != 0)
+   {
+      // we can continue fine with the buffer we have
+      MaxSize = Size;
+      return false;
+   }
+   unsigned char * const NewBuf = static_cast<unsigned char *>(Mem);
+   for (unsigned long long P = OutP; P < InP;)
+   {
+      unsigned long long Sz = InP - P;
+      if (Sz > Size - (P%Size))
+	 Sz = Size - (P%Size);
+      if (Sz > NewSize - (P%NewSize))
+	 Sz = NewSize - (P%NewSize);
+      memcpy(NewBuf + (P%NewSize), Buf + (P%Size), Sz);
+      P += Sz;
+   }
+   free(Buf);
+   Buf = NewBuf;
+   Size = NewSize;
+   return true;
+}
+									/*}}}*/
 // CircleBuf::Read - Put the string into the buffer			/*{{{*/
 // ---------------------------------------------------------------------
 /* This will hold the string in and fill the buffer with it as it empties */
@@ -191,8 +244,9 @@ void CircleBuf::FillOut()
 									/*}}}*/
 // CircleBuf::Write - Write from the buffer into a FD			/*{{{*/
 // ---------------------------------------------------------------------
-/* This empties the buffer into the FD. */
-bool CircleBuf::Write(int Fd)
+/* This empties the buffer into the FD. With a position the data is written
+   there instead of at the current offset and the position is advanced. */
+bool CircleBuf::Write(int Fd, unsigned long long * const Pos)
 {
    while (1)
    {
@@ -205,9 +259,27 @@ bool CircleBuf::Write(int Fd)
       if (OutP == MaxGet)
 	 return true;
       
-      // Write the buffer segment
+      /* Write the data in place, both parts of it in one go if it wraps
+	 around the end of the buffer */
+      struct iovec Vec[2];
+      int VecCount = 1;
+      Vec[0].iov_base = Buf + (OutP%Size);
+      Vec[0].iov_len = LeftWrite();
+      unsigned long long Wanted = InP - OutP;
+      if (InP > MaxGet)
+	 Wanted = MaxGet - OutP;
+      if (Wanted > Vec[0].iov_len)
+      {
+	 Vec[1].iov_base = Buf;
+	 Vec[1].iov_len = Wanted - Vec[0].iov_len;
+	 VecCount = 2;
+      }
+
       ssize_t Res;
-      Res = write(Fd,Buf + (OutP%Size),LeftWrite());
+      if (Pos == nullptr)
+	 Res = writev(Fd, Vec, VecCount);
+      else
+	 Res = pwritev(Fd, Vec, VecCount, *Pos);
 
       if (Res == 0)
 	 return false;
@@ -220,9 +292,19 @@ bool CircleBuf::Write(int Fd)
       }
 
       TotalWriten += Res;
+      if (Pos != nullptr)
+	 *Pos += Res;
       
       if (Hash != NULL)
-	 Hash->Add(Buf + (OutP%Size),Res);
+      {
+	 unsigned long long Done = Res;
+	 for (int I = 0; I < VecCount && Done != 0; ++I)
+	 {
+	    unsigned long long const Sz = std::min<unsigned long long>(Done, Vec[I].iov_len);
+	    Hash->Add(static_cast<unsigned char *>(Vec[I].iov_base), Sz);
+	    Done -= Sz;
+	 }
+      }
       
       OutP += Res;
    }
@@ -275,19 +357,24 @@ void CircleBuf::Stats()
    
    struct timeval Stop;
    gettimeofday(&Stop,0);
-/*   float Diff = Stop.tv_sec - Start.tv_sec + 
-             (float)(Stop.tv_usec - Start.tv_usec)/1000000;
-   clog << "Got " << InP << " in " << Diff << " at " << InP/Diff << endl;*/
+   double const Diff = Stop.tv_sec - Start.tv_sec +
+      (double)(Stop.tv_usec - Start.tv_usec)/1000000;
+   clog << "Got " << InP << " bytes with " << Reads << " reads in " << Diff << "s";
+   if (Diff > 0)
+      clog << " at " << SizeToStr(InP/Diff) << "B/s";
+   clog << " using a " << SizeToStr(Size) << "B buffer" << endl;
 }
 									/*}}}*/
 CircleBuf::~CircleBuf()
 {
-   delete [] Buf;
+   free(Buf);
    delete Hash;
 }
 
 // HttpServerState::HttpServerState - Constructor			/*{{{*/
-HttpServerState::HttpServerState(URI Srv,HttpMethod *Owner) : ServerState(Srv, Owner), In(64*1024), Out(4*1024)
+HttpServerState::HttpServerState(URI Srv,HttpMethod *Owner) : ServerState(Srv, Owner),
+   In(64*1024, _config->FindI("Acquire::http::Max-Buffer-Size", 16*1024*1024)), Out(4*1024),
+   SegmentsAllowed(true)
 {
    TimeOut = _config->FindI("Acquire::http::Timeout",TimeOut);
    Reset();
@@ -366,6 +453,8 @@ bool HttpServerState::Open()
 /* */
 bool HttpServerState::Close()
 {
+   if (ServerFd != -1 && Owner->Debug == true)
+      In.Stats();
    close(ServerFd);
    ServerFd = -1;
    return true;
@@ -439,6 +528,10 @@ bool HttpServerState::RunData(FileFd * const File)
    }
    else
    {
+      unsigned long long const Segments = SegmentCount();
+      if (Segments > 1)
+	 return RunSegments(File, Segments);
+
       /* Closes encoding is used when the server did not specify a size, the
          loss of the connection means we are done */
       if (Persistent == false)
@@ -461,6 +554,217 @@ bool HttpServerState::RunData(FileFd * const File)
    }
 
    return Owner->Flush() && !_error->PendingError();
+}
+									/*}}}*/
+// HttpServerState::SegmentCount - Connections to fetch the body with	/*{{{*/
+// ---------------------------------------------------------------------
+/* Big files can be split into byte ranges fetched on connections of their
+   own if the server supports ranges and the user asked for it with
+   Acquire::http::Segments. Returns 1 if the body is fetched as usual. */
+unsigned long long HttpServerState::SegmentCount() const
+{
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+   if (SegmentsAllowed == false || Result != 200 || AcceptRanges == false || Encoding != Stream || Persistent == false ||
+	 JunkSize != 0 || StartPos != 0 || DownloadSize != TotalFileSize ||
+	 (MaximumSize != 0 && TotalFileSize > MaximumSize) ||
+	 _config->FindI("Acquire::http::Dl-Limit",0) != 0)
+      return 1;
+   long const Segments = _config->FindI("Acquire::http::Segments", 1);
+   unsigned long long const MinSize = std::max(1, _config->FindI("Acquire::http::Segment-Min-Size", 32*1024*1024));
+   if (Segments <= 1 || TotalFileSize < 2 * MinSize)
+      return 1;
+   return std::min<unsigned long long>(Segments, TotalFileSize / MinSize);
+#else
+   return 1;
+#endif
+}
+									/*}}}*/
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+namespace {
+struct HttpSegment
+{
+   // the next byte to fetch and the byte after the last
+   unsigned long long Pos;
+   unsigned long long End;
+   std::unique_ptr<HttpServerState> Server;
+   std::thread Thread;
+   bool Result;
+   std::vector<std::pair<bool, std::string>> Messages;
+};
+}
+// FetchSegment - Receive the requested range into the file		/*{{{*/
+// ---------------------------------------------------------------------
+/* The request is already in the output buffer. This runs without the
+   select loop of Go() as it may run in its own thread, so it must not talk
+   to apt: the caller reports the errors. */
+static bool FetchSegment(HttpSegment &Seg, int const Fd, unsigned long long const TotalFileSize)
+{
+   HttpServerState &Srv = *Seg.Server;
+   bool Open = true;
+   while (Srv.Out.WriteSpace() == true)
+   {
+      if (WaitFd(Srv.ServerFd, true, Srv.TimeOut) == false)
+	 return _error->Error(_("Connection timed out"));
+      if (Srv.Out.Write(Srv.ServerFd) == false)
+	 return _error->Errno("write", _("Error writing to the server"));
+   }
+
+   std::string Data;
+   while (Srv.In.WriteTillEl(Data) == false)
+   {
+      if (Open == false || Srv.In.ReadSpace() == false)
+	 return _error->Error(_("Error reading from server. Remote end closed connection"));
+      if (WaitFd(Srv.ServerFd, false, Srv.TimeOut) == false)
+	 return _error->Error(_("Connection timed out"));
+      Open = Srv.In.Read(Srv.ServerFd);
+   }
+   for (string::const_iterator I = Data.begin(); I < Data.end(); ++I)
+   {
+      string::const_iterator J = I;
+      for (; J != Data.end() && *J != '\n' && *J != '\r'; ++J);
+      if (Srv.HeaderLine(string(I,J)) == false)
+	 return false;
+      I = J;
+   }
+   if (Srv.Result != 206 || Srv.StartPos != Seg.Pos || Srv.TotalFileSize != TotalFileSize)
+      return _error->Error(_("This HTTP server has broken range support"));
+
+   Srv.State = ServerState::Data;
+   Srv.In.Limit(Seg.End - Seg.Pos);
+   while (Srv.In.IsLimit() == false)
+   {
+      if (Srv.In.WriteSpace() == true)
+      {
+	 if (Srv.In.Write(Fd, &Seg.Pos) == false)
+	    return _error->Errno("write",_("Error writing to file"));
+	 continue;
+      }
+      if (Open == false)
+	 return _error->Error(_("Error reading from server. Remote end closed connection"));
+      if (WaitFd(Srv.ServerFd, false, Srv.TimeOut) == false)
+	 return _error->Error(_("Connection timed out"));
+      Open = Srv.In.Read(Srv.ServerFd);
+   }
+   return true;
+}
+static void FetchSegmentThread(HttpSegment &Seg, int const Fd, unsigned long long const TotalFileSize)
+{
+   Seg.Result = FetchSegment(Seg, Fd, TotalFileSize);
+   // our caller lives in another thread, so hand our messages over
+   while (_error->empty(GlobalError::DEBUG) == false)
+   {
+      std::string Msg;
+      bool const Type = _error->PopMessage(Msg);
+      Seg.Messages.emplace_back(Type, Msg);
+   }
+}
+									/*}}}*/
+#endif
+// HttpServerState::RunSegments - Fetch the body in ranges		/*{{{*/
+// ---------------------------------------------------------------------
+/* This connection receives the first range while the others are requested
+   on new connections (opened here as that talks to apt) and written with
+   pwrite into the file in threads of their own. The rest of the body we
+   got requested is ignored by closing this connection afterwards. A range
+   which failed is tried again on a new connection before giving up and as
+   each connection only hashed a part, the whole file is hashed at the end. */
+bool HttpServerState::RunSegments(FileFd * const File, unsigned long long const Count)
+{
+#if defined(_POSIX_THREADS) && defined(HAVE_PTHREAD)
+   HttpMethod * const Http = static_cast<HttpMethod *>(Owner);
+   pkgAcqMethod::FetchItem const * const Itm = Http->Queue;
+   unsigned long long const SegmentSize = TotalFileSize / Count;
+
+   auto const StartSegment = [&](HttpSegment &Seg) {
+      Seg.Result = false;
+      Seg.Server.reset(new HttpServerState(ServerName, Http));
+      if (Seg.Server->Open() == false)
+	 return false;
+      if (Owner->Debug == true)
+	 clog << "Fetching bytes " << Seg.Pos << " to " << (Seg.End - 1) << " of " << Itm->Uri << " on its own connection" << endl;
+      Seg.Server->WriteResponse(Http->BuildReq(Itm, *Seg.Server, Seg.Pos, Seg.End));
+      return true;
+   };
+
+   std::vector<HttpSegment> Segments(Count - 1);
+   for (unsigned long long I = 1; I < Count; ++I)
+   {
+      HttpSegment &Seg = Segments[I - 1];
+      Seg.Pos = I * SegmentSize;
+      Seg.End = (I == Count - 1) ? TotalFileSize : (I + 1) * SegmentSize;
+      if (StartSegment(Seg) == false)
+      {
+	 _error->Discard();
+	 continue;
+      }
+      try {
+	 Seg.Thread = std::thread(FetchSegmentThread, std::ref(Seg), File->Fd(), TotalFileSize);
+      } catch (std::system_error const &) {
+	 // fetched on the second try below
+      }
+   }
+
+   // only the assembled file can be checked
+   delete In.Hash;
+   In.Hash = nullptr;
+
+   bool Result = false;
+   In.Limit(SegmentSize);
+   do
+   {
+      if (In.IsLimit() == true)
+      {
+	 Result = true;
+	 break;
+      }
+   }
+   while (Go(true, File) == true);
+   if (Result == false)
+      Result = Owner->Flush() && In.IsLimit() == true;
+   In.Limit(-1);
+   Close();
+
+   for (auto &Seg : Segments)
+   {
+      if (Seg.Thread.joinable() == true)
+	 Seg.Thread.join();
+      if (Seg.Result == true || Result == false)
+	 continue;
+      Seg.Messages.clear();
+      if (StartSegment(Seg) == true)
+	 Seg.Result = FetchSegment(Seg, File->Fd(), TotalFileSize);
+      if (Seg.Result == false)
+      {
+	 // the retry will resume from the first missing byte on one connection
+	 Result = false;
+	 SegmentsAllowed = false;
+      }
+   }
+   // keep only what we have from the start on for a later resume
+   unsigned long long Complete = Result ? TotalFileSize : File->Tell();
+   for (auto const &Seg : Segments)
+   {
+      for (auto const &Msg : Seg.Messages)
+	 _error->Insert(Msg.first ? GlobalError::ERROR : GlobalError::WARNING, "%s", Msg.second.c_str());
+      if (Seg.Pos != Seg.End && Complete > Seg.Pos)
+	 Complete = Seg.Pos;
+   }
+   Segments.clear();
+   if (Result == false || _error->PendingError() == true)
+   {
+      if (Complete < TotalFileSize)
+	 File->Truncate(Complete);
+      return false;
+   }
+
+   In.Hash = new Hashes(Itm->ExpectedHashes);
+   FileFd Whole(Itm->DestFile, FileFd::ReadOnly);
+   if (In.Hash->AddFD(Whole) == false)
+      return _error->Errno("read",_("Problem hashing file"));
+   return true;
+#else
+   return false;
+#endif
 }
 									/*}}}*/
 bool HttpServerState::ReadHeaderLines(std::string &Data)		/*{{{*/
@@ -487,6 +791,9 @@ bool HttpServerState::InitHashes(HashStringList const &ExpectedHashes)	/*{{{*/
 {
    delete In.Hash;
    In.Hash = new Hashes(ExpectedHashes);
+   // as in Hashes::AddFD threads only pay off for big files
+   if (ExpectedHashes.FileSize() >= 1024 * 1024)
+      In.Hash->StartPipeline();
    return true;
 }
 									/*}}}*/
@@ -676,6 +983,18 @@ bool HttpServerState::Go(bool ToFile, FileFd * const File)
 // ---------------------------------------------------------------------
 /* This places the http request in the outbound buffer */
 void HttpMethod::SendReq(FetchItem *Itm)
+{
+   std::string const Req = BuildReq(Itm, *Server, 0, 0);
+
+   if (Debug == true)
+      cerr << Req << endl;
+
+   Server->WriteResponse(Req);
+}
+									/*}}}*/
+// HttpMethod::BuildReq - Build the HTTP request			/*{{{*/
+std::string HttpMethod::BuildReq(FetchItem const * const Itm, ServerState &Srv,
+      unsigned long long const RangeStart, unsigned long long const RangeEnd)
 {
    URI Uri = Itm->Uri;
 
@@ -692,7 +1011,7 @@ void HttpMethod::SendReq(FetchItem *Itm)
       but while its a must for all servers to accept absolute URIs,
       it is assumed clients will sent an absolute path for non-proxies */
    std::string requesturi;
-   if (Server->Proxy.empty() == true || Server->Proxy.Host.empty())
+   if (Srv.Proxy.empty() == true || Srv.Proxy.Host.empty())
       requesturi = Uri.Path;
    else
       requesturi = Itm->Uri;
@@ -735,15 +1054,17 @@ void HttpMethod::SendReq(FetchItem *Itm)
 
    // Check for a partial file and send if-queries accordingly
    struct stat SBuf;
-   if (stat(Itm->DestFile.c_str(),&SBuf) >= 0 && SBuf.st_size > 0)
+   if (RangeEnd != 0)
+      Req << "Range: bytes=" << RangeStart << "-" << (RangeEnd - 1) << "\r\n";
+   else if (stat(Itm->DestFile.c_str(),&SBuf) >= 0 && SBuf.st_size > 0)
       Req << "Range: bytes=" << SBuf.st_size << "-\r\n"
 	 << "If-Range: " << TimeRFC1123(SBuf.st_mtime) << "\r\n";
    else if (Itm->LastModified != 0)
       Req << "If-Modified-Since: " << TimeRFC1123(Itm->LastModified).c_str() << "\r\n";
 
-   if (Server->Proxy.User.empty() == false || Server->Proxy.Password.empty() == false)
+   if (Srv.Proxy.User.empty() == false || Srv.Proxy.Password.empty() == false)
       Req << "Proxy-Authorization: Basic "
-	 << Base64Encode(Server->Proxy.User + ":" + Server->Proxy.Password) << "\r\n";
+	 << Base64Encode(Srv.Proxy.User + ":" + Srv.Proxy.Password) << "\r\n";
 
    maybe_add_auth (Uri, _config->FindFile("Dir::Etc::netrc"));
    if (Uri.User.empty() == false || Uri.Password.empty() == false)
@@ -754,11 +1075,7 @@ void HttpMethod::SendReq(FetchItem *Itm)
 		"Debian APT-HTTP/1.3 (" PACKAGE_VERSION ")") << "\r\n";
 
    Req << "\r\n";
-
-   if (Debug == true)
-      cerr << Req.str() << endl;
-
-   Server->WriteResponse(Req.str());
+   return Req.str();
 }
 									/*}}}*/
 // HttpMethod::Configuration - Handle a configuration message		/*{{{*/
@@ -30,12 +30,16 @@ class CircleBuf
 {
    unsigned char *Buf;
    unsigned long long Size;
+   // the buffer grows up to this size if the fd has more data than fits
+   unsigned long long MaxSize;
    unsigned long long InP;
    unsigned long long OutP;
    std::string OutQueue;
    unsigned long long StrPos;
    unsigned long long MaxGet;
    struct timeval Start;
+   // syscalls needed to read InP bytes
+   unsigned long long Reads;
 
    static unsigned long long BwReadLimit;
    static unsigned long long BwTickReadData;
@@ -59,6 +63,7 @@ class CircleBuf
       return Sz;
    }
    void FillOut();
+   bool Grow();
 
    public:
    Hashes *Hash;
@@ -69,8 +74,8 @@ class CircleBuf
    bool Read(int Fd);
    bool Read(std::string Data);
 
-   // Write data out
-   bool Write(int Fd);
+   // Write data out, at the given position if any
+   bool Write(int Fd, unsigned long long * const Pos = nullptr);
    bool WriteTillEl(std::string &Data,bool Single = false);
 
    // Control the write limit
@@ -83,10 +88,10 @@ class CircleBuf
    bool WriteSpace() const {return InP - OutP > 0;};
 
    void Reset();
-   // Dump everything
+   // Print the throughput since the last Reset
    void Stats();
 
-   explicit CircleBuf(unsigned long long Size);
+   explicit CircleBuf(unsigned long long Size, unsigned long long MaxSize = 0);
    ~CircleBuf();
 };
 
@@ -96,12 +101,17 @@ struct HttpServerState: public ServerState
    CircleBuf In;
    CircleBuf Out;
    int ServerFd;
+   // cleared if fetching ranges on other connections failed
+   bool SegmentsAllowed;
 
    protected:
    virtual bool ReadHeaderLines(std::string &Data) APT_OVERRIDE;
    virtual bool LoadNextResponse(bool const ToFile, FileFd * const File) APT_OVERRIDE;
    virtual bool WriteResponse(std::string const &Data) APT_OVERRIDE;
 
+   unsigned long long SegmentCount() const;
+   bool RunSegments(FileFd * const File, unsigned long long const Count);
+
    public:
    virtual void Reset() APT_OVERRIDE { ServerState::Reset(); ServerFd = -1; };
 
@@ -124,6 +134,10 @@ class HttpMethod : public ServerMethod
 {
    public:
    virtual void SendReq(FetchItem *Itm) APT_OVERRIDE;
+   /** \brief build the request for the given item, limited to the bytes
+    *  [RangeStart, RangeEnd) if RangeEnd isn't 0 */
+   std::string BuildReq(FetchItem const * const Itm, ServerState &Srv,
+	 unsigned long long const RangeStart, unsigned long long const RangeEnd);
 
    virtual bool Configuration(std::string Message) APT_OVERRIDE;
 
@@ -153,6 +153,9 @@ bool HttpsServerState::InitHashes(HashStringList const &ExpectedHashes)	/*{{{*/
 {
    delete Hash;
    Hash = new Hashes(ExpectedHashes);
+   // as in Hashes::AddFD threads only pay off for big files
+   if (ExpectedHashes.FileSize() >= 1024 * 1024)
+      Hash->StartPipeline();
    return true;
 }
 									/*}}}*/
@@ -13,6 +13,7 @@
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/hashes.h>
 #include <apt-pkg/configuration.h>
+#include <apt-pkg/mmap.h>
 #include "aptmethod.h"
 
 #include <stddef.h>
@@ -525,10 +526,62 @@ class Patch {
       }
    }
 
+   /* The changes of all patches as one contiguous edit script: entries
+      which do nothing are dropped and neighbours which can be expressed
+      as a single change are merged */
+   std::vector<Change> compact_script()
+   {
+      std::vector<Change> script;
+      size_t unchanged = 0;
+      for (std::list<struct Change>::const_iterator ch = filechanges.begin(); ch != filechanges.end(); ++ch) {
+	 if (ch->del_cnt == 0 && ch->add_len == 0) {
+	    unchanged += ch->offset;
+	    continue;
+	 }
+	 Change c(*ch);
+	 c.offset += unchanged;
+	 unchanged = 0;
+	 /* without lines kept in between, skipping input lines and adding
+	    output lines of two changes can happen in any order */
+	 if (script.empty() == false && c.offset == 0) {
+	    Change &last = script.back();
+	    if (c.add_len == 0) {
+	       last.del_cnt += c.del_cnt;
+	       continue;
+	    } else if (last.add_len == 0 || last.add + last.add_len == c.add) {
+	       last.del_cnt += c.del_cnt;
+	       if (last.add_len == 0)
+		  last.add = c.add;
+	       last.add_cnt += c.add_cnt;
+	       last.add_len += c.add_len;
+	       continue;
+	    }
+	 }
+	 script.push_back(c);
+      }
+      return script;
+   }
+
    void apply_against_file(FileFd &out, FileFd &in, Hashes *hash = NULL)
    {
-      std::list<struct Change>::iterator ch;
-      for (ch = filechanges.begin(); ch != filechanges.end(); ++ch) {
+      std::vector<Change> const script = compact_script();
+
+      /* Map the whole base file (compressed ones are decompressed into
+	 memory) and write the unchanged parts straight out of it */
+      if (in.Size() != 0)
+      {
+	 _error->PushToStack();
+	 MMap map(in, MMap::ReadOnly);
+	 bool const mapped = map.validData();
+	 _error->RevertToStack();
+	 if (mapped == true)
+	 {
+	    apply_against_memory(out, static_cast<char *>(map.Data()), map.Size(), script, hash);
+	    return;
+	 }
+      }
+
+      for (std::vector<Change>::const_iterator ch = script.begin(); ch != script.end(); ++ch) {
 	 dump_lines(out, in, ch->offset, hash);
 	 skip_lines(in, ch->del_cnt);
 	 dump_mem(out, ch->add, ch->add_len, hash);
@@ -536,6 +589,35 @@ class Patch {
       dump_rest(out, in, hash);
       out.Flush();
    }
+
+   private:
+   // a pointer behind the next n lines, or to the end if there are less
+   static char *find_lines(char *p, char * const end, size_t n)
+   {
+      for (; n > 0 && p < end; --n) {
+	 char * const nl = static_cast<char *>(memchr(p, '\n', end - p));
+	 if (nl == NULL)
+	    return end;
+	 p = nl + 1;
+      }
+      return p;
+   }
+
+   static void apply_against_memory(FileFd &out, char *data, size_t const size, std::vector<Change> const &script, Hashes *hash)
+   {
+      char * const end = data + size;
+      for (std::vector<Change>::const_iterator ch = script.begin(); ch != script.end(); ++ch) {
+	 char * const keep = find_lines(data, end, ch->offset);
+	 if (keep != data)
+	    dump_mem(out, data, keep - data, hash);
+	 data = find_lines(keep, end, ch->del_cnt);
+	 if (ch->add_len != 0)
+	    dump_mem(out, ch->add, ch->add_len, hash);
+      }
+      if (data != end)
+	 dump_mem(out, data, end - data, hash);
+      out.Flush();
+   }
 };
 
 class RredMethod : public aptMethod {
@@ -58,6 +58,7 @@ ServerState::RunHeadersResult ServerState::RunHeaders(FileFd * const File,
    StartPos = 0;
    Encoding = Closes;
    HaveContent = false;
+   AcceptRanges = false;
    time(&Date);
 
    do
@@ -211,6 +212,12 @@ bool ServerState::HeaderLine(string Line)
       return true;
    }
 
+   if (stringcasecmp(Tag,"Accept-Ranges:") == 0)
+   {
+      AcceptRanges = (stringcasecmp(Val,"bytes") == 0);
+      return true;
+   }
+
    if (stringcasecmp(Tag,"Transfer-Encoding:") == 0)
    {
       HaveContent = true;
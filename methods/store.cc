@@ -84,7 +84,12 @@ bool StoreMethod::Fetch(FetchItem *Itm)					/*{{{*/
    if (Itm->DestFile != "/dev/null" && Itm->DestFile != Path)
    {
       if (_config->FindB("Method::Compress", false) == false)
-	 To.Open(Itm->DestFile, FileFd::WriteOnly | FileFd::Create | FileFd::Atomic, FileFd::Extension);
+      {
+	 unsigned int Mode = FileFd::WriteOnly | FileFd::Create | FileFd::Atomic;
+	 if (_config->FindB("Acquire::SeekableIndexes", true) == true)
+	    Mode |= FileFd::Seekable;
+	 To.Open(Itm->DestFile, Mode, FileFd::Extension);
+      }
       else if (OpenFileWithCompressorByName(To, Itm->DestFile, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, Prog) == false)
 	    return false;
 
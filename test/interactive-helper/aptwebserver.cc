@@ -22,6 +22,7 @@
 
 #include <algorithm>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <list>
 #include <string>
@@ -150,16 +151,18 @@ static bool sendHead(int const client, int const httpcode, std::list<std::string
    return Success;
 }
 									/*}}}*/
-static bool sendFile(int const client, std::list<std::string> const &headers, FileFd &data)/*{{{*/
+static bool sendFile(int const client, std::list<std::string> const &headers, FileFd &data,/*{{{*/
+      unsigned long long left = std::numeric_limits<unsigned long long>::max())
 {
    bool Success = true;
    bool const chunked = chunkedTransferEncoding(headers);
    char buffer[500];
    unsigned long long actual = 0;
-   while ((Success &= data.Read(buffer, sizeof(buffer), &actual)) == true)
+   while (left != 0 && (Success &= data.Read(buffer, std::min<unsigned long long>(sizeof(buffer), left), &actual)) == true)
    {
       if (actual == 0)
 	 break;
+      left -= actual;
 
       if (chunked == true)
       {
@@ -727,28 +730,27 @@ static void * handleClient(void * voidclient)				/*{{{*/
 	       {
 		  size_t start = 6;
 		  unsigned long long filestart = strtoull(condition.c_str() + start, NULL, 10);
-		  // FIXME: no support for last-byte-pos being not the end of the file (APT clients do not do this)
 		  size_t dash = condition.find('-') + 1;
 		  unsigned long long fileend = strtoull(condition.c_str() + dash, NULL, 10);
 		  unsigned long long filesize = data.FileSize();
-		  if ((fileend == 0 || (fileend == filesize && fileend >= filestart)) &&
-			validrange == true)
+		  if ((fileend == 0 || fileend >= filestart) && validrange == true)
 		  {
 		     if (filesize > filestart)
 		     {
+			unsigned long long const lastbyte = (fileend == 0 || fileend >= filesize) ? filesize - 1 : fileend;
 			data.Skip(filestart);
                         // make sure to send content-range before conent-length
                         // as regression test for LP: #1445239
 			std::ostringstream contentrange;
 			contentrange << "Content-Range: bytes " << filestart << "-"
-			   << filesize - 1 << "/" << filesize;
+			   << lastbyte << "/" << filesize;
 			headers.push_back(contentrange.str());
 			std::ostringstream contentlength;
-			contentlength << "Content-Length: " << (filesize - filestart);
+			contentlength << "Content-Length: " << (lastbyte - filestart + 1);
 			headers.push_back(contentlength.str());
 			sendHead(client, 206, headers);
 			if (sendContent == true)
-			   sendFile(client, headers, data);
+			   sendFile(client, headers, data, lastbyte - filestart + 1);
 			continue;
 		     }
 		     else
@@ -0,0 +1,64 @@
+#include <config.h>
+
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/md5.h>
+#include <apt-pkg/sha1.h>
+#include <apt-pkg/sha2.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+/* Reports the throughput of each hash algorithm, once with the portable
+   implementations and once with the ones apt picks for this CPU.
+   The implementation is chosen once per process, so each run happens in a
+   child process. Usage: hashbench [MiB to hash, default 256] */
+
+template<class T> static void bench(char const * const name, std::string const &impl,
+      std::vector<unsigned char> const &data, unsigned long long const total)
+{
+   auto const start = std::chrono::steady_clock::now();
+   T sum;
+   for (unsigned long long done = 0; done < total; done += data.size())
+      sum.Add(data.data(), data.size());
+   auto const value = sum.Result().Value();
+   std::chrono::duration<double> const took = std::chrono::steady_clock::now() - start;
+   std::cout << std::left << std::setw(8) << name << std::setw(10) << impl
+      << std::right << std::fixed << std::setprecision(1) << std::setw(10)
+      << (total / (1024.0 * 1024.0)) / took.count() << " MB/s  " << value.substr(0, 16) << std::endl;
+}
+
+int main(int argc, char ** argv)
+{
+   unsigned long long const total = ((argc > 1) ? strtoull(argv[1], nullptr, 10) : 256) * 1024 * 1024;
+   std::vector<unsigned char> data(1024 * 1024);
+   for (size_t i = 0; i < data.size(); ++i)
+      data[i] = (i * 2654435761u) >> 24;
+
+   for (auto const impl : { "portable", "native" })
+   {
+      pid_t const child = fork();
+      if (child == -1)
+	 return 1;
+      if (child == 0)
+      {
+	 _config->Set("APT::Hashes-Hardware", std::string(impl) != "portable");
+	 bench<MD5Summation>("MD5", impl, data, total);
+	 bench<SHA1Summation>("SHA1", impl, data, total);
+	 bench<SHA256Summation>("SHA256", impl, data, total);
+	 bench<SHA512Summation>("SHA512", impl, data, total);
+	 return 0;
+      }
+      int status;
+      if (waitpid(child, &status, 0) != child || WIFEXITED(status) == false || WEXITSTATUS(status) != 0)
+	 return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,82 @@
+#include <config.h>
+
+#include <apt-pkg/debversion.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/tagfile.h>
+
+#include <string.h>
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <set>
+#include <string>
+#include <vector>
+
+/* Compares all pairs of the versions found in the given index file once
+   with CmpVersion and once with the sort keys of the versions (falling
+   back to CmpVersion for equal keys) and reports the time each needed and
+   if the results differ. Usage: versionbench [file, default the dpkg status] */
+
+template<class F> static long long bench(char const * const name, size_t const count, F const &compare)
+{
+   auto const start = std::chrono::steady_clock::now();
+   long long sum = 0;
+   for (size_t a = 0; a < count; ++a)
+      for (size_t b = 0; b < count; ++b)
+      {
+	 int const Res = compare(a, b);
+	 sum = sum * 3 + ((Res < 0) ? -1 : ((Res > 0) ? 1 : 0));
+      }
+   std::chrono::duration<double> const took = std::chrono::steady_clock::now() - start;
+   std::cout << std::left << std::setw(10) << name << std::right << std::fixed << std::setprecision(1)
+      << std::setw(10) << (count * count) / took.count() / 1000000 << " M/s" << std::endl;
+   return sum;
+}
+
+int main(int argc, char ** argv)
+{
+   char const * const filename = (argc > 1) ? argv[1] : "/var/lib/dpkg/status";
+   FileFd fd;
+   if (fd.Open(filename, FileFd::ReadOnly, FileFd::Extension) == false)
+      return 1;
+   std::set<std::string> unique;
+   pkgTagFile tags(&fd);
+   pkgTagSection section;
+   while (tags.Step(section) == true && unique.size() < 3000)
+   {
+      std::string const version = section.FindS("Version");
+      if (version.empty() == false)
+	 unique.insert(version);
+   }
+   std::vector<std::string> const versions(unique.begin(), unique.end());
+
+   std::vector<std::string> keys(versions.size());
+   size_t withkey = 0;
+   for (size_t i = 0; i < versions.size(); ++i)
+      if (debVersioningSystem::SortKey(versions[i].c_str(), versions[i].c_str() + versions[i].length(), keys[i]) == true)
+	 ++withkey;
+   std::cout << versions.size() << " versions, " << withkey << " with a key" << std::endl;
+
+   long long const full = bench("CmpVersion", versions.size(), [&](size_t const a, size_t const b) {
+      return debVS.CmpVersion(versions[a], versions[b]);
+   });
+   size_t fallbacks = 0;
+   long long const keyed = bench("SortKey", versions.size(), [&](size_t const a, size_t const b) {
+      if (keys[a].empty() == false && keys[b].empty() == false)
+      {
+	 int const Res = strcmp(keys[a].c_str(), keys[b].c_str());
+	 if (Res != 0)
+	    return Res;
+      }
+      ++fallbacks;
+      return debVS.CmpVersion(versions[a], versions[b]);
+   });
+   std::cout << fallbacks << " comparisons fell back to CmpVersion" << std::endl;
+   if (full != keyed)
+   {
+      std::cout << "The results differ!" << std::endl;
+      return 1;
+   }
+   return 0;
+}
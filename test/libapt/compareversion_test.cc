@@ -25,6 +25,7 @@
 #include <fstream>
 #include <string>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
 
@@ -58,6 +59,15 @@ static bool callDPKG(const char *val, const char *ref, const char &op) {
    Res = (Res < 0) ? -1 : ( (Res > 0) ? 1 : Res); \
    EXPECT_EQ(compare, Res) << "APT: A: »" << A << "« B: »" << B << "«"; \
    EXPECT_PRED3(callDPKG, A, B, compare); \
+   std::string KeyA, KeyB; \
+   if (debVS.SortKey(A, A + strlen(A), KeyA) && debVS.SortKey(B, B + strlen(B), KeyB)) \
+   { \
+      int const KeyRes = strcmp(KeyA.c_str(), KeyB.c_str()); \
+      if (KeyRes != 0) \
+      { \
+	 EXPECT_EQ(compare, (KeyRes < 0) ? -1 : 1) << "SortKey: A: »" << A << "« B: »" << B << "«"; \
+      } \
+   } \
 }
 #define EXPECT_VERSION(A, compare, B) \
    EXPECT_VERSION_PART(A, compare, B); \
@@ -178,3 +188,26 @@ TEST(CompareVersionTest,CuptTests)
    EXPECT_VERSION("2.2.4-47978_Debian_lenny", EQUAL, "2.2.4-47978_Debian_lenny"); // and underscore...
    // */
 }
+TEST(CompareVersionTest,SortKey)
+{
+   std::string Key, Other;
+   char const * const Ver = "1.0";
+   EXPECT_TRUE(debVS.SortKey(Ver, Ver + strlen(Ver), Key));
+   EXPECT_EQ(std::string::npos, Key.find('\0'));
+   // zero epochs, missing revisions and leading zeros are the same version
+   for (auto const Same : { "0:1.0", "1.0-0", "00:01.00-00" })
+   {
+      EXPECT_TRUE(debVS.SortKey(Same, Same + strlen(Same), Other));
+      EXPECT_EQ(Key, Other) << Same;
+   }
+   // versions the keys can't order
+   for (auto const Bad : { "", "-1", "1.0\xc3\xa4", "1 0" })
+      EXPECT_FALSE(debVS.SortKey(Bad, Bad + strlen(Bad), Other)) << Bad;
+   // long versions have cut keys which need the full comparison
+   std::string const Long = "1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.";
+   EXPECT_TRUE(debVS.SortKey(Long.c_str(), Long.c_str() + Long.length(), Key));
+   std::string const Longer = Long + "17";
+   EXPECT_TRUE(debVS.SortKey(Longer.c_str(), Longer.c_str() + Longer.length(), Other));
+   EXPECT_EQ(Key, Other);
+   EXPECT_VERSION(Long.c_str(), LESS, Longer.c_str());
+}
@@ -10,11 +10,12 @@ class Stream : public pkgDirStream
 {
    public:
     int count;
-    Stream () { count = 0; }
-    virtual bool DoItem(Item &Itm,int &Fd) { (void)Itm; (void)Fd; count++; return true; }
+    unsigned long long bytes;
+    Stream () { count = 0; bytes = 0; }
+    virtual bool DoItem(Item &Itm,int &Fd) { (void)Itm; Fd = -2; count++; return true; }
     virtual bool Fail(Item &Itm,int Fd) { (void)Itm; (void)Fd; return true; }
     virtual bool FinishedFile(Item &Itm,int Fd) { (void)Itm; (void)Fd; return true; }
-    virtual bool Process(Item &Itm,const unsigned char * Data, unsigned long Size,unsigned long Pos) { (void)Itm; (void) Data; (void) Size; (void) Pos; return true; }
+    virtual bool Process(Item &Itm,const unsigned char * Data, unsigned long long Size,unsigned long long Pos) { (void)Itm; (void) Data; (void) Pos; bytes += Size; return true; }
     virtual ~Stream() {}
 };
 
@@ -39,3 +40,24 @@ TEST(ExtractTar, ExtractTar)
         EXPECT_EQ(stream.count, 1);
     }
 }
+
+TEST(ExtractTar, ManyFiles)
+{
+    // sizes around the block size and bigger than the read buffer
+    EXPECT_EQ(system("rm -rf extracttar && mkdir extracttar && cd extracttar && "
+	     "head -c 511 /dev/zero > a && head -c 512 /dev/zero > b && head -c 513 /dev/zero > c && "
+	     "head -c 300000 /dev/urandom > d && touch e && tar c a b c d e 2>/dev/null | xz > ../tar.txz"), 0);
+    EXPECT_EQ(system("rm -rf extracttar"), 0);
+
+    FileFd fd("tar.txz", FileFd::ReadOnly);
+    unlink("tar.txz");
+    ExtractTar tar(fd, -1, "xz");
+    Stream stream;
+    EXPECT_TRUE(tar.Go(stream));
+    if (_error->PendingError()) {
+        _error->DumpErrors();
+        EXPECT_FALSE(true);
+    }
+    EXPECT_EQ(5, stream.count);
+    EXPECT_EQ(511 + 512 + 513 + 300000, stream.bytes);
+}
@@ -9,8 +9,10 @@
 #include <algorithm>
 #include <string>
 #include <vector>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 
 #include <gtest/gtest.h>
 
@@ -165,7 +167,7 @@ static void TestFileFd(mode_t const a_umask, mode_t const ExpectedFilePermission
 static void TestFileFd(unsigned int const filemode)
 {
    auto const compressors = APT::Configuration::getCompressors();
-   EXPECT_EQ(7, compressors.size());
+   EXPECT_EQ(8, compressors.size());
    bool atLeastOneWasTested = false;
    for (auto const &c: compressors)
    {
@@ -189,7 +191,7 @@ TEST(FileUtlTest, FileFD)
    _config->Set("APT::Compressor::rev::Binary", "rev");
    _config->Set("APT::Compressor::rev::Cost", 10);
    auto const compressors = APT::Configuration::getCompressors(false);
-   EXPECT_EQ(7, compressors.size());
+   EXPECT_EQ(8, compressors.size());
    EXPECT_TRUE(std::any_of(compressors.begin(), compressors.end(), [](APT::Configuration::Compressor const &c) { return c.Name == "rev"; }));
 
    std::string const startdir = SafeGetCWD();
@@ -203,6 +205,7 @@ TEST(FileUtlTest, FileFD)
    TestFileFd(FileFd::WriteOnly | FileFd::Create | FileFd::Exclusive);
    TestFileFd(FileFd::WriteOnly | FileFd::Atomic);
    TestFileFd(FileFd::WriteOnly | FileFd::Create | FileFd::Atomic);
+   TestFileFd(FileFd::WriteOnly | FileFd::Create | FileFd::Seekable);
    // short-hands for ReadWrite with these modes
    TestFileFd(FileFd::WriteEmpty);
    TestFileFd(FileFd::WriteAny);
@@ -212,6 +215,219 @@ TEST(FileUtlTest, FileFD)
    EXPECT_EQ(0, chdir(startdir.c_str()));
    removeDirectory(tempdir);
 }
+static void TestSeekableFileFd(APT::Configuration::Compressor const &compressor, size_t const lines)
+{
+   SCOPED_TRACE(compressor.Name + " with " + std::to_string(lines) + " lines");
+   std::string content;
+   for (size_t i = 0; i < lines; ++i)
+      content.append("Line: " + std::to_string(1000000 + i) + "\n");
+
+   static const char* fname = "apt-filefd-seekable";
+   FileFd f;
+   ASSERT_TRUE(f.Open(fname, FileFd::WriteOnly | FileFd::Create | FileFd::Empty | FileFd::Seekable, compressor));
+   // write in odd pieces to cross the chunk boundaries in every possible way
+   for (size_t i = 0; i < content.size(); i += 4099)
+      ASSERT_TRUE(f.Write(content.c_str() + i, std::min<size_t>(4099, content.size() - i)));
+   ASSERT_TRUE(f.Close());
+
+   ASSERT_TRUE(f.Open(fname, FileFd::ReadOnly, compressor));
+   EXPECT_TRUE(f.IsRandomAccess());
+   EXPECT_EQ(content.size(), f.Size());
+   std::string readback(content.size(), '\0');
+   ASSERT_TRUE(f.Read(&readback[0], content.size()));
+   EXPECT_EQ(content, readback);
+   unsigned long long actual = 1;
+   char c;
+   EXPECT_TRUE(f.Read(&c, 1, &actual));
+   EXPECT_EQ(0, actual);
+
+   for (size_t const i : { lines - 1, size_t(0), lines / 2, lines / 3, lines - 2, size_t(1), size_t(4681), size_t(4680) })
+   {
+      if (i >= lines)
+	 continue;
+      char line[14];
+      size_t const pos = i * sizeof(line);
+      ASSERT_TRUE(f.Seek(pos)) << i;
+      EXPECT_EQ(pos, f.Tell());
+      ASSERT_TRUE(f.Read(line, sizeof(line)));
+      EXPECT_EQ(content.substr(pos, sizeof(line)), std::string(line, sizeof(line)));
+      EXPECT_EQ(pos + sizeof(line), f.Tell());
+   }
+   f.Close();
+
+   // the result is a normal file for everyone else
+   ASSERT_TRUE(f.Open(fname, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, compressor));
+   ASSERT_TRUE(f.Write(content.c_str(), content.size()));
+   ASSERT_TRUE(f.Close());
+   ASSERT_TRUE(f.Open(fname, FileFd::ReadOnly, compressor));
+   EXPECT_FALSE(f.IsRandomAccess());
+   f.Close();
+   EXPECT_EQ(0, unlink(fname));
+}
+TEST(FileUtlTest, SeekableFileFd)
+{
+   std::string const startdir = SafeGetCWD();
+   std::string tempdir;
+   createTemporaryDirectory("seekable", tempdir);
+   EXPECT_EQ(0, chdir(tempdir.c_str()));
+
+   for (auto const &c: APT::Configuration::getCompressors())
+   {
+      if (c.Name != "gzip" && c.Name != "lz4")
+	 continue;
+      // chunks are 64 KiB, lines 14 bytes
+      for (size_t const lines : { 1, 4681, 4682, 30000 })
+	 TestSeekableFileFd(c, lines);
+   }
+
+   EXPECT_EQ(0, chdir(startdir.c_str()));
+   removeDirectory(tempdir);
+}
+static void TestThreadedCompressor(APT::Configuration::Compressor compressor, std::string const &threads, std::string const &content)
+{
+   compressor.CompressArgs.push_back(threads);
+   std::string const fname = "threaded" + compressor.Extension;
+   FileFd f;
+   ASSERT_TRUE(f.Open(fname, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, compressor));
+   for (size_t i = 0; i < content.size(); i += 40009)
+      ASSERT_TRUE(f.Write(content.c_str() + i, std::min<size_t>(40009, content.size() - i)));
+   EXPECT_EQ(content.size(), f.Tell());
+   ASSERT_TRUE(f.Close());
+
+   // read with a plain decompressor
+   compressor.CompressArgs.pop_back();
+   ASSERT_TRUE(f.Open(fname, FileFd::ReadOnly, compressor));
+   std::string readback(content.size(), '\0');
+   ASSERT_TRUE(f.Read(&readback[0], content.size()));
+   EXPECT_EQ(content, readback);
+   unsigned long long actual = 1;
+   char c;
+   EXPECT_TRUE(f.Read(&c, 1, &actual));
+   EXPECT_EQ(0, actual);
+   f.Close();
+   EXPECT_EQ(0, unlink(fname.c_str()));
+}
+static void TestThreadedCompressorWriteError(APT::Configuration::Compressor compressor, std::string const &threads, std::string const &content)
+{
+   compressor.CompressArgs.push_back(threads);
+   std::string const fname = "threaded-error" + compressor.Extension;
+   FileFd f;
+   ASSERT_TRUE(f.Open(fname, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, compressor));
+
+   // let writing the blocks fail after the header
+   struct rlimit old, small;
+   ASSERT_EQ(0, getrlimit(RLIMIT_FSIZE, &old));
+   small = old;
+   small.rlim_cur = 16 * 1024;
+   sighandler_t const oldhandler = signal(SIGXFSZ, SIG_IGN);
+   ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &small));
+   for (size_t i = 0; i < content.size() && f.Failed() == false; i += 40009)
+      f.Write(content.c_str() + i, std::min<size_t>(40009, content.size() - i));
+   // the failure might only be noticed on close, but it has to be noticed
+   EXPECT_FALSE(f.Close());
+   EXPECT_EQ(0, setrlimit(RLIMIT_FSIZE, &old));
+   signal(SIGXFSZ, oldhandler);
+   EXPECT_TRUE(_error->PendingError());
+   _error->Discard();
+   EXPECT_EQ(0, unlink(fname.c_str()));
+}
+TEST(FileUtlTest, ThreadedCompressors)
+{
+   std::string const startdir = SafeGetCWD();
+   std::string tempdir;
+   createTemporaryDirectory("threaded", tempdir);
+   EXPECT_EQ(0, chdir(tempdir.c_str()));
+
+   std::string content;
+   for (size_t i = 0; content.size() < 5 * 1024 * 1024; ++i)
+      content.append("Package: pkg").append(std::to_string(i * 7919 % 100003)).append("\n");
+
+   for (auto const &c: APT::Configuration::getCompressors())
+   {
+      if (c.Name == "gzip")
+      {
+	 // more than one block, just one block and nothing at all
+	 TestThreadedCompressor(c, "-p4", content);
+	 TestThreadedCompressor(c, "--processes=2", content.substr(0, 1000));
+	 TestThreadedCompressor(c, "-p2", "");
+	 TestThreadedCompressorWriteError(c, "-p2", content);
+      }
+      else if (c.Name == "xz")
+      {
+	 // the blocks of xz -1 are 3 MiB
+	 auto fast = c;
+	 fast.CompressArgs = { "-1" };
+	 TestThreadedCompressor(fast, "-T2", content);
+	 TestThreadedCompressor(fast, "--threads=0", "");
+      }
+   }
+
+   EXPECT_EQ(0, chdir(startdir.c_str()));
+   removeDirectory(tempdir);
+}
+static std::string ReadWholeFile(std::string const &fname)
+{
+   FileFd f(fname, FileFd::ReadOnly);
+   std::string content(f.FileSize(), '\0');
+   EXPECT_TRUE(f.Read(&content[0], content.size()));
+   return content;
+}
+TEST(FileUtlTest, CopyFile)
+{
+   std::string const startdir = SafeGetCWD();
+   std::string tempdir;
+   createTemporaryDirectory("copyfile", tempdir);
+   EXPECT_EQ(0, chdir(tempdir.c_str()));
+
+   std::string content;
+   for (size_t i = 0; content.size() < 3 * 1024 * 1024; ++i)
+      content.append("Package: pkg").append(std::to_string(i)).append("\n");
+   FileFd in("source", FileFd::WriteOnly | FileFd::Create | FileFd::Empty);
+   ASSERT_TRUE(in.Write(content.c_str(), content.size()));
+   ASSERT_TRUE(in.Close());
+
+   // the whole file
+   FileFd out;
+   ASSERT_TRUE(in.Open("source", FileFd::ReadOnly));
+   ASSERT_TRUE(out.Open("copy", FileFd::WriteOnly | FileFd::Create | FileFd::Empty));
+   EXPECT_TRUE(CopyFile(in, out));
+   EXPECT_EQ(content.size(), in.Tell());
+   EXPECT_EQ(content.size(), out.Tell());
+   ASSERT_TRUE(out.Close());
+   EXPECT_EQ(content, ReadWholeFile("copy"));
+
+   // from an offset to a file with content and pending writes
+   ASSERT_TRUE(in.Seek(0));
+   ASSERT_TRUE(in.Skip(1000));
+   ASSERT_TRUE(out.Open("copy", FileFd::WriteOnly | FileFd::Create | FileFd::Empty | FileFd::BufferedWrite));
+   ASSERT_TRUE(out.Write("header\n", 7));
+   EXPECT_TRUE(CopyFile(in, out));
+   ASSERT_TRUE(out.Close());
+   EXPECT_EQ("header\n" + content.substr(1000), ReadWholeFile("copy"));
+
+   // with data buffered by reading lines
+   char line[100];
+   ASSERT_TRUE(in.Seek(0));
+   ASSERT_NE(nullptr, in.ReadLine(line, sizeof(line)));
+   ASSERT_TRUE(out.Open("copy", FileFd::WriteOnly | FileFd::Create | FileFd::Empty));
+   EXPECT_TRUE(CopyFile(in, out));
+   ASSERT_TRUE(out.Close());
+   EXPECT_EQ(content.substr(strlen(line)), ReadWholeFile("copy"));
+   ASSERT_TRUE(in.Close());
+
+   // an empty file
+   ASSERT_TRUE(in.Open("empty", FileFd::WriteOnly | FileFd::Create | FileFd::Empty));
+   ASSERT_TRUE(in.Close());
+   ASSERT_TRUE(in.Open("empty", FileFd::ReadOnly));
+   ASSERT_TRUE(out.Open("copy", FileFd::WriteOnly | FileFd::Create | FileFd::Empty));
+   EXPECT_TRUE(CopyFile(in, out));
+   ASSERT_TRUE(out.Close());
+   ASSERT_TRUE(in.Close());
+   EXPECT_EQ("", ReadWholeFile("copy"));
+
+   EXPECT_EQ(0, chdir(startdir.c_str()));
+   removeDirectory(tempdir);
+}
 TEST(FileUtlTest, Glob)
 {
    std::vector<std::string> files;
@@ -8,6 +8,7 @@
 #include <apt-pkg/hashes.h>
 #include <apt-pkg/fileutl.h>
 
+#include <algorithm>
 #include <iostream>
 #include <stdlib.h>
 #include <string>
@@ -295,6 +296,55 @@ TEST(HashSumsTest, FileBased)
    EXPECT_FALSE(similar == hashes);
    EXPECT_TRUE(similar != hashes);
 }
+static HashStringList PipelineHashes(std::string const &data, FileFd &fd, bool const pipeline, int const how)
+{
+   _config->Set("APT::Hashes-Pipeline", pipeline);
+   Hashes hashes;
+   EXPECT_TRUE(fd.Seek(0));
+   switch (how)
+   {
+      case 0: EXPECT_TRUE(hashes.AddFD(fd)); break;
+      case 1: EXPECT_TRUE(hashes.AddFD(fd, data.size())); break;
+      case 2: EXPECT_TRUE(hashes.AddFD(fd.Fd())); break;
+      case 3:
+	 EXPECT_EQ(pipeline, hashes.StartPipeline());
+	 // odd pieces to have them spread over the blocks
+	 for (size_t i = 0; i < data.size(); i += 10007)
+	    EXPECT_TRUE(hashes.Add(reinterpret_cast<unsigned char const *>(data.c_str()) + i, std::min<size_t>(10007, data.size() - i)));
+	 break;
+   }
+   return hashes.GetHashStringList();
+}
+TEST(HashSumsTest, Pipeline)
+{
+   std::string data;
+   for (size_t i = 0; data.size() < 3 * 1024 * 1024 + 42; ++i)
+      data.append(std::to_string(i * 2654435761u));
+   FileFd fd;
+   createTemporaryFile("hashpipeline", fd, nullptr, data.c_str());
+
+   for (int how = 0; how < 4; ++how)
+   {
+      SCOPED_TRACE(how);
+      HashStringList const serial = PipelineHashes(data, fd, false, how);
+      HashStringList const pipelined = PipelineHashes(data, fd, true, how);
+      EXPECT_EQ(5, serial.size());
+      EXPECT_EQ(data.size(), serial.FileSize());
+      EXPECT_EQ(data.size(), pipelined.FileSize());
+      for (auto const &hs : serial)
+      {
+	 HashString const * const other = pipelined.find(hs.HashType());
+	 ASSERT_NE(nullptr, other);
+	 EXPECT_EQ(hs.HashValue(), other->HashValue()) << hs.HashType();
+      }
+   }
+
+   // a single hash isn't worth the threads
+   _config->Set("APT::Hashes-Pipeline", true);
+   Hashes sha256(Hashes::SHA256SUM);
+   EXPECT_FALSE(sha256.StartPipeline());
+   _config->Clear("APT::Hashes-Pipeline");
+}
 TEST(HashSumsTest, HashStringList)
 {
    _config->Clear("Acquire::ForceHash");
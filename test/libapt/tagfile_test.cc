@@ -8,6 +8,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <sstream>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -184,6 +185,45 @@ TEST(TagFileTest, PickedUpFromPreviousCall)
    }
 }
 
+TEST(TagFileTest, BlockBoundaries)
+{
+   // the scanner classifies the section in blocks of 64 bytes, so move
+   // newlines, colons and continuation lines over these boundaries
+   for (size_t shift = 0; shift < 70; ++shift)
+   {
+      std::string const pad(shift, 'x');
+      std::string content =
+	 "Package: " + pad + "\n"
+	 "Long-" + pad + ": " + std::string(130, 'y') + "\n"
+	 "Multi-Line: first" + pad + "\n"
+	 " second: line\n"
+	 " .\n"
+	 "Empty:\n"
+	 "X" + pad + ":" + pad + "\n"
+	 "Last: value\n"
+	 "\n";
+
+      SCOPED_TRACE(shift);
+      pkgTagSection section;
+      ASSERT_TRUE(section.Scan(content.c_str(), content.size()));
+      EXPECT_EQ(6, section.Count());
+      EXPECT_EQ(pad, section.FindS("Package"));
+      EXPECT_EQ(std::string(130, 'y'), section.FindS(("Long-" + pad).c_str()));
+      EXPECT_EQ("first" + pad + "\n second: line\n .", section.FindS("Multi-Line"));
+      EXPECT_TRUE(section.Exists("Empty"));
+      EXPECT_EQ("", section.FindS("Empty"));
+      EXPECT_EQ(pad, section.FindS(("X" + pad).c_str()));
+      EXPECT_EQ("value", section.FindS("Last"));
+
+      // a truncated section is incomplete, wherever it ends
+      for (size_t cut = 1; cut < content.size() - 1; cut += 7)
+      {
+	 pkgTagSection partial;
+	 EXPECT_FALSE(partial.Scan(content.c_str(), cut)) << cut;
+      }
+   }
+}
+
 TEST(TagFileTest, SpacesEverywhere)
 {
    std::string content =
@@ -283,3 +323,58 @@ TEST(TagFileTest, Comments)
 
    EXPECT_FALSE(tfile.Step(section));
 }
+
+static void checkWholeFile(FileFd &fd)
+{
+   pkgTagFile tfile(&fd, pkgTagFile::MMAP);
+   pkgTagSection section;
+   std::vector<unsigned long> offsets;
+   for (size_t i = 0; i < 100; ++i)
+   {
+      offsets.push_back(tfile.Offset());
+      ASSERT_TRUE(tfile.Step(section)) << i;
+      EXPECT_EQ(2, section.Count());
+      EXPECT_EQ("pkg" + std::to_string(i), section.FindS("Package"));
+   }
+   EXPECT_FALSE(tfile.Step(section));
+
+   // jumping is just moving around in the buffer
+   for (size_t i = 100; i-- > 0;)
+   {
+      ASSERT_TRUE(tfile.Jump(section, offsets[i])) << i;
+      EXPECT_EQ("pkg" + std::to_string(i), section.FindS("Package"));
+      EXPECT_EQ(std::to_string(i), section.FindS("Version"));
+   }
+   // jumping doesn't consume the section
+   ASSERT_TRUE(tfile.Jump(section, offsets[98]));
+   ASSERT_TRUE(tfile.Step(section));
+   EXPECT_EQ("pkg98", section.FindS("Package"));
+   ASSERT_TRUE(tfile.Step(section));
+   EXPECT_EQ("pkg99", section.FindS("Package"));
+   EXPECT_FALSE(tfile.Step(section));
+   EXPECT_FALSE(tfile.Jump(section, offsets[99] + 1000));
+}
+TEST(TagFileTest, WholeFile)
+{
+   std::string content;
+   for (size_t i = 0; i < 100; ++i)
+      content.append("Package: pkg" + std::to_string(i) + "\nVersion: " + std::to_string(i) + "\n\n");
+   // no trailing newlines at the end of the file
+   content.erase(content.length() - 2);
+
+   FileFd fd;
+   createTemporaryFile("wholefile", fd, NULL, content.c_str());
+   checkWholeFile(fd);
+
+   std::string compressed;
+   createTemporaryFile("wholefile.XXXXXX.gz", fd, &compressed, NULL);
+   fd.Close();
+   ASSERT_TRUE(fd.Open(compressed, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, FileFd::Gzip));
+   ASSERT_TRUE(fd.Write(content.c_str(), content.length()));
+   ASSERT_TRUE(fd.Close());
+   ASSERT_TRUE(fd.Open(compressed, FileFd::ReadOnly, FileFd::Gzip));
+   EXPECT_TRUE(fd.IsCompressed());
+   checkWholeFile(fd);
+   fd.Close();
+   unlink(compressed.c_str());
+}